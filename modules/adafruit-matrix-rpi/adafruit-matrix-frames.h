@@ -0,0 +1,41 @@
+#ifndef _ADAMTX_FRAMES_H
+#define _ADAMTX_FRAMES_H
+
+#include <linux/types.h>
+
+/*
+ * Container of pre-encoded frames, written by tools/adafruit-matrix/frame_compiler
+ * and loaded into the playlist through request_firmware or a write to
+ * /dev/adamtxN. All fields are little endian. The header is followed by
+ * num_frames records of a struct adamtx_frames_entry and frame_size bytes of
+ * output words in paneldata layout. Geometry and pinout must match the display
+ * exactly, the words are clocked out as they are.
+ */
+
+#define ADAMTX_FRAMES_MAGIC		0x58544D41	// "AMTX"
+#define ADAMTX_FRAMES_VERSION	1
+#define ADAMTX_FRAMES_NUM_PINS	14
+
+typedef struct adamtx_frames_header {
+	__u32	magic;
+	__u32	version;
+	__u32	header_size;
+	__u32	rows;
+	__u32	columns;
+	__u32	addresses;
+	__u32	shift_len;
+	__u32	address_mode;
+	__u32	pwm_bits;
+	__u32	dither_frames;
+	__u32	pins[ADAMTX_FRAMES_NUM_PINS];
+	__u32	loop_mode;
+	__u32	num_frames;
+	__u32	frame_size;
+} adamtx_frames_header;
+
+typedef struct adamtx_frames_entry {
+	__u32	duration_us;
+	__u32	reserved;
+} adamtx_frames_entry;
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _ADAMTX_IOCTL_H
+#define _ADAMTX_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Userspace interface of /dev/adamtxN
+ *
+ * The device maps buffers * buffer_stride bytes. Each buffer holds
+ * dither_frames complete frames of 32 bit GPIO words laid out like the driver's
+ * own paneldata: [dither frame][address][bitplane][shift_len]. Each bitplane
+ * line is clocked out highest index first, words are masked to the pins of the
+ * pinout. A queued buffer is displayed from the next frame boundary on.
+ */
+
+#define ADAMTX_IOC_MAGIC	0xAD
+#define ADAMTX_IOC_NUM_PINS	14
+
+typedef struct adamtx_ioc_info {
+	__u32	rows;
+	__u32	columns;
+	__u32	addresses;
+	__u32	shift_len;
+	__u32	address_mode;
+	__u32	pwm_bits;
+	__u32	dither_frames;
+	__u32	buffers;
+	__u32	buffer_size;
+	__u32	buffer_stride;
+	__u32	pins[ADAMTX_IOC_NUM_PINS];
+	__u32	width;
+	__u32	height;
+} adamtx_ioc_info;
+
+// Playlist frame formats
+#define ADAMTX_FRAME_RGB		0	// width * height pixels of 3 bytes, ordered like the framebuffer
+#define ADAMTX_FRAME_ENCODED	1	// buffer_size bytes of output words
+
+// Playlist loop modes
+#define ADAMTX_LOOP_ONCE		0	// Back to the framebuffer after the last frame
+#define ADAMTX_LOOP_REPEAT		1
+#define ADAMTX_LOOP_PINGPONG	2
+
+typedef struct adamtx_ioc_playlist {
+	__u32	frames;
+} adamtx_ioc_playlist;
+
+typedef struct adamtx_ioc_frame {
+	__u32	index;
+	__u32	format;
+	__u32	duration_us;
+	__u32	length;
+	__u64	data;
+} adamtx_ioc_frame;
+
+typedef struct adamtx_ioc_play {
+	__u32	mode;
+	__u32	first;
+	__u32	count;
+} adamtx_ioc_play;
+
+#define ADAMTX_IOC_GET_INFO	_IOR(ADAMTX_IOC_MAGIC, 0, struct adamtx_ioc_info)
+// Queues a buffer index for display, replaces a buffer queued before
+#define ADAMTX_IOC_QUEUE	_IOW(ADAMTX_IOC_MAGIC, 1, __u32)
+// Waits until the queued buffer is on display, returns its index
+#define ADAMTX_IOC_WAIT		_IO(ADAMTX_IOC_MAGIC, 2)
+// Returns the display to the framebuffer
+#define ADAMTX_IOC_RELEASE	_IO(ADAMTX_IOC_MAGIC, 3)
+
+/*
+ * The playlist is a driver owned pool of frames that keeps playing after the
+ * device is closed. Buffers queued with ADAMTX_IOC_QUEUE take precedence.
+ */
+// Replaces the pool with frames empty frames
+#define ADAMTX_IOC_PLAYLIST_ALLOC	_IOW(ADAMTX_IOC_MAGIC, 4, struct adamtx_ioc_playlist)
+// Stores a frame and its duration, the playlist must be stopped
+#define ADAMTX_IOC_PLAYLIST_LOAD	_IOW(ADAMTX_IOC_MAGIC, 5, struct adamtx_ioc_frame)
+#define ADAMTX_IOC_PLAYLIST_PLAY	_IOW(ADAMTX_IOC_MAGIC, 6, struct adamtx_ioc_play)
+#define ADAMTX_IOC_PLAYLIST_STOP	_IO(ADAMTX_IOC_MAGIC, 7)
+
+#endif
@@ -0,0 +1,603 @@
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+
+#include "matrix.h"
+#include "encoder.h"
+#include "remap.h"
+#include "dummyfb-format.h"
+
+/*
+ * KUnit suites for the frame pipeline: panel geometry, framebuffer decoders
+ * with color gains and the encoder compared against a straightforward
+ * reference for several scan topologies, with dithering and for damage
+ * updates of an address range. Everything runs on a fixed chain of
+ * two 64x32 panels, no device or GPIO is involved, so the suites also run
+ * under UML or qemu.
+ */
+
+#define ADAMTX_TEST_WIDTH		64
+#define ADAMTX_TEST_HEIGHT		64
+#define ADAMTX_TEST_COLUMNS		128
+#define ADAMTX_TEST_ROWS		32
+#define ADAMTX_TEST_CHAIN_LEN	(ADAMTX_TEST_COLUMNS * ADAMTX_TEST_ROWS)
+#define ADAMTX_TEST_DISPLAY_LEN	(ADAMTX_TEST_WIDTH * ADAMTX_TEST_HEIGHT)
+#define ADAMTX_TEST_PWM_BITS	8
+
+// Default pinout of the driver
+static const uint32_t adamtx_test_pins[ADAMTX_NUM_PINS] = { 11, 27, 7, 8, 9, 10, 22, 23, 24, 25, 15, 18, 4, 17 };
+
+// Upper half of the display at the end of the chain, both mounted upside down in x
+static struct matrix_ledpanel adamtx_test_panel_store[] = {
+	{ .name = "upper", .xres = 64, .yres = 32, .virtual_x = 64, .virtual_y = 0, .realx = 0, .realy = 0, .flip_x = 1, .flip_y = 0,
+		.gain = { MATRIX_GAIN_MAX, MATRIX_GAIN_MAX, MATRIX_GAIN_MAX } },
+	{ .name = "lower", .xres = 64, .yres = 32, .virtual_x = 0, .virtual_y = 0, .realx = 0, .realy = 32, .flip_x = 1, .flip_y = 0,
+		.gain = { MATRIX_GAIN_MAX, MATRIX_GAIN_MAX, MATRIX_GAIN_MAX } }
+};
+
+static struct matrix_ledpanel* adamtx_test_panels[] = { &adamtx_test_panel_store[0], &adamtx_test_panel_store[1] };
+
+enum adamtx_test_pattern {
+	ADAMTX_PATTERN_BLACK = 0,
+	ADAMTX_PATTERN_GRADIENT,
+	ADAMTX_PATTERN_NOISE,
+	ADAMTX_PATTERN_TEXT,
+	ADAMTX_NUM_PATTERNS
+};
+
+static const char* const adamtx_test_pattern_names[ADAMTX_NUM_PATTERNS] = {
+	[ADAMTX_PATTERN_BLACK] =	"black",
+	[ADAMTX_PATTERN_GRADIENT] =	"gradient",
+	[ADAMTX_PATTERN_NOISE] =	"noise",
+	[ADAMTX_PATTERN_TEXT] =		"text"
+};
+
+typedef struct adamtx_test_topology {
+	const char*	name;
+	int			fold;
+	int			zigzag;
+	int			zigzag_invert;
+	int			address_mode;
+} adamtx_test_topology;
+
+static const struct adamtx_test_topology adamtx_test_topologies[] = {
+	{ "fold1",					1, 0, 0, ADAMTX_ADDRESS_DIRECT },
+	{ "fold2",					2, 0, 0, ADAMTX_ADDRESS_DIRECT },
+	{ "fold2-zigzag8",			2, 8, 0, ADAMTX_ADDRESS_DIRECT },
+	{ "fold2-zigzag8-invert",	2, 8, 1, ADAMTX_ADDRESS_DIRECT },
+	{ "fold4-zigzag4",			4, 4, 0, ADAMTX_ADDRESS_DIRECT },
+	{ "fold1-shift",			1, 0, 0, ADAMTX_ADDRESS_SHIFT }
+};
+
+// 5x7 glyphs of "ADAMTX", one byte per line, MSB left
+static const uint8_t adamtx_test_font[6][7] = {
+	{ 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	{ 0x1E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1E },
+	{ 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+	{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+	{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }
+};
+
+static uint32_t adamtx_test_pixel(int pattern, int x, int y, int width, int height, uint32_t* seed)
+{
+	int glyph, line;
+	switch(pattern)
+	{
+		case ADAMTX_PATTERN_GRADIENT:
+			return (x * 255 / max(width - 1, 1)) << 16 | (y * 255 / max(height - 1, 1)) << 8 | ((x + y) & 0xFF);
+		case ADAMTX_PATTERN_NOISE:
+			// xorshift32, the same sequence on every run
+			*seed ^= *seed << 13;
+			*seed ^= *seed >> 17;
+			*seed ^= *seed << 5;
+			return *seed & 0x00FFFFFF;
+		case ADAMTX_PATTERN_TEXT:
+			glyph = (x / 6) % ARRAY_SIZE(adamtx_test_font);
+			line = y % 8;
+			if(x % 6 == 5 || line == 7 || !(adamtx_test_font[glyph][line] & (0x10 >> (x % 6))))
+				return 0;
+			// Each text line in another channel
+			return 0xFFU << (8 * ((y / 8) % 3));
+	}
+	return 0;
+}
+
+static void adamtx_test_fill(uint32_t* image, int pattern, int width, int height)
+{
+	int x, y;
+	uint32_t seed = 0x2545F491;
+	for(y = 0; y < height; y++)
+	{
+		for(x = 0; x < width; x++)
+			image[y * width + x] = adamtx_test_pixel(pattern, x, y, width, height, &seed);
+	}
+}
+
+// Same construction as the driver's remap table, uncovered pixels go to the spare slot
+static void adamtx_test_remap_table(struct matrix_ledpanel** panels, int num_panels, int width, int height, uint32_t* table)
+{
+	int x, y;
+	struct matrix_ledpanel* panel;
+	struct matrix_pos pos;
+	for(y = 0; y < height; y++)
+	{
+		for(x = 0; x < width; x++)
+		{
+			panel = matrix_get_panel_at_real(panels, num_panels, x, y);
+			if(panel == NULL)
+			{
+				table[y * width + x] = ADAMTX_TEST_CHAIN_LEN;
+				continue;
+			}
+			matrix_panel_get_position(&pos, panel, x, y);
+			table[y * width + x] = pos.y * ADAMTX_TEST_COLUMNS + pos.x;
+		}
+	}
+}
+
+// Every display pixel lands on its panel as wired and no chain pixel is used twice
+static void adamtx_test_geometry_unique(struct kunit* test)
+{
+	int i;
+	uint32_t* table = kunit_kzalloc(test, ADAMTX_TEST_DISPLAY_LEN * sizeof(uint32_t), GFP_KERNEL);
+	uint8_t* used = kunit_kzalloc(test, ADAMTX_TEST_CHAIN_LEN, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, table);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, used);
+	adamtx_test_remap_table(adamtx_test_panels, ARRAY_SIZE(adamtx_test_panels), ADAMTX_TEST_WIDTH, ADAMTX_TEST_HEIGHT, table);
+	for(i = 0; i < ADAMTX_TEST_DISPLAY_LEN; i++)
+	{
+		KUNIT_ASSERT_LT(test, table[i], (uint32_t)ADAMTX_TEST_CHAIN_LEN);
+		KUNIT_ASSERT_EQ_MSG(test, (int)used[table[i]]++, 0, "chain pixel %u used twice", table[i]);
+	}
+}
+
+static void adamtx_test_geometry_flip(struct kunit* test)
+{
+	struct matrix_pos pos;
+	struct matrix_ledpanel panel = adamtx_test_panel_store[1];
+
+	// Flipped in x, the left edge of the display is the last column of the panel
+	matrix_panel_get_position(&pos, &panel, 0, 32);
+	KUNIT_EXPECT_EQ(test, pos.x, 63);
+	KUNIT_EXPECT_EQ(test, pos.y, 0);
+	matrix_panel_get_position(&pos, &panel, 63, 63);
+	KUNIT_EXPECT_EQ(test, pos.x, 0);
+	KUNIT_EXPECT_EQ(test, pos.y, 31);
+
+	panel.flip_x = 0;
+	panel.flip_y = 1;
+	matrix_panel_get_position(&pos, &panel, 0, 32);
+	KUNIT_EXPECT_EQ(test, pos.x, 0);
+	KUNIT_EXPECT_EQ(test, pos.y, 31);
+
+	// The upper panel sits behind the lower one in the chain
+	matrix_panel_get_position(&pos, &adamtx_test_panel_store[0], 63, 0);
+	KUNIT_EXPECT_EQ(test, pos.x, 64);
+	KUNIT_EXPECT_EQ(test, pos.y, 0);
+}
+
+// Pixels no panel covers go to the spare slot
+static void adamtx_test_geometry_uncovered(struct kunit* test)
+{
+	uint32_t* table = kunit_kzalloc(test, ADAMTX_TEST_DISPLAY_LEN * sizeof(uint32_t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, table);
+
+	// Only the lower panel, the upper half of the display is uncovered
+	KUNIT_EXPECT_PTR_EQ(test, matrix_get_panel_at_real(&adamtx_test_panels[1], 1, 0, 0), (struct matrix_ledpanel*)NULL);
+	KUNIT_EXPECT_PTR_EQ(test, matrix_get_panel_at_real(&adamtx_test_panels[1], 1, 0, 32), adamtx_test_panels[1]);
+	adamtx_test_remap_table(&adamtx_test_panels[1], 1, ADAMTX_TEST_WIDTH, ADAMTX_TEST_HEIGHT, table);
+	KUNIT_EXPECT_EQ(test, table[0], (uint32_t)ADAMTX_TEST_CHAIN_LEN);
+	KUNIT_EXPECT_EQ(test, table[32 * ADAMTX_TEST_WIDTH - 1], (uint32_t)ADAMTX_TEST_CHAIN_LEN);
+	KUNIT_EXPECT_EQ(test, table[32 * ADAMTX_TEST_WIDTH], (uint32_t)63);
+}
+
+static struct kunit_case adamtx_test_geometry_cases[] = {
+	KUNIT_CASE(adamtx_test_geometry_unique),
+	KUNIT_CASE(adamtx_test_geometry_flip),
+	KUNIT_CASE(adamtx_test_geometry_uncovered),
+	{}
+};
+
+static struct kunit_suite adamtx_test_geometry_suite = {
+	.name = "adafruit-matrix-geometry",
+	.test_cases = adamtx_test_geometry_cases
+};
+
+static void adamtx_test_decoders(struct kunit* test)
+{
+	uint32_t table[1] = { 0 };
+	uint32_t to;
+	uint32_t xrgb8888 = 0xAB123456;
+	uint16_t rgb565 = 0xF81F;
+	uint8_t rgb888[3] = { 0x56, 0x34, 0x12 };
+	KUNIT_EXPECT_EQ(test, remap_frame(table, NULL, &xrgb8888, DUMMYFB_FORMAT_XRGB8888, 1, &to, 1), 0x12UL + 0x34 + 0x56);
+	KUNIT_EXPECT_EQ(test, to, (uint32_t)0x00123456);
+	KUNIT_EXPECT_EQ(test, remap_frame(table, NULL, rgb888, DUMMYFB_FORMAT_RGB888, 1, &to, 1), 0x12UL + 0x34 + 0x56);
+	KUNIT_EXPECT_EQ(test, to, (uint32_t)0x00123456);
+	// Full intensity stays full intensity
+	KUNIT_EXPECT_EQ(test, remap_frame(table, NULL, &rgb565, DUMMYFB_FORMAT_RGB565, 1, &to, 1), 2 * 0xFFUL);
+	KUNIT_EXPECT_EQ(test, to, (uint32_t)0x00FF00FF);
+	// Pixels no panel shows are not lit
+	KUNIT_EXPECT_EQ(test, remap_frame(table, NULL, &xrgb8888, DUMMYFB_FORMAT_XRGB8888, 1, &to, 0), 0UL);
+}
+
+static void adamtx_test_scatter(struct kunit* test)
+{
+	int i;
+	uint32_t* table = kunit_kzalloc(test, ADAMTX_TEST_DISPLAY_LEN * sizeof(uint32_t), GFP_KERNEL);
+	uint32_t* image = kunit_kzalloc(test, ADAMTX_TEST_DISPLAY_LEN * sizeof(uint32_t), GFP_KERNEL);
+	uint32_t* chain = kunit_kzalloc(test, (ADAMTX_TEST_CHAIN_LEN + 1) * sizeof(uint32_t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, table);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, image);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, chain);
+	adamtx_test_remap_table(adamtx_test_panels, ARRAY_SIZE(adamtx_test_panels), ADAMTX_TEST_WIDTH, ADAMTX_TEST_HEIGHT, table);
+	adamtx_test_fill(image, ADAMTX_PATTERN_NOISE, ADAMTX_TEST_WIDTH, ADAMTX_TEST_HEIGHT);
+	remap_frame(table, NULL, image, DUMMYFB_FORMAT_XRGB8888, ADAMTX_TEST_DISPLAY_LEN, chain, ADAMTX_TEST_CHAIN_LEN);
+	for(i = 0; i < ADAMTX_TEST_DISPLAY_LEN; i++)
+		KUNIT_ASSERT_EQ_MSG(test, chain[table[i]], image[i], "display pixel %d", i);
+}
+
+static void adamtx_test_gain(struct kunit* test)
+{
+	int i;
+	uint32_t table[2] = { 0, 1 };
+	uint32_t from[2] = { 0x00FFFFFF, 0x00FFFFFF };
+	uint32_t to[2];
+	uint16_t map[2] = { 0, 1 };
+	static const unsigned char unity[3] = { ADAMTX_GAIN_UNITY, ADAMTX_GAIN_UNITY, ADAMTX_GAIN_UNITY };
+	static const unsigned char warm[3] = { 255, 128, 0 };
+	uint8_t* lut = kunit_kzalloc(test, 2 * ADAMTX_GAIN_LUT_LEN, GFP_KERNEL);
+	struct adamtx_gain gain = { .lut = lut, .map = map };
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, lut);
+	adamtx_gain_fill_lut(lut, unity);
+	adamtx_gain_fill_lut(lut + ADAMTX_GAIN_LUT_LEN, warm);
+	for(i = 0; i < ADAMTX_GAIN_CHANNEL_LEN; i++)
+		KUNIT_ASSERT_EQ(test, adamtx_gain_apply(lut, i * 0x010101), (uint32_t)i * 0x010101);
+
+	// Each pixel gets its own panel's table
+	KUNIT_EXPECT_EQ(test, remap_frame(table, &gain, from, DUMMYFB_FORMAT_XRGB8888, 2, to, 2), 3 * 0xFFUL + 0xFF + 0x80);
+	KUNIT_EXPECT_EQ(test, to[0], (uint32_t)0x00FFFFFF);
+	KUNIT_EXPECT_EQ(test, to[1], (uint32_t)0x00FF8000);
+}
+
+static struct kunit_case adamtx_test_remap_cases[] = {
+	KUNIT_CASE(adamtx_test_decoders),
+	KUNIT_CASE(adamtx_test_scatter),
+	KUNIT_CASE(adamtx_test_gain),
+	{}
+};
+
+static struct kunit_suite adamtx_test_remap_suite = {
+	.name = "adafruit-matrix-remap",
+	.test_cases = adamtx_test_remap_cases
+};
+
+static uint32_t adamtx_test_bits(const struct adamtx_encoder* encoder, uint32_t upper, uint32_t lower, int plane)
+{
+	return ((upper >> (16 + plane)) & 1) << encoder->pins[ADAMTX_PIN_R1] |
+		((upper >> (8 + plane)) & 1) << encoder->pins[ADAMTX_PIN_G1] |
+		((upper >> plane) & 1) << encoder->pins[ADAMTX_PIN_B1] |
+		((lower >> (16 + plane)) & 1) << encoder->pins[ADAMTX_PIN_R2] |
+		((lower >> (8 + plane)) & 1) << encoder->pins[ADAMTX_PIN_G2] |
+		((lower >> plane) & 1) << encoder->pins[ADAMTX_PIN_B2];
+}
+
+static uint32_t adamtx_test_address(const struct adamtx_encoder* encoder, int address)
+{
+	int i;
+	uint32_t word = 0;
+	static const int pins[ADAMTX_NUM_ADDRESS_PINS] = { ADAMTX_PIN_A, ADAMTX_PIN_B, ADAMTX_PIN_C, ADAMTX_PIN_D, ADAMTX_PIN_E };
+	if(encoder->scan.address_mode != ADAMTX_ADDRESS_DIRECT)
+		return 0;
+	for(i = 0; i < ADAMTX_NUM_ADDRESS_PINS; i++)
+		word |= ((address >> i) & 1U) << encoder->pins[pins[i]];
+	return word;
+}
+
+// Shift position, address * shift_len + k, of chain row r of the upper half and its lower half partner
+static int adamtx_test_position(const struct adamtx_encoder* encoder, int r, int c)
+{
+	int k;
+	const struct adamtx_scan* scan = &encoder->scan;
+	int fold_row = r / scan->addresses;
+	if(scan->zigzag_invert)
+		fold_row = encoder->fold - 1 - fold_row;
+	if(scan->zigzag)
+		k = ((c / scan->zigzag) * encoder->fold + fold_row) * scan->zigzag + c % scan->zigzag;
+	else
+		k = fold_row * scan->columns + c;
+	return (r % scan->addresses) * encoder->shift_len + k;
+}
+
+/*
+ * Expected output words, computed per pixel from the panel wiring instead of
+ * per shift position like the encoder. Fails if a position is missed.
+ */
+static void adamtx_test_reference(struct kunit* test, const struct adamtx_encoder* encoder, const uint32_t* chain, uint32_t* expected, uint8_t* written)
+{
+	int r, c, j, k, pos, address;
+	const struct adamtx_scan* scan = &encoder->scan;
+	int half = scan->rows / 2;
+	int pwm_bits = encoder->pwm_bits;
+	int shift_len = encoder->shift_len;
+	memset(written, 0, scan->addresses * shift_len);
+	for(r = 0; r < half; r++)
+	{
+		for(c = 0; c < scan->columns; c++)
+		{
+			pos = adamtx_test_position(encoder, r, c);
+			address = pos / shift_len;
+			k = pos % shift_len;
+			written[pos]++;
+			for(j = 0; j < pwm_bits; j++)
+			{
+				// The first bitplane already carries the next address, it is latched while that plane shows
+				expected[(address * pwm_bits + j) * shift_len + k] = adamtx_test_bits(encoder, chain[r * scan->columns + c], chain[(half + r) * scan->columns + c], j) |
+					adamtx_test_address(encoder, j == 0 ? (address + 1) % scan->addresses : address);
+			}
+		}
+	}
+	for(k = 0; k < scan->addresses * shift_len; k++)
+		KUNIT_ASSERT_EQ_MSG(test, (int)written[k], 1, "shift position %d of address %d", k % shift_len, k / shift_len);
+}
+
+// Channel values the bitplanes at a shift position encode for the upper and the lower half
+static void adamtx_test_decode(const struct adamtx_encoder* encoder, const struct adamtx_panel_io* paneldata, int pos, uint32_t* upper, uint32_t* lower)
+{
+	int j;
+	uint32_t word;
+	const uint32_t* pins = encoder->pins;
+	int address = pos / encoder->shift_len;
+	int k = pos % encoder->shift_len;
+	*upper = 0;
+	*lower = 0;
+	for(j = 0; j < encoder->pwm_bits; j++)
+	{
+		word = paneldata[(address * encoder->pwm_bits + j) * encoder->shift_len + k].gpios;
+		*upper |= ((word >> pins[ADAMTX_PIN_R1]) & 1U) << (16 + j) | ((word >> pins[ADAMTX_PIN_G1]) & 1U) << (8 + j) | ((word >> pins[ADAMTX_PIN_B1]) & 1U) << j;
+		*lower |= ((word >> pins[ADAMTX_PIN_R2]) & 1U) << (16 + j) | ((word >> pins[ADAMTX_PIN_G2]) & 1U) << (8 + j) | ((word >> pins[ADAMTX_PIN_B2]) & 1U) << j;
+	}
+}
+
+static void adamtx_test_scan(const struct adamtx_test_topology* topology, struct adamtx_scan* scan)
+{
+	memset(scan, 0, sizeof(struct adamtx_scan));
+	scan->rows = ADAMTX_TEST_ROWS;
+	scan->columns = ADAMTX_TEST_COLUMNS;
+	scan->addresses = ADAMTX_TEST_ROWS / 2 / topology->fold;
+	scan->address_mode = topology->address_mode;
+	scan->zigzag = topology->zigzag;
+	scan->zigzag_invert = topology->zigzag_invert;
+}
+
+static void adamtx_test_encoder_topology(struct kunit* test, const struct adamtx_test_topology* topology)
+{
+	int i, pattern;
+	int len = ADAMTX_TEST_PWM_BITS * ADAMTX_TEST_ROWS / 2 * ADAMTX_TEST_COLUMNS;
+	uint32_t* chain = kunit_kzalloc(test, ADAMTX_TEST_CHAIN_LEN * sizeof(uint32_t), GFP_KERNEL);
+	struct adamtx_panel_io* paneldata = kunit_kzalloc(test, len * sizeof(struct adamtx_panel_io), GFP_KERNEL);
+	uint32_t* expected = kunit_kzalloc(test, len * sizeof(uint32_t), GFP_KERNEL);
+	uint8_t* written = kunit_kzalloc(test, ADAMTX_TEST_CHAIN_LEN, GFP_KERNEL);
+	struct adamtx_encoder encoder;
+	struct adamtx_scan scan;
+	struct adamtx_frame frame = {
+		.width = ADAMTX_TEST_COLUMNS,
+		.height = ADAMTX_TEST_ROWS,
+		.vertical_offset = 0,
+		.rows = ADAMTX_TEST_ROWS,
+		.paneldata = paneldata,
+		.frame = chain,
+		.pwm_bits = ADAMTX_TEST_PWM_BITS,
+		.dither_bits = 0,
+		.dither_frame = 0,
+		.encoder = &encoder
+	};
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, chain);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, paneldata);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, expected);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, written);
+	adamtx_test_scan(topology, &scan);
+	KUNIT_ASSERT_EQ_MSG(test, adamtx_encoder_init(&encoder, adamtx_test_pins, ADAMTX_TEST_PWM_BITS, &scan), 0, "%s", topology->name);
+
+	for(pattern = 0; pattern < ADAMTX_NUM_PATTERNS; pattern++)
+	{
+		adamtx_test_fill(chain, pattern, ADAMTX_TEST_COLUMNS, ADAMTX_TEST_ROWS);
+		adamtx_test_reference(test, &encoder, chain, expected, written);
+		memset(paneldata, 0, len * sizeof(struct adamtx_panel_io));
+		prerender_frame_part(&frame);
+		for(i = 0; i < len; i++)
+		{
+			if(paneldata[i].gpios != expected[i])
+			{
+				KUNIT_FAIL(test, "%s/%s: word %d (address %d, plane %d, position %d) is 0x%08x, expected 0x%08x",
+					topology->name, adamtx_test_pattern_names[pattern],
+					i, i / (encoder.pwm_bits * encoder.shift_len), (i / encoder.shift_len) % encoder.pwm_bits, i % encoder.shift_len,
+					paneldata[i].gpios, expected[i]);
+				break;
+			}
+		}
+	}
+	adamtx_encoder_free(&encoder);
+}
+
+static void adamtx_test_encoder(struct kunit* test)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(adamtx_test_topologies); i++)
+		adamtx_test_encoder_topology(test, &adamtx_test_topologies[i]);
+}
+
+/*
+ * Damage updates encode a range of addresses, every word outside of it keeps
+ * what the previous frame left there.
+ */
+static void adamtx_test_encoder_partial_topology(struct kunit* test, const struct adamtx_test_topology* topology)
+{
+	int i, address, first, last;
+	int len = ADAMTX_TEST_PWM_BITS * ADAMTX_TEST_ROWS / 2 * ADAMTX_TEST_COLUMNS;
+	uint32_t* chain = kunit_kzalloc(test, ADAMTX_TEST_CHAIN_LEN * sizeof(uint32_t), GFP_KERNEL);
+	struct adamtx_panel_io* full = kunit_kzalloc(test, len * sizeof(struct adamtx_panel_io), GFP_KERNEL);
+	struct adamtx_panel_io* paneldata = kunit_kzalloc(test, len * sizeof(struct adamtx_panel_io), GFP_KERNEL);
+	struct adamtx_encoder encoder;
+	struct adamtx_scan scan;
+	struct adamtx_frame frame = {
+		.width = ADAMTX_TEST_COLUMNS,
+		.height = ADAMTX_TEST_ROWS,
+		.frame = chain,
+		.pwm_bits = ADAMTX_TEST_PWM_BITS,
+		.encoder = &encoder
+	};
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, chain);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, full);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, paneldata);
+	adamtx_test_scan(topology, &scan);
+	KUNIT_ASSERT_EQ_MSG(test, adamtx_encoder_init(&encoder, adamtx_test_pins, ADAMTX_TEST_PWM_BITS, &scan), 0, "%s", topology->name);
+	adamtx_test_fill(chain, ADAMTX_PATTERN_NOISE, ADAMTX_TEST_COLUMNS, ADAMTX_TEST_ROWS);
+
+	frame.paneldata = full;
+	frame.vertical_offset = 0;
+	frame.rows = ADAMTX_TEST_ROWS;
+	prerender_frame_part(&frame);
+
+	// All but the first and the last address
+	first = 1;
+	last = scan.addresses - 1;
+	memset(paneldata, 0xA5, len * sizeof(struct adamtx_panel_io));
+	frame.paneldata = paneldata;
+	frame.vertical_offset = first * 2 * encoder.fold;
+	frame.rows = (last - first) * 2 * encoder.fold;
+	prerender_frame_part(&frame);
+	for(i = 0; i < len; i++)
+	{
+		address = i / (encoder.pwm_bits * encoder.shift_len);
+		if(paneldata[i].gpios != (address >= first && address < last ? full[i].gpios : 0xA5A5A5A5))
+		{
+			KUNIT_FAIL(test, "%s: word %d of address %d is 0x%08x after encoding addresses %d to %d",
+				topology->name, i, address, paneldata[i].gpios, first, last - 1);
+			break;
+		}
+	}
+	adamtx_encoder_free(&encoder);
+}
+
+static void adamtx_test_encoder_partial(struct kunit* test)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(adamtx_test_topologies); i++)
+		adamtx_test_encoder_partial_topology(test, &adamtx_test_topologies[i]);
+}
+
+/*
+ * With dither_bits the thresholds of all dither frames add up to the dropped
+ * low bits, so per pixel and channel the shown values sum to the 8 bit input
+ * unless they clip at the top. Uses a zigzag scan, dithering then works on
+ * scan mapped lines, and scratch private to the part.
+ */
+static void adamtx_test_encoder_dither(struct kunit* test)
+{
+	int i, r, c, t, pos, shift, pattern;
+	int dither_frames = 1 << ADAMTX_DITHER_MAX_BITS;
+	int pwm_bits = 8 - ADAMTX_DITHER_MAX_BITS;
+	int max = (1 << pwm_bits) - 1;
+	int half = ADAMTX_TEST_ROWS / 2;
+	int len = pwm_bits * half * ADAMTX_TEST_COLUMNS;
+	const struct adamtx_test_topology* topology = &adamtx_test_topologies[2];
+	uint32_t* chain = kunit_kzalloc(test, ADAMTX_TEST_CHAIN_LEN * sizeof(uint32_t), GFP_KERNEL);
+	struct adamtx_panel_io* paneldata = kunit_kzalloc(test, dither_frames * len * sizeof(struct adamtx_panel_io), GFP_KERNEL);
+	uint32_t upper, lower, pixel[2], sum[2], expected[2], value;
+	struct adamtx_encoder encoder;
+	struct adamtx_scan scan;
+	struct adamtx_frame frame = {
+		.width = ADAMTX_TEST_COLUMNS,
+		.height = ADAMTX_TEST_ROWS,
+		.vertical_offset = 0,
+		.rows = ADAMTX_TEST_ROWS,
+		.frame = chain,
+		.pwm_bits = pwm_bits,
+		.dither_bits = ADAMTX_DITHER_MAX_BITS,
+		.encoder = &encoder
+	};
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, chain);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, paneldata);
+	adamtx_test_scan(topology, &scan);
+	KUNIT_ASSERT_EQ_MSG(test, adamtx_encoder_init(&encoder, adamtx_test_pins, pwm_bits, &scan), 0, "%s", topology->name);
+	frame.lines = kunit_kzalloc(test, ADAMTX_LINES_LEN(&encoder) * sizeof(uint32_t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, frame.lines);
+
+	for(pattern = 0; pattern < ADAMTX_NUM_PATTERNS; pattern++)
+	{
+		adamtx_test_fill(chain, pattern, ADAMTX_TEST_COLUMNS, ADAMTX_TEST_ROWS);
+		for(i = 0; i < dither_frames; i++)
+		{
+			frame.dither_frame = i;
+			frame.paneldata = paneldata + i * len;
+			prerender_frame_part(&frame);
+		}
+		for(r = 0; r < half; r++)
+		{
+			for(c = 0; c < ADAMTX_TEST_COLUMNS; c++)
+			{
+				pos = adamtx_test_position(&encoder, r, c);
+				pixel[0] = chain[r * ADAMTX_TEST_COLUMNS + c];
+				pixel[1] = chain[(half + r) * ADAMTX_TEST_COLUMNS + c];
+				sum[0] = 0;
+				sum[1] = 0;
+				for(i = 0; i < dither_frames; i++)
+				{
+					adamtx_test_decode(&encoder, paneldata + i * len, pos, &upper, &lower);
+					sum[0] += upper;
+					sum[1] += lower;
+				}
+				for(shift = 0; shift < 24; shift += 8)
+				{
+					for(i = 0; i < 2; i++)
+					{
+						value = (pixel[i] >> shift) & 0xFF;
+						expected[i] = 0;
+						for(t = 0; t < dither_frames; t++)
+							expected[i] += min_t(uint32_t, (value + t) >> ADAMTX_DITHER_MAX_BITS, max);
+						if(((sum[i] >> shift) & 0xFF) != expected[i])
+						{
+							KUNIT_FAIL(test, "%s: channel %d of row %d column %d sums to %u over the dither frames, expected %u",
+								adamtx_test_pattern_names[pattern], shift / 8, i * half + r, c, (sum[i] >> shift) & 0xFF, expected[i]);
+							goto exit_encoder;
+						}
+					}
+				}
+			}
+		}
+	}
+exit_encoder:
+	adamtx_encoder_free(&encoder);
+}
+
+// Invalid scans are refused instead of producing a partial scan map
+static void adamtx_test_encoder_invalid(struct kunit* test)
+{
+	struct adamtx_encoder encoder;
+	struct adamtx_scan scan = {
+		.rows = ADAMTX_TEST_ROWS,
+		.columns = ADAMTX_TEST_COLUMNS,
+		.addresses = 5,
+		.address_mode = ADAMTX_ADDRESS_DIRECT
+	};
+	KUNIT_EXPECT_NE(test, adamtx_encoder_init(&encoder, adamtx_test_pins, ADAMTX_TEST_PWM_BITS, &scan), 0);
+}
+
+static struct kunit_case adamtx_test_encoder_cases[] = {
+	KUNIT_CASE(adamtx_test_encoder),
+	KUNIT_CASE(adamtx_test_encoder_partial),
+	KUNIT_CASE(adamtx_test_encoder_dither),
+	KUNIT_CASE(adamtx_test_encoder_invalid),
+	{}
+};
+
+static struct kunit_suite adamtx_test_encoder_suite = {
+	.name = "adafruit-matrix-encoder",
+	.test_cases = adamtx_test_encoder_cases
+};
+
+// Part of adafruit_matrix.ko, the suites run when the module loads
+kunit_test_suites(&adamtx_test_geometry_suite, &adamtx_test_remap_suite, &adamtx_test_encoder_suite);
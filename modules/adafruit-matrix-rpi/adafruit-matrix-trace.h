@@ -0,0 +1,135 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM adamtx
+
+#if !defined(_ADAMTX_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ADAMTX_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Sources of a drawn frame, see draw_frame
+#define ADAMTX_SOURCE_FB		0
+#define ADAMTX_SOURCE_USER		1
+#define ADAMTX_SOURCE_PLAYLIST	2
+
+#define adamtx_show_source(source) __print_symbolic(source, \
+	{ ADAMTX_SOURCE_FB,			"fb" }, \
+	{ ADAMTX_SOURCE_USER,		"user" }, \
+	{ ADAMTX_SOURCE_PLAYLIST,	"playlist" })
+
+TRACE_EVENT(adamtx_update_start,
+	TP_PROTO(int id, int first_address, int last_address),
+	TP_ARGS(id, first_address, last_address),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, first_address)
+		__field(int, last_address)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->first_address = first_address;
+		__entry->last_address = last_address;
+	),
+	TP_printk("adamtx%d addresses=%d-%d", __entry->id, __entry->first_address, __entry->last_address)
+);
+
+TRACE_EVENT(adamtx_update_end,
+	TP_PROTO(int id, int rows, unsigned long lit),
+	TP_ARGS(id, rows, lit),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, rows)
+		__field(unsigned long, lit)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->rows = rows;
+		__entry->lit = lit;
+	),
+	TP_printk("adamtx%d rows=%d lit=%lu", __entry->id, __entry->rows, __entry->lit)
+);
+
+TRACE_EVENT(adamtx_draw_start,
+	TP_PROTO(int id, int source, int dither_frame),
+	TP_ARGS(id, source, dither_frame),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, source)
+		__field(int, dither_frame)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->source = source;
+		__entry->dither_frame = dither_frame;
+	),
+	TP_printk("adamtx%d source=%s dither_frame=%d", __entry->id, adamtx_show_source(__entry->source), __entry->dither_frame)
+);
+
+TRACE_EVENT(adamtx_draw_end,
+	TP_PROTO(int id),
+	TP_ARGS(id),
+	TP_STRUCT__entry(
+		__field(int, id)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+	),
+	TP_printk("adamtx%d", __entry->id)
+);
+
+// All bitplanes of one address, i.e. one row pair per fold
+TRACE_EVENT(adamtx_row,
+	TP_PROTO(int id, int address, u64 ns),
+	TP_ARGS(id, address, ns),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, address)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->address = address;
+		__entry->ns = ns;
+	),
+	TP_printk("adamtx%d address=%d ns=%llu", __entry->id, __entry->address, __entry->ns)
+);
+
+// Time from the hrtimer firing to the polling thread picking the work up
+TRACE_EVENT(adamtx_wakeup,
+	TP_PROTO(int id, const char* thread, s64 latency_ns),
+	TP_ARGS(id, thread, latency_ns),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__string(thread, thread)
+		__field(s64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__assign_str(thread, thread);
+		__entry->latency_ns = latency_ns;
+	),
+	TP_printk("adamtx%d thread=%s latency_ns=%lld", __entry->id, __get_str(thread), __entry->latency_ns)
+);
+
+TRACE_EVENT(adamtx_swap,
+	TP_PROTO(int id, int source, int index),
+	TP_ARGS(id, source, index),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, source)
+		__field(int, index)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->source = source;
+		__entry->index = index;
+	),
+	TP_printk("adamtx%d source=%s index=%d", __entry->id, adamtx_show_source(__entry->source), __entry->index)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE adafruit-matrix-trace
+#include <trace/define_trace.h>
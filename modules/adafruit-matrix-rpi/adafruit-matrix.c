@@ -12,35 +12,76 @@
 #include <linux/err.h>
 #include <linux/delay.h>
 #include <linux/platform_device.h>
+#include <linux/of.h>
+#include <linux/idr.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/math64.h>
 
 #include "matrix.h"
+#include "encoder.h"
 #include "adafruit-matrix.h"
 #include "io.h"
+#include "chrdev.h"
+#include "playlist.h"
+#include "selftest.h"
+#include "refresh.h"
 
-#define ADAMTX_GPIO_HI(gpio) adamtx_gpio_set_bits((1 << gpio))
-#define ADAMTX_GPIO_LO(gpio) adamtx_gpio_clr_bits((1 << gpio))
-#define ADAMTX_GPIO_SET(gpio, state) (state ? ADAMTX_GPIO_HI(gpio) : ADAMTX_GPIO_LO(gpio))
+#define CREATE_TRACE_POINTS
+#include "adafruit-matrix-trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Tobas Schramm");
 MODULE_DESCRIPTION("Adafruit LED matrix driver");
 MODULE_VERSION("0.1");
 
-static struct matrix_ledpanel** adamtx_panels;
+static int adamtx_dither_bits = 0;
+module_param_named(dither_bits, adamtx_dither_bits, int, S_IRUGO);
+MODULE_PARM_DESC(dither_bits, "Color bits reproduced by temporal dithering instead of bitplanes (0-2)");
 
-static char* framedata;
-static struct adamtx_panel_io* paneldata;
+static uint32_t adamtx_pinout[ADAMTX_NUM_PINS] = {
+	ADAMTX_GPIO_R1, ADAMTX_GPIO_G1, ADAMTX_GPIO_B1,
+	ADAMTX_GPIO_R2, ADAMTX_GPIO_G2, ADAMTX_GPIO_B2,
+	ADAMTX_GPIO_A, ADAMTX_GPIO_B, ADAMTX_GPIO_C, ADAMTX_GPIO_D, ADAMTX_GPIO_E,
+	ADAMTX_GPIO_OE, ADAMTX_GPIO_STR, ADAMTX_GPIO_CLK
+};
+static unsigned int adamtx_pinout_len = ADAMTX_NUM_PINS;
+module_param_array_named(pinout, adamtx_pinout, uint, &adamtx_pinout_len, S_IRUGO);
+MODULE_PARM_DESC(pinout, "Default GPIOs of R1,G1,B1,R2,G2,B2,A,B,C,D,E,OE,STR,CLK");
+
+static int adamtx_scan = 0;
+module_param_named(scan, adamtx_scan, int, S_IRUGO);
+MODULE_PARM_DESC(scan, "Default row addresses per chain (1/scan multiplexing), 0 for half the chain height");
+
+static int adamtx_address_mode = ADAMTX_ADDRESS_DIRECT;
+module_param_named(address_mode, adamtx_address_mode, int, S_IRUGO);
+MODULE_PARM_DESC(address_mode, "Default row addressing, 0 for A-E, 1 for shift register on A (clock) and B (data)");
+
+static int adamtx_zigzag = 0;
+module_param_named(zigzag, adamtx_zigzag, int, S_IRUGO);
+MODULE_PARM_DESC(zigzag, "Default block width of zig-zag pixel order of outdoor panels, 0 for linear");
+
+static unsigned int adamtx_idle_timeout = ADAMTX_IDLE_TIMEOUT_S;
+module_param_named(idle_timeout, adamtx_idle_timeout, uint, S_IRUGO);
+MODULE_PARM_DESC(idle_timeout, "Seconds of black frames or of an unused framebuffer before the panel is blanked and the threads are parked, 0 to disable");
 
-static struct adamtx_update_param adamtx_update_param;
-struct task_struct* adamtx_update_thread;
+static unsigned int adamtx_led_current = ADAMTX_LED_CURRENT_UA;
+module_param_named(led_current, adamtx_led_current, uint, S_IRUGO);
+MODULE_PARM_DESC(led_current, "Default current of one LED while on in uA, for the power limiter");
 
-static struct adamtx_draw_param adamtx_draw_param;
-struct task_struct* adamtx_draw_thread;
+static unsigned int adamtx_current_limit = ADAMTX_CURRENT_LIMIT_MA;
+module_param_named(current_limit, adamtx_current_limit, uint, S_IRUGO);
+MODULE_PARM_DESC(current_limit, "Default average LED current budget of a chain in mA, brighter frames are shown with reduced on-time, 0 to disable");
 
-struct task_struct* adamtx_perf_thread;
-static int adamtx_do_perf = 0;
+static bool adamtx_selftest_enabled = false;
+module_param_named(selftest, adamtx_selftest_enabled, bool, S_IRUGO);
+MODULE_PARM_DESC(selftest, "Check the remap table of each display and time remap and encoder on its chain on probe, results go to the kernel log");
 
-static uint32_t* adamtx_intermediate_frame;
+static char* adamtx_firmware = NULL;
+module_param_named(firmware, adamtx_firmware, charp, S_IRUGO);
+MODULE_PARM_DESC(firmware, "Frame container played on startup, e.g. a boot splash");
+
+static DEFINE_IDA(adamtx_ida);
 
 #define ADAMTX_NUM_PANELS 2
 
@@ -53,7 +94,8 @@ static struct matrix_ledpanel adamtx_matrix_up = {
 	.realx = 0,
 	.realy = 0,
 	.flip_x = 1,
-	.flip_y = 0
+	.flip_y = 0,
+	.gain = {MATRIX_GAIN_MAX, MATRIX_GAIN_MAX, MATRIX_GAIN_MAX}
 };
 
 static struct matrix_ledpanel adamtx_matrix_low = {
@@ -65,116 +107,10 @@ static struct matrix_ledpanel adamtx_matrix_low = {
 	.realx = 0,
 	.realy = 32,
 	.flip_x = 1,
-	.flip_y = 0
+	.flip_y = 0,
+	.gain = {MATRIX_GAIN_MAX, MATRIX_GAIN_MAX, MATRIX_GAIN_MAX}
 };
 
-static struct hrtimer adamtx_frametimer;
-static ktime_t adamtx_frameperiod;
-static int adamtx_frametimer_enabled = 0;
-
-static struct hrtimer adamtx_updatetimer;
-static ktime_t adamtx_updateperiod;
-static int adamtx_updatetimer_enabled = 0;
-
-static DEFINE_SPINLOCK(adamtx_lock_draw);
-static int adamtx_do_draw = 0;
-static int adamtx_do_update = 0;
-
-static struct hrtimer adamtx_perftimer;
-static ktime_t adamtx_perfperiod;
-static int adamtx_perftimer_enabled = 0;
-
-void adamtx_clock_out_row(struct adamtx_panel_io* data, int length)
-{
-	while(--length >= 0)
-	{
-		adamtx_gpio_write_bits(((uint32_t*)data)[length]);
-		ADAMTX_GPIO_HI(ADAMTX_GPIO_CLK);
-	}
-}
-
-void adamtx_set_address(int i)
-{
-	struct adamtx_panel_io io;
-	*((uint32_t*)(&io)) = (i << ADAMTX_GPIO_OFFSET_ADDRESS) & ADAMTX_GPIO_MASK_ADDRESS_HI;
-	io.E = i >> 4;
-	adamtx_gpio_write_bits(*((uint32_t*)&io));
-}
-
-void remap_frame(struct matrix_ledpanel** panels, char* from, int width_from, int height_from, uint32_t* to, int width_to, int height_to)
-{
-	int i, j;
-	off_t offset;
-	struct matrix_ledpanel* panel;
-	struct matrix_pos pos;
-	for(i = 0; i < height_from; i++)
-	{
-		for(j = 0; j < width_from; j++)
-		{
-			panel = matrix_get_panel_at_real(panels, ADAMTX_NUM_PANELS, j, i);
-			matrix_panel_get_position(&pos, panel, j, i);
-			offset = i * width_from * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN;
-			to[pos.y * width_to + pos.x] = from[offset] | from[offset + 1] << 8 | from[offset + 2] << 16;
-		}
-	}
-}
-
-void prerender_frame_part(struct adamtx_frame* framepart)
-{
-	int i, j, k, addr;
-	uint32_t* frame = framepart->frame;
-	int rows = framepart->height;
-	int columns = framepart->width;
-	int pwm_steps = framepart->pwm_bits;
-	int vertical_offset = framepart->vertical_offset / 2;
-	struct adamtx_panel_io row[columns];
-	for(i = vertical_offset; i < vertical_offset + framepart->rows / 2; i++)
-	{
-		int row1_base = i * columns;
-		int row2_base = (rows / 2 + i) * columns;
-		for(j = 0; j < pwm_steps; j++)
-		{
-			memset(row, 0, columns * sizeof(struct adamtx_panel_io));
-			for(k = 0; k < columns; k++)
-			{
-				row[k].B1 = (frame[row1_base + k] & (1 << j)) > 0;
-				row[k].G1 = ((frame[row1_base + k] >> 8) & (1 << j)) > 0;
-				row[k].R1 = ((frame[row1_base + k] >> 16) & (1 << j)) > 0;
-				row[k].B2 = (frame[row2_base + k] & (1 << j)) > 0;
-				row[k].G2 = ((frame[row2_base + k] >> 8) & (1 << j)) > 0;
-				row[k].R2 = ((frame[row2_base + k] >> 16) & (1 << j)) > 0;
-				if(j == 0)
-					addr = (i + 1) % (framepart->rows / 2);
-				else
-					addr = i;
-				*((uint32_t*)(&row[k])) |= (addr << ADAMTX_GPIO_OFFSET_ADDRESS) & ADAMTX_GPIO_MASK_ADDRESS_HI;
-				row[k].E = addr >> 4;
-			}
-			memcpy(framepart->paneldata + i * pwm_steps * columns + j * columns, row, columns * sizeof(struct adamtx_panel_io));
-		}
-	}
-}
-
-void show_frame(struct adamtx_panel_io* frame, int bits, int rows, int columns)
-{
-	ADAMTX_GPIO_LO(ADAMTX_GPIO_OE);
-	int i, j, k;
-	int pwm_steps = bits;
-	for(i = rows / 2 - 1; i >= 0; i--)
-	{
-		for(j = 0; j < pwm_steps; j++)
-		{
-			adamtx_clock_out_row(frame + i * pwm_steps * columns + j * columns, columns);
-			ADAMTX_GPIO_HI(ADAMTX_GPIO_OE);
-			ADAMTX_GPIO_HI(ADAMTX_GPIO_STR);
-			ADAMTX_GPIO_LO(ADAMTX_GPIO_STR);
-			ADAMTX_GPIO_LO(ADAMTX_GPIO_OE);
-			ndelay((1 << j) * ADAMTX_BCD_TIME_NS);
-		}
-	}
-	ADAMTX_GPIO_HI(ADAMTX_GPIO_OE);
-}
-
 void render_part(struct adamtx_frame* part)
 {
 	struct adamtx_frame* framepart = (struct adamtx_frame*)part;
@@ -184,6 +120,7 @@ void render_part(struct adamtx_frame* part)
 int process_frame(struct adamtx_processable_frame* frame)
 {
 	int i;
+	int dither_frames = 1 << frame->dither_bits;
 
 /*	int datalen = frame->rows * frame->columns * sizeof(uint32_t);
 
@@ -193,97 +130,226 @@ int process_frame(struct adamtx_processable_frame* frame)
 	if(data == NULL)
 		return -ENOMEM;
 */
-	remap_frame(frame->panels, frame->frame, frame->width, frame->height, adamtx_intermediate_frame, frame->columns, frame->rows);
+	frame->lit = remap_frame(frame->remap_table, frame->gain, frame->frame, frame->format, frame->width * frame->height, frame->intermediate, frame->rows * frame->columns);
 
 //	memset(frame->iodata, 0, frame->pwm_bits * frame->columns * frame->rows / 2 * sizeof(struct adamtx_panel_io));
 
+	int fold = frame->encoder->fold;
+
 	struct adamtx_frame threadframe = {
 		.width = frame->columns,
 		.height = frame->rows,
-		.vertical_offset = 0,
-		.rows = frame->rows,
+		.vertical_offset = frame->first_address * 2 * fold,
+		.rows = (frame->last_address - frame->first_address) * 2 * fold,
 		.paneldata = frame->iodata,
 		.paneloffset = 0,
-		.frame = adamtx_intermediate_frame,
+		.frame = frame->intermediate,
 		.frameoffset = 0,
-		.pwm_bits = frame->pwm_bits
+		.pwm_bits = frame->pwm_bits,
+		.dither_bits = frame->dither_bits,
+		.encoder = frame->encoder,
+		.lines = frame->lines
 	};
 
-	render_part(&threadframe);
+	// Each dither frame is a complete set of bitplanes
+	for(i = 0; i < dither_frames; i++)
+	{
+		threadframe.dither_frame = i;
+		threadframe.paneldata = frame->iodata + i * ADAMTX_PANELDATA_LEN(frame->pwm_bits, frame->rows, frame->columns);
+		render_part(&threadframe);
+	}
 
 //	vfree(data);
 	return 0;
 }
 
-static unsigned long adamtx_draws = 0;
-static unsigned long adamtx_draw_irqs = 0;
-static unsigned long adamtx_draw_time = 0;
+void adamtx_fill_frame(struct adamtx* adamtx, struct adamtx_processable_frame* frame)
+{
+	frame->width = adamtx->real_width;
+	frame->height = adamtx->real_height;
+	frame->columns = adamtx->columns;
+	frame->rows = adamtx->rows;
+	frame->pwm_bits = adamtx->pwm_bits;
+	frame->dither_bits = adamtx->dither_bits;
+	frame->first_address = 0;
+	frame->last_address = adamtx->scan.addresses;
+	frame->iodata = adamtx->paneldata;
+	frame->frame = adamtx->framedata;
+	frame->intermediate = adamtx->intermediate_frame;
+	frame->remap_table = adamtx->remap_table;
+	frame->format = DUMMYFB_FORMAT_RGB888;
+	frame->encoder = &adamtx->encoder;
+	frame->lines = NULL;
+	frame->gain = adamtx->gain_lut ? &adamtx->gain : NULL;
+}
+
+/*
+ * On-time scale keeping the average LED current of a frame within the
+ * budget. Each address is lit for 1 / addresses of the refresh and every
+ * LED draws led_current for value / 255 of that, so lit predicts the
+ * current without another look at the frame. The model only holds with OE
+ * masked during clock out, so a configured limit never returns OFF.
+ */
+unsigned int adamtx_power_scale(struct adamtx* adamtx, unsigned long lit)
+{
+	u64 current_ua, budget_ua;
+	if(adamtx->current_limit == 0)
+		return ADAMTX_POWER_SCALE_OFF;
+	if(lit == 0)
+		return ADAMTX_POWER_SCALE_ONE;
+	current_ua = div_u64((u64)lit * adamtx->led_current, 255 * adamtx->scan.addresses);
+	budget_ua = (u64)adamtx->current_limit * 1000;
+	if(current_ua <= budget_ua)
+		return ADAMTX_POWER_SCALE_ONE;
+	return div64_u64(budget_ua << ADAMTX_POWER_SCALE_SHIFT, current_ua);
+}
 
 static int draw_frame(void* arg)
 {
 	unsigned long irqflags;
 	struct timespec before;
 	struct timespec after;
-	struct adamtx_draw_param* param = (struct adamtx_draw_param*)arg;
-	printk(KERN_INFO ADAMTX_NAME ": Draw spacing: %lu us", 1000000UL / param->rate);
+	struct adamtx* adamtx = arg;
+	struct adamtx_panel_io* paneldata;
+	int source;
+	unsigned int scale;
+	s64 latency, draw_time;
+	ktime_t start;
+	int paneldata_len = ADAMTX_PANELDATA_LEN(adamtx->pwm_bits, adamtx->rows, adamtx->columns);
+	dev_info(&adamtx->pdev->dev, "Draw spacing: %lu us", 1000000UL / adamtx->draw.rate);
 	while(!kthread_should_stop())
 	{
-		while(!adamtx_do_draw && !kthread_should_stop())
+		while(!adamtx->draw.do_work && !kthread_should_stop() && !kthread_should_park())
 			usleep_range(50, 500);
 		if(kthread_should_stop())
 			break;
-		adamtx_do_draw = 0;
-		spin_lock_irqsave(&adamtx_lock_draw, irqflags);
+		if(kthread_should_park())
+		{
+			kthread_parkme();
+			continue;
+		}
+		adamtx->draw.do_work = 0;
+		start = ktime_get();
+		latency = ktime_to_ns(ktime_sub(start, adamtx->draw.expired));
+		trace_adamtx_wakeup(adamtx->id, "draw", latency);
+		adamtx_stats_record(&adamtx->stats, ADAMTX_HIST_DRAW_WAKEUP, latency);
+		if(adamtx->stats.last_draw)
+			adamtx_stats_record(&adamtx->stats, ADAMTX_HIST_REFRESH, ktime_to_ns(ktime_sub(start, adamtx->stats.last_draw)));
+		adamtx->stats.last_draw = start;
+		spin_lock_irqsave(&adamtx->lock_draw, irqflags);
 		getnstimeofday(&before);
-		show_frame(paneldata, ADAMTX_PWM_BITS, ADAMTX_ROWS, ADAMTX_COLUMNS);
+		// Bitplanes queued by userspace take precedence over the playlist and the framebuffer,
+		// without a lit sum the limiter leaves them at full on-time
+		source = ADAMTX_SOURCE_USER;
+		scale = adamtx_power_scale(adamtx, 0);
+		paneldata = adamtx_chrdev_swap(adamtx);
+		if(paneldata == NULL)
+		{
+			source = ADAMTX_SOURCE_PLAYLIST;
+			paneldata = adamtx_playlist_next(adamtx, &scale);
+		}
+		if(paneldata == NULL)
+		{
+			source = ADAMTX_SOURCE_FB;
+			paneldata = adamtx->paneldata;
+			scale = adamtx->power_scale;
+			adamtx_stats_shown(&adamtx->stats, ktime_get_ns());
+		}
+		trace_adamtx_draw_start(adamtx->id, source, adamtx->dither_frame);
+		show_frame(adamtx->id, &adamtx->encoder, paneldata + adamtx->dither_frame * paneldata_len, adamtx->pwm_bits, scale);
+		adamtx->dither_frame = (adamtx->dither_frame + 1) % adamtx->dither_frames;
+		trace_adamtx_draw_end(adamtx->id);
 		getnstimeofday(&after);
-		adamtx_draw_time += (after.tv_sec - before.tv_sec) * 1000000000UL + (after.tv_nsec - before.tv_nsec);
-		adamtx_draws++;
-		spin_unlock_irqrestore(&adamtx_lock_draw, irqflags);
+		draw_time = (after.tv_sec - before.tv_sec) * 1000000000LL + (after.tv_nsec - before.tv_nsec);
+		adamtx_stats_record(&adamtx->stats, ADAMTX_HIST_DRAW, draw_time);
+		adamtx->draw_time += draw_time;
+		adamtx->draws++;
+		spin_unlock_irqrestore(&adamtx->lock_draw, irqflags);
 	}
 	do_exit(0);	
 }
 
-static unsigned long adamtx_updates = 0;
-static unsigned long adamtx_update_irqs = 0;
-static unsigned long adamtx_update_time = 0;
-
 static int update_frame(void* arg)
 {
 	int err;
 	unsigned long irqflags;
 	struct timespec before;
 	struct timespec after;
-	struct adamtx_update_param* param = (struct adamtx_update_param*)arg;
-	printk(KERN_INFO ADAMTX_NAME ": Update spacing: %lu us", 1000000UL / param->rate);
+	struct adamtx* adamtx = arg;
+	struct adamtx_processable_frame frame;
+	struct adamtx_address_range damage;
+	u64 hash;
+	s64 latency, update_time;
+	dev_info(&adamtx->pdev->dev, "Update spacing: %lu us", 1000000UL / adamtx->update.rate);
+	adamtx_fill_frame(adamtx, &frame);
 	while(!kthread_should_stop())
 	{
-		while(!adamtx_do_update && !kthread_should_stop())
+		while(!adamtx->update.do_work && !kthread_should_stop() && !kthread_should_park())
 			usleep_range(50, 500);
 		if(kthread_should_stop())
 			break;
-		adamtx_do_update = 0;
-
-		dummyfb_copy(framedata);
-
-		struct adamtx_processable_frame frame = {
-			.width = ADAMTX_REAL_WIDTH,
-			.height = ADAMTX_REAL_HEIGHT,
-			.columns = ADAMTX_COLUMNS,
-			.rows = ADAMTX_ROWS,
-			.pwm_bits = ADAMTX_PWM_BITS,
-			.iodata = paneldata,
-			.frame = framedata,
-			.panels = adamtx_panels
-		};
-
-		spin_lock_irqsave(&adamtx_lock_draw, irqflags);
+		if(kthread_should_park())
+		{
+			kthread_parkme();
+			continue;
+		}
+		adamtx->update.do_work = 0;
+		latency = ktime_to_ns(ktime_sub(ktime_get(), adamtx->update.expired));
+		trace_adamtx_wakeup(adamtx->id, "update", latency);
+		adamtx_stats_record(&adamtx->stats, ADAMTX_HIST_UPDATE_WAKEUP, latency);
+		if(adamtx->chrdev.active != ADAMTX_USER_NONE || adamtx->playlist.playing)
+			continue;
+
+		spin_lock_irqsave(&adamtx->lock_damage, irqflags);
+		damage = adamtx->damage;
+		adamtx->damage.first = adamtx->damage.last = 0;
+		spin_unlock_irqrestore(&adamtx->lock_damage, irqflags);
+		// Sampled frames come without damage and are encoded completely
+		if(damage.first >= damage.last)
+		{
+			damage.first = 0;
+			damage.last = adamtx->scan.addresses;
+		}
+		frame.first_address = damage.first;
+		frame.last_address = damage.last;
+
+		// Unchanged frames cost neither the copy nor the draw lock
+		hash = dummyfb_fingerprint(adamtx->fb_x, adamtx->fb_y, adamtx->real_width, adamtx->real_height);
+		if(adamtx->frame_hash_valid && hash == adamtx->frame_hash)
+		{
+			adamtx->update_skips++;
+			adamtx_stats_count(&adamtx->stats, ADAMTX_COUNT_UPDATE_SKIPPED, 1);
+			// Commits of identical content count as shown, their waiters are released like after a copy
+			atomic64_set(&adamtx->stats.commit_pending, 0);
+			dummyfb_vsync();
+			continue;
+		}
+		adamtx->frame_hash = hash;
+		adamtx->frame_hash_valid = 1;
+
+		frame.format = dummyfb_copy_rect(adamtx->framedata, adamtx->fb_x, adamtx->fb_y, adamtx->real_width, adamtx->real_height);
+		// The displayed page is copied, renderers may reuse the previous one
+		dummyfb_vsync();
+
+		spin_lock_irqsave(&adamtx->lock_draw, irqflags);
 		getnstimeofday(&before);
+		trace_adamtx_update_start(adamtx->id, frame.first_address, frame.last_address);
 		err = process_frame(&frame);
+		trace_adamtx_update_end(adamtx->id, (frame.last_address - frame.first_address) * 2 * adamtx->encoder.fold, frame.lit);
 		getnstimeofday(&after);
-		adamtx_update_time += (after.tv_sec - before.tv_sec) * 1000000000UL + (after.tv_nsec - before.tv_nsec);
-		adamtx_updates++;
-		spin_unlock_irqrestore(&adamtx_lock_draw, irqflags);
+		adamtx->power_scale = adamtx_power_scale(adamtx, frame.lit);
+		if(adamtx->power_scale < ADAMTX_POWER_SCALE_ONE)
+			adamtx_stats_count(&adamtx->stats, ADAMTX_COUNT_POWER_LIMITED, 1);
+		adamtx->last_change = ktime_get();
+		if(frame.lit == 0 && !adamtx->frame_black)
+			adamtx->black_since = adamtx->last_change;
+		adamtx->frame_black = frame.lit == 0;
+		update_time = (after.tv_sec - before.tv_sec) * 1000000000LL + (after.tv_nsec - before.tv_nsec);
+		adamtx_stats_record(&adamtx->stats, ADAMTX_HIST_UPDATE, update_time);
+		adamtx_stats_encoded(&adamtx->stats);
+		adamtx->update_time += update_time;
+		adamtx->updates++;
+		spin_unlock_irqrestore(&adamtx->lock_draw, irqflags);
 		if(err)
 			do_exit(err);
 	}
@@ -292,247 +358,817 @@ static int update_frame(void* arg)
 
 static int show_perf(void* arg)
 {
-	long irqflags, perf_adamtx_updates, perf_adamtx_update_irqs, perf_adamtx_update_time;
+	long irqflags, perf_adamtx_updates, perf_adamtx_update_skips, perf_adamtx_update_irqs, perf_adamtx_update_time;
 	long perf_adamtx_draws, perf_adamtx_draw_irqs, perf_adamtx_draw_time;
+	struct adamtx* adamtx = arg;
 	while(!kthread_should_stop())
     {
-        while(!adamtx_do_perf && !kthread_should_stop())
+        while(!adamtx->perf.do_work && !kthread_should_stop())
             usleep_range(5000, 10000);
         if(kthread_should_stop())
             break;
-		adamtx_do_perf = 0;
-
-		spin_lock_irqsave(&adamtx_lock_draw, irqflags);
-
-		perf_adamtx_updates = adamtx_updates;
-		adamtx_updates = 0;
-		perf_adamtx_update_irqs = adamtx_update_irqs;
-		adamtx_update_irqs = 0;
-		perf_adamtx_update_time = adamtx_update_time;
-		adamtx_update_time = 0;
-
-		perf_adamtx_draws = adamtx_draws;
-		adamtx_draws = 0;
-		perf_adamtx_draw_irqs = adamtx_draw_irqs;
-		adamtx_draw_irqs = 0;
-		perf_adamtx_draw_time = adamtx_draw_time;
-		adamtx_draw_time = 0;
-
-		spin_unlock_irqrestore(&adamtx_lock_draw, irqflags);
-		printk(KERN_INFO ADAMTX_NAME ": %ld updates/s\t%ld irqs/s\t%lu ns/update", perf_adamtx_updates, perf_adamtx_update_irqs, perf_adamtx_updates != 0 ? perf_adamtx_update_time / perf_adamtx_updates : 0);
-		printk(KERN_INFO ADAMTX_NAME ": %ld draws/s\t%ld irqs/s\t%lu ns/draw", perf_adamtx_draws, perf_adamtx_draw_irqs, perf_adamtx_draws != 0 ? perf_adamtx_draw_time / perf_adamtx_draws : 0);	
+		adamtx->perf.do_work = 0;
+
+		spin_lock_irqsave(&adamtx->lock_draw, irqflags);
+
+		perf_adamtx_updates = adamtx->updates;
+		adamtx->updates = 0;
+		perf_adamtx_update_skips = adamtx->update_skips;
+		adamtx->update_skips = 0;
+		perf_adamtx_update_irqs = adamtx->update_irqs;
+		adamtx->update_irqs = 0;
+		perf_adamtx_update_time = adamtx->update_time;
+		adamtx->update_time = 0;
+
+		perf_adamtx_draws = adamtx->draws;
+		adamtx->draws = 0;
+		perf_adamtx_draw_irqs = adamtx->draw_irqs;
+		adamtx->draw_irqs = 0;
+		perf_adamtx_draw_time = adamtx->draw_time;
+		adamtx->draw_time = 0;
+
+		spin_unlock_irqrestore(&adamtx->lock_draw, irqflags);
+		dev_info(&adamtx->pdev->dev, "%ld updates/s\t%ld skipped/s\t%ld irqs/s\t%lu ns/update", perf_adamtx_updates, perf_adamtx_update_skips, perf_adamtx_update_irqs, perf_adamtx_updates != 0 ? perf_adamtx_update_time / perf_adamtx_updates : 0);
+		dev_info(&adamtx->pdev->dev, "%ld draws/s\t%ld irqs/s\t%lu ns/draw", perf_adamtx_draws, perf_adamtx_draw_irqs, perf_adamtx_draws != 0 ? perf_adamtx_draw_time / perf_adamtx_draws : 0);	
 	}
+	do_exit(0);
 }
 
 static enum hrtimer_restart update_callback(struct hrtimer* timer)
 {
-	hrtimer_forward_now(timer, adamtx_frameperiod);
-	adamtx_do_update = 1;
-	adamtx_update_irqs++;
+	struct adamtx* adamtx = container_of(timer, struct adamtx, update.timer);
+	u64 periods = hrtimer_forward_now(timer, adamtx->update.period);
+	if(periods > 1)
+		adamtx_stats_count(&adamtx->stats, ADAMTX_COUNT_UPDATE_MISSED, periods - 1);
+	// Producers that commit their frames are not sampled
+	if(ktime_ms_delta(ktime_get(), adamtx->last_commit) >= ADAMTX_COMMIT_TIMEOUT_MS)
+	{
+		if(adamtx->update.do_work)
+			adamtx_stats_count(&adamtx->stats, ADAMTX_COUNT_UPDATE_PENDING, 1);
+		adamtx->update.expired = ktime_get();
+		adamtx->update.do_work = 1;
+	}
+	adamtx->update_irqs++;
 	return HRTIMER_RESTART;
 }
 
+static int adamtx_fb_notify(struct notifier_block* nb, unsigned long event, void* data)
+{
+	struct adamtx* adamtx = container_of(nb, struct adamtx, fb_notifier);
+	struct dummyfb_commit* commit = data;
+	struct dummyfb_damage* damage = commit->damage;
+	unsigned long irqflags;
+	int y, top, bottom;
+	if(event != DUMMYFB_EVENT_COMMIT)
+		return NOTIFY_DONE;
+	adamtx->last_commit = ktime_get();
+	adamtx_idle_wake(adamtx);
+	// Only frames touching the area of this display need an update
+	if(damage->x >= adamtx->fb_x + adamtx->real_width || damage->x + damage->width <= adamtx->fb_x ||
+		damage->y >= adamtx->fb_y + adamtx->real_height || damage->y + damage->height <= adamtx->fb_y)
+		return NOTIFY_OK;
+	// Re-encode only the addresses driving the damaged rows
+	top = max_t(int, damage->y - adamtx->fb_y, 0);
+	bottom = min_t(int, damage->y + damage->height - adamtx->fb_y, adamtx->real_height);
+	spin_lock_irqsave(&adamtx->lock_damage, irqflags);
+	for(y = top; y < bottom; y++)
+	{
+		if(adamtx->damage_map[y].first >= adamtx->damage_map[y].last)
+			continue;
+		if(adamtx->damage.first >= adamtx->damage.last)
+		{
+			adamtx->damage = adamtx->damage_map[y];
+			continue;
+		}
+		adamtx->damage.first = min(adamtx->damage.first, adamtx->damage_map[y].first);
+		adamtx->damage.last = max(adamtx->damage.last, adamtx->damage_map[y].last);
+	}
+	spin_unlock_irqrestore(&adamtx->lock_damage, irqflags);
+	adamtx->update.expired = ktime_get();
+	adamtx_stats_commit(&adamtx->stats, ktime_to_ns(adamtx->update.expired));
+	adamtx->update.do_work = 1;
+	return NOTIFY_OK;
+}
+
 static enum hrtimer_restart draw_callback(struct hrtimer* timer)
 {
-	hrtimer_forward_now(timer, adamtx_frameperiod);
-	adamtx_do_draw = 1;
-	adamtx_draw_irqs++;
+	struct adamtx* adamtx = container_of(timer, struct adamtx, draw.timer);
+	u64 periods = hrtimer_forward_now(timer, adamtx->draw.period);
+	if(periods > 1)
+		adamtx_stats_count(&adamtx->stats, ADAMTX_COUNT_DRAW_MISSED, periods - 1);
+	if(adamtx->draw.do_work)
+		adamtx_stats_count(&adamtx->stats, ADAMTX_COUNT_DRAW_PENDING, 1);
+	adamtx->draw.expired = ktime_get();
+	adamtx->draw.do_work = 1;
+	adamtx->draw_irqs++;
 	return HRTIMER_RESTART;
 }
 
 static enum hrtimer_restart perf_callback(struct hrtimer* timer)
 {
-	hrtimer_forward_now(timer, adamtx_perfperiod);
-	adamtx_do_perf = 1;
+	struct adamtx* adamtx = container_of(timer, struct adamtx, perf.timer);
+	hrtimer_forward_now(timer, adamtx->perf.period);
+	adamtx->perf.do_work = 1;
 
 	return HRTIMER_RESTART;
 }
 
-static void __init adamtx_init_gpio(void)
+static int adamtx_start_thread(struct adamtx* adamtx, struct adamtx_thread* thread, int (*threadfn)(void* data), const char* name)
 {
-	adamtx_gpio_set_outputs((1 << ADAMTX_GPIO_R1) | (1 << ADAMTX_GPIO_R2) | (1 << ADAMTX_GPIO_G1) | (1 << ADAMTX_GPIO_G2) | (1 << ADAMTX_GPIO_B1) | (1 << ADAMTX_GPIO_B2) | (1 << ADAMTX_GPIO_A) | (1 << ADAMTX_GPIO_B) | (1 << ADAMTX_GPIO_C) | (1 << ADAMTX_GPIO_D) | (1 << ADAMTX_GPIO_E) | (1 << ADAMTX_GPIO_OE) | (1 << ADAMTX_GPIO_STR) | (1 << ADAMTX_GPIO_CLK));
+	int ret;
+	thread->task = kthread_create(threadfn, adamtx, "adamtx_%s/%d", name, adamtx->id);
+	if(IS_ERR(thread->task))
+	{
+		ret = PTR_ERR(thread->task);
+		thread->task = NULL;
+		dev_warn(&adamtx->pdev->dev, "failed to create %s thread (%d)\n", name, ret);
+		return ret;
+	}
+	if(thread->cpu >= 0)
+		kthread_bind(thread->task, thread->cpu);
+	wake_up_process(thread->task);
+	return 0;
 }
 
-static int adamtx_probe(struct platform_device *device)
+static void adamtx_stop_thread(struct adamtx_thread* thread)
 {
-	int i, j, ret, framesize;
-	
-	if((ret = adamtx_gpio_alloc()))
+	if(thread->timer_enabled)
+		hrtimer_cancel(&thread->timer);
+	thread->timer_enabled = 0;
+	if(thread->task)
+		kthread_stop(thread->task);
+	thread->task = NULL;
+}
+
+static void adamtx_start_timer(struct adamtx_thread* thread, enum hrtimer_restart (*function)(struct hrtimer*))
+{
+	thread->period = ktime_set(0, 1000000000UL / thread->rate);
+	hrtimer_init(&thread->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	thread->timer.function = function;
+	hrtimer_start(&thread->timer, thread->period, HRTIMER_MODE_REL);
+	thread->timer_enabled = 1;
+}
+
+static int adamtx_idle_busy(struct adamtx* adamtx)
+{
+	return adamtx->chrdev.active != ADAMTX_USER_NONE || adamtx->chrdev.queued != ADAMTX_USER_NONE || adamtx->playlist.playing;
+}
+
+// Black for idle_timeout, or unchanged for idle_timeout while nobody has the framebuffer open
+static int adamtx_idle_due(struct adamtx* adamtx, ktime_t now)
+{
+	if(adamtx->idle_timeout == 0 || adamtx_idle_busy(adamtx))
+		return 0;
+	if(adamtx->frame_black && ktime_ms_delta(now, adamtx->black_since) >= adamtx->idle_timeout * 1000LL)
+		return 1;
+	return dummyfb_get_users() == 0 && ktime_ms_delta(now, adamtx->last_change) >= adamtx->idle_timeout * 1000LL &&
+		ktime_ms_delta(now, adamtx->last_commit) >= adamtx->idle_timeout * 1000LL;
+}
+
+static void adamtx_idle_enter(struct adamtx* adamtx)
+{
+	dev_info(&adamtx->pdev->dev, "idle, blanking display\n");
+	hrtimer_cancel(&adamtx->update.timer);
+	hrtimer_cancel(&adamtx->draw.timer);
+	adamtx->update.timer_enabled = adamtx->draw.timer_enabled = 0;
+	kthread_park(adamtx->update.task);
+	kthread_park(adamtx->draw.task);
+	// The draw thread is out of show_frame, nothing drives OE low anymore
+	adamtx_gpio_set_bits(adamtx->encoder.oe);
+	WRITE_ONCE(adamtx->idle, 1);
+}
+
+static void adamtx_idle_exit(struct adamtx* adamtx)
+{
+	dev_info(&adamtx->pdev->dev, "leaving idle\n");
+	WRITE_ONCE(adamtx->idle, 0);
+	adamtx->last_change = ktime_get();
+	adamtx->frame_black = 0;
+	kthread_unpark(adamtx->draw.task);
+	kthread_unpark(adamtx->update.task);
+	adamtx->update.do_work = 1;
+	adamtx_start_timer(&adamtx->draw, draw_callback);
+	adamtx_start_timer(&adamtx->update, update_callback);
+}
+
+static void adamtx_idle_work(struct work_struct* work)
+{
+	struct adamtx* adamtx = container_of(to_delayed_work(work), struct adamtx, idle_work);
+	ktime_t now = ktime_get();
+	if(adamtx->idle)
 	{
-		printk(KERN_WARNING ADAMTX_NAME ": failed to allocate gpios (%d)\n", ret);
-		goto none_alloced;
+		// mmap writers don't commit, the poll catches them
+		if(xchg(&adamtx->idle_wake, 0) || adamtx_idle_busy(adamtx) ||
+			dummyfb_fingerprint(adamtx->fb_x, adamtx->fb_y, adamtx->real_width, adamtx->real_height) != adamtx->frame_hash)
+			adamtx_idle_exit(adamtx);
+	}
+	else if(adamtx_idle_due(adamtx, now))
+	{
+		adamtx_idle_enter(adamtx);
+	}
+	schedule_delayed_work(&adamtx->idle_work, msecs_to_jiffies(ADAMTX_IDLE_POLL_MS));
+}
+
+// Safe from atomic context, ends idle on the next run of the idle work
+void adamtx_idle_wake(struct adamtx* adamtx)
+{
+	if(!READ_ONCE(adamtx->idle))
+		return;
+	WRITE_ONCE(adamtx->idle_wake, 1);
+	mod_delayed_work(system_wq, &adamtx->idle_work, 0);
+}
+
+// Safe from atomic context, the next update encodes the whole framebuffer even if it is unchanged
+void adamtx_force_update(struct adamtx* adamtx)
+{
+	unsigned long irqflags;
+	spin_lock_irqsave(&adamtx->lock_damage, irqflags);
+	adamtx->damage.first = 0;
+	adamtx->damage.last = adamtx->scan.addresses;
+	spin_unlock_irqrestore(&adamtx->lock_damage, irqflags);
+	adamtx->frame_hash_valid = 0;
+	adamtx->update.do_work = 1;
+}
+
+static void adamtx_release(struct kref* ref)
+{
+	struct adamtx* adamtx = container_of(ref, struct adamtx, ref);
+	adamtx_chrdev_free_buffers(adamtx);
+	vfree(adamtx);
+}
+
+void adamtx_get(struct adamtx* adamtx)
+{
+	kref_get(&adamtx->ref);
+}
+
+void adamtx_put(struct adamtx* adamtx)
+{
+	kref_put(&adamtx->ref, adamtx_release);
+}
+
+// Spreads the threads of multiple instances over the available cpus, highest cpus first
+static int adamtx_default_cpu(int id, int offset)
+{
+	int cpus = num_online_cpus();
+	return ((cpus - 1 - offset - 2 * id) % cpus + cpus) % cpus;
+}
+
+static void adamtx_of_read_cpu(struct adamtx* adamtx, const char* prop, struct adamtx_thread* thread)
+{
+	u32 cpu;
+	if(of_property_read_u32(adamtx->pdev->dev.of_node, prop, &cpu))
+		return;
+	if(cpu >= nr_cpu_ids || !cpu_online(cpu))
+	{
+		dev_warn(&adamtx->pdev->dev, "%s: cpu %u not available, using cpu %d\n", prop, cpu, thread->cpu);
+		return;
 	}
-	adamtx_init_gpio();
+	thread->cpu = cpu;
+}
 
-	adamtx_panels = vmalloc(ADAMTX_NUM_PANELS * sizeof(struct matrix_ledpanel*));
-	if(adamtx_panels == NULL)
+static int adamtx_of_parse_scan(struct adamtx* adamtx)
+{
+	u32 value;
+	const char* mode;
+	struct device_node* node = adamtx->pdev->dev.of_node;
+
+	if(!of_property_read_u32(node, "adafruit,scan", &value))
+		adamtx->scan.addresses = value;
+	if(!of_property_read_u32(node, "adafruit,zigzag", &value))
+		adamtx->scan.zigzag = value;
+	adamtx->scan.zigzag_invert = of_property_read_bool(node, "adafruit,zigzag-invert");
+	if(of_property_read_string(node, "adafruit,address-mode", &mode))
+		return 0;
+	if(!strcmp(mode, "direct"))
+		adamtx->scan.address_mode = ADAMTX_ADDRESS_DIRECT;
+	else if(!strcmp(mode, "shift-register"))
+		adamtx->scan.address_mode = ADAMTX_ADDRESS_SHIFT;
+	else
 	{
-		ret = -ENOMEM;
-		printk(KERN_WARNING ADAMTX_NAME ": failed to allocate panels (%d)\n", ret);
-		goto gpio_alloced;
+		dev_warn(&adamtx->pdev->dev, "unknown address mode %s\n", mode);
+		return -EINVAL;
 	}
-	adamtx_panels[0] = &adamtx_matrix_up;
-	adamtx_panels[1] = &adamtx_matrix_low;
+	return 0;
+}
+
+static int adamtx_of_parse(struct adamtx* adamtx, uint32_t* pins)
+{
+	u32 rate;
+	u32 offset[2];
+	struct device_node* node = adamtx->pdev->dev.of_node;
+
+	if(adamtx_pinout_len != ADAMTX_NUM_PINS)
+	{
+		dev_warn(&adamtx->pdev->dev, "pinout needs exactly %d gpios\n", ADAMTX_NUM_PINS);
+		return -EINVAL;
+	}
+	memcpy(pins, adamtx_pinout, sizeof(adamtx_pinout));
+
+	adamtx->update.cpu = adamtx_default_cpu(adamtx->id, 1);
+	adamtx->draw.cpu = adamtx_default_cpu(adamtx->id, 0);
+	adamtx->perf.cpu = -1;
+	adamtx->update.rate = ADAMTX_FBRATE;
+	adamtx->draw.rate = ADAMTX_RATE;
+	adamtx->perf.rate = ADAMTX_PERF_RATE;
+	adamtx->scan.addresses = adamtx_scan;
+	adamtx->scan.address_mode = adamtx_address_mode;
+	adamtx->scan.zigzag = adamtx_zigzag;
+	adamtx->led_current = adamtx_led_current;
+	adamtx->current_limit = adamtx_current_limit;
+
+	if(!node)
+		return 0;
+
+	adamtx_of_read_cpu(adamtx, "adafruit,update-cpu", &adamtx->update);
+	adamtx_of_read_cpu(adamtx, "adafruit,draw-cpu", &adamtx->draw);
+	if(!of_property_read_u32(node, "adafruit,update-rate", &rate) && rate > 0)
+		adamtx->update.rate = rate;
+	if(!of_property_read_u32(node, "adafruit,refresh-rate", &rate) && rate > 0)
+		adamtx->draw.rate = rate;
+	if(!of_property_read_u32_array(node, "adafruit,fb-offset", offset, 2))
+	{
+		adamtx->fb_x = offset[0];
+		adamtx->fb_y = offset[1];
+	}
+	of_property_read_u32(node, "adafruit,led-current-ua", &adamtx->led_current);
+	of_property_read_u32(node, "adafruit,current-limit-ma", &adamtx->current_limit);
+	if(of_find_property(node, "adafruit,pinout", NULL) && of_property_read_u32_array(node, "adafruit,pinout", pins, ADAMTX_NUM_PINS))
+	{
+		dev_warn(&adamtx->pdev->dev, "adafruit,pinout needs exactly %d gpios\n", ADAMTX_NUM_PINS);
+		return -EINVAL;
+	}
+	return adamtx_of_parse_scan(adamtx);
+}
 
-	framesize = ADAMTX_REAL_HEIGHT * ADAMTX_REAL_WIDTH * ADAMTX_PIX_LEN;
-	if(dummyfb_get_fbsize() != framesize)
+static int adamtx_of_parse_panel(struct adamtx* adamtx, struct device_node* child, struct matrix_ledpanel* panel)
+{
+	u32 size[2];
+	u32 chain[2] = {0, 0};
+	u32 position[2] = {0, 0};
+	u32 gain[3] = {MATRIX_GAIN_MAX, MATRIX_GAIN_MAX, MATRIX_GAIN_MAX};
+	int i;
+
+	if(of_property_read_u32_array(child, "adafruit,size", size, 2) || size[0] == 0 || size[1] == 0)
 	{
-        ret = -EINVAL;
-        printk(KERN_WARNING ADAMTX_NAME ": size of framebuffer != framesize\n");
-        goto framedata_alloced;
+		dev_warn(&adamtx->pdev->dev, "%s: adafruit,size missing\n", child->name);
+		return -EINVAL;
 	}
-	framedata = vzalloc(framesize);
-	if(framedata == NULL)
+	of_property_read_u32_array(child, "adafruit,chain-offset", chain, 2);
+	of_property_read_u32_array(child, "adafruit,fb-position", position, 2);
+	panel->name = (char*)child->name;
+	panel->xres = size[0];
+	panel->yres = size[1];
+	panel->virtual_x = chain[0];
+	panel->virtual_y = chain[1];
+	panel->realx = position[0];
+	panel->realy = position[1];
+	panel->flip_x = of_property_read_bool(child, "adafruit,flip-x");
+	panel->flip_y = of_property_read_bool(child, "adafruit,flip-y");
+	if(of_find_property(child, "adafruit,color-gain", NULL) && of_property_read_u32_array(child, "adafruit,color-gain", gain, 3))
+	{
+		dev_warn(&adamtx->pdev->dev, "%s: adafruit,color-gain needs R, G and B\n", child->name);
+		return -EINVAL;
+	}
+	for(i = 0; i < 3; i++)
+		panel->gain[i] = min_t(u32, gain[i], MATRIX_GAIN_MAX);
+	return 0;
+}
+
+/*
+ * Panels of the chain, either from the child nodes of the device or the two
+ * 64x32 panel default. The chain and display dimensions follow from the panels.
+ */
+static int adamtx_setup_panels(struct adamtx* adamtx)
+{
+	int i, x, y, ret;
+	struct matrix_pos pos;
+	struct device_node* node = adamtx->pdev->dev.of_node;
+	struct device_node* child;
+	struct matrix_ledpanel* panel;
+
+	adamtx->num_panels = node ? of_get_available_child_count(node) : 0;
+	if(adamtx->num_panels == 0)
+		adamtx->num_panels = ADAMTX_NUM_PANELS;
+	adamtx->panels = vmalloc(adamtx->num_panels * sizeof(struct matrix_ledpanel*));
+	if(adamtx->panels == NULL)
+		return -ENOMEM;
+	adamtx->panel_store = vzalloc(adamtx->num_panels * sizeof(struct matrix_ledpanel));
+	if(adamtx->panel_store == NULL)
 	{
 		ret = -ENOMEM;
-		printk(KERN_WARNING ADAMTX_NAME ": failed to allocate frame memory (%d)\n", ret);
 		goto panels_alloced;
 	}
-	paneldata = vmalloc(ADAMTX_PWM_BITS * ADAMTX_ROWS / 2 * ADAMTX_COLUMNS * sizeof(struct adamtx_panel_io));
-	if(paneldata == NULL)
+	if(node && of_get_available_child_count(node))
+	{
+		i = 0;
+		for_each_available_child_of_node(node, child)
+		{
+			if((ret = adamtx_of_parse_panel(adamtx, child, &adamtx->panel_store[i++])))
+			{
+				of_node_put(child);
+				goto panel_store_alloced;
+			}
+		}
+	}
+	else
+	{
+		adamtx->panel_store[0] = adamtx_matrix_up;
+		adamtx->panel_store[1] = adamtx_matrix_low;
+	}
+
+	adamtx->rows = adamtx->columns = adamtx->real_width = adamtx->real_height = 0;
+	for(i = 0; i < adamtx->num_panels; i++)
+	{
+		panel = &adamtx->panel_store[i];
+		adamtx->panels[i] = panel;
+		adamtx->columns = max(adamtx->columns, panel->virtual_x + panel->xres);
+		adamtx->rows = max(adamtx->rows, panel->virtual_y + panel->yres);
+		adamtx->real_width = max(adamtx->real_width, panel->realx + panel->xres);
+		adamtx->real_height = max(adamtx->real_height, panel->realy + panel->yres);
+	}
+	if(adamtx->rows % 2)
+	{
+		ret = -EINVAL;
+		dev_warn(&adamtx->pdev->dev, "chain height must be even\n");
+		goto panel_store_alloced;
+	}
+
+	// Chain position of every display pixel, pixels without a panel go to the spare slot
+	adamtx->remap_table = vmalloc(adamtx->real_width * adamtx->real_height * sizeof(uint32_t));
+	if(adamtx->remap_table == NULL)
 	{
 		ret = -ENOMEM;
-		printk(KERN_WARNING ADAMTX_NAME ": failed to allocate panel memory (%d)\n", ret);
-		goto framedata_alloced;
+		goto panel_store_alloced;
 	}
-	adamtx_intermediate_frame = vmalloc(ADAMTX_ROWS * ADAMTX_COLUMNS * sizeof(uint32_t));
-	if(adamtx_intermediate_frame == NULL)
+	for(y = 0; y < adamtx->real_height; y++)
 	{
-        ret = -ENOMEM;
-        printk(KERN_WARNING ADAMTX_NAME ": failed to allocate intermediate frame memory (%d)\n", ret);
-        goto paneldata_alloced;
+		for(x = 0; x < adamtx->real_width; x++)
+		{
+			panel = matrix_get_panel_at_real(adamtx->panels, adamtx->num_panels, x, y);
+			if(panel == NULL)
+			{
+				adamtx->remap_table[y * adamtx->real_width + x] = adamtx->rows * adamtx->columns;
+				continue;
+			}
+			matrix_panel_get_position(&pos, panel, x, y);
+			adamtx->remap_table[y * adamtx->real_width + x] = pos.y * adamtx->columns + pos.x;
+		}
+	}
+	return 0;
+
+panel_store_alloced:
+	vfree(adamtx->panel_store);
+panels_alloced:
+	vfree(adamtx->panels);
+	return ret;
+}
+
+static int adamtx_panel_calibrated(struct matrix_ledpanel* panel)
+{
+	return panel->gain[0] != MATRIX_GAIN_MAX || panel->gain[1] != MATRIX_GAIN_MAX || panel->gain[2] != MATRIX_GAIN_MAX;
+}
+
+/*
+ * Gain tables of the panels and the panel of every display pixel, only set
+ * up if a panel needs one. Display pixels outside all panels use the first
+ * table, they end up in the spare slot anyway.
+ */
+static int adamtx_setup_gain(struct adamtx* adamtx)
+{
+	int i;
+	struct matrix_ledpanel* panel;
+
+	for(i = 0; i < adamtx->num_panels; i++)
+	{
+		if(adamtx_panel_calibrated(&adamtx->panel_store[i]))
+			break;
+	}
+	if(i == adamtx->num_panels)
+		return 0;
+
+	adamtx->gain_lut = vmalloc(adamtx->num_panels * ADAMTX_GAIN_LUT_LEN);
+	if(adamtx->gain_lut == NULL)
+		return -ENOMEM;
+	adamtx->gain_map = vzalloc(adamtx->real_width * adamtx->real_height * sizeof(uint16_t));
+	if(adamtx->gain_map == NULL)
+	{
+		vfree(adamtx->gain_lut);
+		adamtx->gain_lut = NULL;
+		return -ENOMEM;
+	}
+	for(i = 0; i < adamtx->num_panels; i++)
+		adamtx_gain_fill_lut(adamtx->gain_lut + i * ADAMTX_GAIN_LUT_LEN, adamtx->panel_store[i].gain);
+	for(i = 0; i < adamtx->real_width * adamtx->real_height; i++)
+	{
+		panel = matrix_get_panel_at_real(adamtx->panels, adamtx->num_panels, i % adamtx->real_width, i / adamtx->real_width);
+		if(panel)
+			adamtx->gain_map[i] = panel - adamtx->panel_store;
 	}
+	adamtx->gain.lut = adamtx->gain_lut;
+	adamtx->gain.map = adamtx->gain_map;
+	return 0;
+}
 
-	for(i = 0; i < ADAMTX_REAL_HEIGHT; i++)
+// Chain row r is driven by address (r % (rows / 2)) % addresses
+static int adamtx_setup_damage_map(struct adamtx* adamtx)
+{
+	int x, y, chain_row, address;
+	uint32_t pos;
+	struct adamtx_address_range* range;
+	adamtx->damage_map = vmalloc(adamtx->real_height * sizeof(struct adamtx_address_range));
+	if(adamtx->damage_map == NULL)
+		return -ENOMEM;
+	for(y = 0; y < adamtx->real_height; y++)
 	{
-		for(j = 0; j < ADAMTX_REAL_WIDTH; j++)
+		range = &adamtx->damage_map[y];
+		range->first = range->last = 0;
+		for(x = 0; x < adamtx->real_width; x++)
 		{
-			if(i == j || i == ADAMTX_REAL_WIDTH - j - 1)
+			pos = adamtx->remap_table[y * adamtx->real_width + x];
+			// Not covered by a panel
+			if(pos >= adamtx->rows * adamtx->columns)
+				continue;
+			chain_row = pos / adamtx->columns;
+			address = (chain_row % (adamtx->rows / 2)) % adamtx->scan.addresses;
+			if(range->first >= range->last)
 			{
-				framedata[i * ADAMTX_REAL_WIDTH * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN + 0] = 4;
-				framedata[i * ADAMTX_REAL_WIDTH * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN + 1] = 8;
-				framedata[i * ADAMTX_REAL_WIDTH * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN + 2] = 2;
+				range->first = address;
+				range->last = address + 1;
+				continue;
 			}
+			range->first = min(range->first, address);
+			range->last = max(range->last, address + 1);
 		}
 	}
+	return 0;
+}
 
-	struct adamtx_processable_frame frame = {
-		.width = ADAMTX_REAL_WIDTH,
-		.height = ADAMTX_REAL_HEIGHT,
-		.columns = ADAMTX_COLUMNS,
-		.rows = ADAMTX_ROWS,
-		.pwm_bits = ADAMTX_PWM_BITS,
-		.iodata = paneldata,
-		.frame = framedata,
-		.panels = adamtx_panels
-	};
-	
+static void adamtx_init_gpio(struct adamtx* adamtx)
+{
+	adamtx_gpio_set_outputs(adamtx->encoder.mask_all);
+	adamtx_gpio_set_bits(adamtx->encoder.oe);
+}
 
-	process_frame(&frame);
+static int adamtx_probe(struct platform_device *device)
+{
+	int i, j, ret, framesize;
+	uint32_t pins[ADAMTX_NUM_PINS];
+	struct adamtx* adamtx;
+	struct adamtx_processable_frame frame;
+	const char* firmware = adamtx_firmware;
 
-	adamtx_update_param.rate = ADAMTX_FBRATE;
-	adamtx_update_thread = kthread_create(update_frame, &adamtx_update_param, "adamtx_update");
-	kthread_bind(adamtx_update_thread, 2);
-	if(IS_ERR(adamtx_update_thread))
+	if(adamtx_dither_bits < 0 || adamtx_dither_bits > ADAMTX_DITHER_MAX_BITS)
 	{
-		ret = PTR_ERR(adamtx_update_thread);
-		printk(KERN_WARNING ADAMTX_NAME ": failed to create update thread (%d)\n", ret);
-		goto interframe_alloced;
+		dev_warn(&device->dev, "dither_bits must be between 0 and %d\n", ADAMTX_DITHER_MAX_BITS);
+		return -EINVAL;
 	}
-	wake_up_process(adamtx_update_thread);
 
-	adamtx_draw_param.rate = ADAMTX_RATE;
-	adamtx_draw_thread = kthread_create(draw_frame, &adamtx_draw_param, "adamtx_draw@");
-	kthread_bind(adamtx_draw_thread, 3);
-	if(IS_ERR(adamtx_draw_thread))
+	adamtx = vzalloc(sizeof(struct adamtx));
+	if(adamtx == NULL)
 	{
-		ret = PTR_ERR(adamtx_draw_thread);
-		printk(KERN_WARNING ADAMTX_NAME ": failed to create draw thread (%d)\n", ret);
-		goto interframe_alloced;
+		ret = -ENOMEM;
+		dev_warn(&device->dev, "failed to allocate device state (%d)\n", ret);
+		goto none_alloced;
 	}
-	wake_up_process(adamtx_draw_thread);
+	adamtx->pdev = device;
+	kref_init(&adamtx->ref);
+	spin_lock_init(&adamtx->lock_draw);
+	spin_lock_init(&adamtx->lock_damage);
+	INIT_DELAYED_WORK(&adamtx->idle_work, adamtx_idle_work);
+	adamtx->idle_timeout = adamtx_idle_timeout;
+	adamtx->id = ida_simple_get(&adamtx_ida, 0, ADAMTX_MAX_DEVICES, GFP_KERNEL);
+	if(adamtx->id < 0)
+	{
+		ret = adamtx->id;
+		goto adamtx_alloced;
+	}
+
+	adamtx->dither_bits = adamtx_dither_bits;
+	adamtx->pwm_bits = ADAMTX_PWM_BITS - adamtx->dither_bits;
+	adamtx->dither_frames = 1 << adamtx->dither_bits;
+	if((ret = adamtx_of_parse(adamtx, pins)))
+		goto id_alloced;
 
-	adamtx_perf_thread = kthread_create(show_perf, NULL, "adamtx_perf");
-	kthread_bind(adamtx_perf_thread, 1);
-	if(IS_ERR(adamtx_perf_thread))
+	if((ret = adamtx_setup_panels(adamtx)))
 	{
-		ret = PTR_ERR(adamtx_perf_thread);
-		printk(KERN_WARNING ADAMTX_NAME ": failed to create perf thread (%d)\n", ret);
-		goto interframe_alloced;
+		dev_warn(&device->dev, "failed to set up panels (%d)\n", ret);
+		goto id_alloced;
+	}
+	if((ret = adamtx_setup_gain(adamtx)))
+	{
+		dev_warn(&device->dev, "failed to set up color gains (%d)\n", ret);
+		goto panel_store_alloced;
 	}
-	wake_up_process(adamtx_perf_thread);
 
-	adamtx_frameperiod = ktime_set(0, 1000000000UL / ADAMTX_RATE);
-	hrtimer_init(&adamtx_frametimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	adamtx_frametimer.function = draw_callback;
-	hrtimer_start(&adamtx_frametimer, adamtx_frameperiod, HRTIMER_MODE_REL);
-	adamtx_frametimer_enabled = 1;
+	adamtx->scan.rows = adamtx->rows;
+	adamtx->scan.columns = adamtx->columns;
+	if(adamtx->scan.addresses == 0)
+		adamtx->scan.addresses = adamtx->rows / 2;
+	if((ret = adamtx_encoder_init(&adamtx->encoder, pins, adamtx->pwm_bits, &adamtx->scan)))
+	{
+		dev_warn(&device->dev, "failed to set up encoder, invalid pinout or scan? (%d)\n", ret);
+		goto panel_store_alloced;
+	}
+	if(adamtx->encoder.mask_all & ~adamtx_valid_gpio_bits)
+	{
+		ret = -EINVAL;
+		dev_warn(&device->dev, "pinout contains unusable gpios (0x%08x)\n", adamtx->encoder.mask_all & ~adamtx_valid_gpio_bits);
+		goto encoder_alloced;
+	}
+	if((ret = adamtx_setup_damage_map(adamtx)))
+		goto encoder_alloced;
 
-	adamtx_updateperiod = ktime_set(0, 1000000000UL / ADAMTX_FBRATE);
-	hrtimer_init(&adamtx_updatetimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	adamtx_updatetimer.function = update_callback;
-	hrtimer_start(&adamtx_updatetimer, adamtx_updateperiod, HRTIMER_MODE_REL);
-	adamtx_updatetimer_enabled = 1;
+	// Diagnostic only and before any GPIO is touched, a failure doesn't keep the display from working
+	if(adamtx_selftest_enabled && (ret = adamtx_selftest(adamtx)))
+		dev_warn(&device->dev, "selftest failed (%d)\n", ret);
 
-	adamtx_perfperiod = ktime_set(0, 1000000000UL);
-	hrtimer_init(&adamtx_perftimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	adamtx_perftimer.function = perf_callback;
-	hrtimer_start(&adamtx_perftimer, adamtx_perfperiod, HRTIMER_MODE_REL);
-	adamtx_perftimer_enabled = 1;
+	if((ret = adamtx_gpio_alloc()))
+	{
+		dev_warn(&device->dev, "failed to allocate gpios (%d)\n", ret);
+		goto encoder_alloced;
+	}
+	adamtx_init_gpio(adamtx);
 
-	printk(KERN_INFO ADAMTX_NAME ": initialized\n");
+	if(adamtx->fb_x < 0 || adamtx->fb_y < 0 || adamtx->fb_x + adamtx->real_width > dummyfb_get_width() || adamtx->fb_y + adamtx->real_height > dummyfb_get_height())
+	{
+		ret = -EINVAL;
+		dev_warn(&device->dev, "display area exceeds framebuffer\n");
+		goto gpio_alloced;
+	}
+	framesize = adamtx->real_height * adamtx->real_width * DUMMYFB_MAX_PIX_LEN;
+	adamtx->framedata = vzalloc(framesize);
+	if(adamtx->framedata == NULL)
+	{
+		ret = -ENOMEM;
+		dev_warn(&device->dev, "failed to allocate frame memory (%d)\n", ret);
+		goto gpio_alloced;
+	}
+	adamtx->paneldata = vmalloc(adamtx->dither_frames * ADAMTX_PANELDATA_LEN(adamtx->pwm_bits, adamtx->rows, adamtx->columns) * sizeof(struct adamtx_panel_io));
+	if(adamtx->paneldata == NULL)
+	{
+		ret = -ENOMEM;
+		dev_warn(&device->dev, "failed to allocate panel memory (%d)\n", ret);
+		goto framedata_alloced;
+	}
+	adamtx->intermediate_frame = vzalloc(ADAMTX_INTERMEDIATE_LEN(adamtx->rows, adamtx->columns) * sizeof(uint32_t));
+	if(adamtx->intermediate_frame == NULL)
+	{
+        ret = -ENOMEM;
+        dev_warn(&device->dev, "failed to allocate intermediate frame memory (%d)\n", ret);
+        goto paneldata_alloced;
+	}
+
+	for(i = 0; i < adamtx->real_height; i++)
+	{
+		for(j = 0; j < adamtx->real_width; j++)
+		{
+			if(i == j || i == adamtx->real_width - j - 1)
+			{
+				adamtx->framedata[i * adamtx->real_width * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN + 0] = 4;
+				adamtx->framedata[i * adamtx->real_width * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN + 1] = 8;
+				adamtx->framedata[i * adamtx->real_width * ADAMTX_PIX_LEN + j * ADAMTX_PIX_LEN + 2] = 2;
+			}
+		}
+	}
+
+	adamtx_fill_frame(adamtx, &frame);
+	process_frame(&frame);
+	adamtx->power_scale = adamtx_power_scale(adamtx, frame.lit);
+
+	adamtx_playlist_init(adamtx);
+	if((ret = adamtx_chrdev_alloc(adamtx)))
+	{
+		dev_warn(&device->dev, "failed to create character device (%d)\n", ret);
+		goto interframe_alloced;
+	}
+
+	if(device->dev.of_node)
+		of_property_read_string(device->dev.of_node, "adafruit,firmware", &firmware);
+	// The display works without its startup frames
+	if(firmware && (ret = adamtx_playlist_load_firmware(adamtx, firmware)))
+		dev_warn(&device->dev, "failed to load %s (%d)\n", firmware, ret);
+
+	if((ret = adamtx_stats_alloc(adamtx)))
+		goto chrdev_alloced;
+
+	if((ret = adamtx_start_thread(adamtx, &adamtx->update, update_frame, "update")))
+		goto stats_alloced;
+	if((ret = adamtx_start_thread(adamtx, &adamtx->draw, draw_frame, "draw")))
+		goto threads_started;
+	if((ret = adamtx_start_thread(adamtx, &adamtx->perf, show_perf, "perf")))
+		goto threads_started;
+
+	adamtx_start_timer(&adamtx->draw, draw_callback);
+	adamtx_start_timer(&adamtx->update, update_callback);
+	adamtx_start_timer(&adamtx->perf, perf_callback);
+
+	adamtx->fb_notifier.notifier_call = adamtx_fb_notify;
+	dummyfb_register_client(&adamtx->fb_notifier);
+	adamtx->last_change = ktime_get();
+	schedule_delayed_work(&adamtx->idle_work, msecs_to_jiffies(ADAMTX_IDLE_POLL_MS));
+
+	platform_set_drvdata(device, adamtx);
+	dev_info(&device->dev, "initialized %dx%d chain at 1/%d scan, update on cpu %d, draw on cpu %d\n", adamtx->columns, adamtx->rows, adamtx->scan.addresses, adamtx->update.cpu, adamtx->draw.cpu);
 	return 0;
 
+threads_started:
+	adamtx_stop_thread(&adamtx->draw);
+	adamtx_stop_thread(&adamtx->update);
+stats_alloced:
+	adamtx_stats_free(adamtx);
+chrdev_alloced:
+	adamtx_chrdev_free(adamtx);
+	// Firmware frames or frames loaded through the device node
+	adamtx_playlist_free(adamtx);
 interframe_alloced:
-	vfree(adamtx_intermediate_frame);
+	vfree(adamtx->intermediate_frame);
 paneldata_alloced:
-	vfree(paneldata);
+	vfree(adamtx->paneldata);
 framedata_alloced:
-	vfree(framedata);
-panels_alloced:
-	vfree(adamtx_panels);
+	vfree(adamtx->framedata);
 gpio_alloced:
 	adamtx_gpio_free();
+encoder_alloced:
+	vfree(adamtx->damage_map);
+	adamtx_encoder_free(&adamtx->encoder);
+panel_store_alloced:
+	vfree(adamtx->gain_map);
+	vfree(adamtx->gain_lut);
+	vfree(adamtx->remap_table);
+	vfree(adamtx->panel_store);
+	vfree(adamtx->panels);
+id_alloced:
+	ida_simple_remove(&adamtx_ida, adamtx->id);
+adamtx_alloced:
+	adamtx_put(adamtx);
 none_alloced:
 	return ret;
 }
 
 static int adamtx_remove(struct platform_device *device)
 {
-	if(adamtx_updatetimer_enabled)
-		hrtimer_cancel(&adamtx_updatetimer);
-	if(adamtx_frametimer_enabled)
-		hrtimer_cancel(&adamtx_frametimer);
-	if(adamtx_perftimer_enabled)
-		hrtimer_cancel(&adamtx_perftimer);
-	kthread_stop(adamtx_draw_thread);
-	kthread_stop(adamtx_update_thread);
-	kthread_stop(adamtx_perf_thread);
-	vfree(adamtx_intermediate_frame);
-	vfree(paneldata);
-	vfree(framedata);
-	vfree(adamtx_panels);
+	struct adamtx* adamtx = platform_get_drvdata(device);
+	dummyfb_unregister_client(&adamtx->fb_notifier);
+	cancel_delayed_work_sync(&adamtx->idle_work);
+	adamtx_stop_thread(&adamtx->update);
+	adamtx_stop_thread(&adamtx->draw);
+	adamtx_stop_thread(&adamtx->perf);
+	adamtx_stats_free(adamtx);
+	adamtx_chrdev_free(adamtx);
+	adamtx_playlist_free(adamtx);
+	vfree(adamtx->intermediate_frame);
+	vfree(adamtx->paneldata);
+	vfree(adamtx->framedata);
 	adamtx_gpio_free();
-	printk(KERN_INFO ADAMTX_NAME ": shutting down\n");
+	vfree(adamtx->damage_map);
+	adamtx_encoder_free(&adamtx->encoder);
+	vfree(adamtx->gain_map);
+	vfree(adamtx->gain_lut);
+	vfree(adamtx->remap_table);
+	vfree(adamtx->panel_store);
+	vfree(adamtx->panels);
+	ida_simple_remove(&adamtx_ida, adamtx->id);
+	adamtx_put(adamtx);
+	dev_info(&device->dev, "shutting down\n");
 	return 0;
 }
 
+static const struct of_device_id adamtx_of_match[] = {
+	{ .compatible = ADAMTX_COMPATIBLE },
+	{}
+};
+
+MODULE_DEVICE_TABLE(of, adamtx_of_match);
+
 static struct platform_driver adamtx_driver = {
 	.probe = adamtx_probe,
 	.remove = adamtx_remove,
 	.driver = {
-		.name = ADAMTX_NAME
+		.name = ADAMTX_NAME,
+		.of_match_table = adamtx_of_match
 	}
 };
 
+// Fallback instance for boards without a matching device tree node
 static struct platform_device* adamtx_dev;
 
 static int __init adamtx_init(void)
 {
 	int ret;
-	ret = platform_driver_register(&adamtx_driver);
+	struct device_node* node;
+	ret = adamtx_chrdev_init();
 	if(ret)
 		goto none_allocated;
+	ret = platform_driver_register(&adamtx_driver);
+	if(ret)
+		goto chrdev_initialized;
+	node = of_find_compatible_node(NULL, NULL, ADAMTX_COMPATIBLE);
+	if(node)
+	{
+		of_node_put(node);
+		return 0;
+	}
 	adamtx_dev = platform_device_alloc(ADAMTX_NAME, 0);
 	if(adamtx_dev == NULL)
 	{
@@ -546,18 +1182,22 @@ static int __init adamtx_init(void)
 
 dev_allocated:
 	platform_device_put(adamtx_dev);
+	adamtx_dev = NULL;
 driver_registered:
 	platform_driver_unregister(&adamtx_driver);
+chrdev_initialized:
+	adamtx_chrdev_exit();
 none_allocated:
 	return ret;
 }
 
 static void __exit adamtx_exit(void)
 {
-	platform_device_unregister(adamtx_dev);
+	if(adamtx_dev)
+		platform_device_unregister(adamtx_dev);
 	platform_driver_unregister(&adamtx_driver);
+	adamtx_chrdev_exit();
 }
 
 module_init(adamtx_init);
 module_exit(adamtx_exit);
-
@@ -1,11 +1,29 @@
 #ifndef _ADAMTX_H
 #define _ADAMTX_H
 
-#define ADAMTX_NAME "adafruit-matrix"
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/platform_device.h>
+#include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/kref.h>
+
+#include "matrix.h"
+#include "encoder.h"
+#include "remap.h"
+#include "refresh.h"
+#include "chrdev.h"
+#include "playlist.h"
+#include "stats.h"
+#include "dummyfb-client.h"
 
-// GPIO setup
-#define ADAMTX_NUM_GPIOS 14
+#define ADAMTX_NAME "adafruit-matrix"
+#define ADAMTX_COMPATIBLE "adafruit,led-matrix"
 
+// Default GPIO pinout
 #define ADAMTX_GPIO_R1	11
 #define ADAMTX_GPIO_R2	8
 #define ADAMTX_GPIO_G1	27
@@ -22,74 +40,30 @@
 #define ADAMTX_GPIO_CLK	17
 
 
-#define ADAMTX_GPIO_OFFSET_ADDRESS 22
-
-#define ADAMTX_GPIO_MASK_CLOCK		(1 << ADAMTX_GPIO_CLK)
-#define ADAMTX_GPIO_MASK_ADDRESS	0b0011110000001000000000000000
-#define ADAMTX_GPIO_MASK_ADDRESS_HI	0b0011110000000000000000000000
-#define ADAMTX_GPIO_MASK_DATA		0b1000000000000000111110000000
-
-
-// Matrix parameters
-#define ADAMTX_ROWS			32
-#define ADAMTX_COLUMNS		128
+// Matrix parameters, chain geometry comes from the panels
 #define ADAMTX_PWM_BITS		8
-#define ADAMTX_REAL_WIDTH	64
-#define ADAMTX_REAL_HEIGHT	64
 #define ADAMTX_RATE			120UL
 #define ADAMTX_DEPTH		ADAMTX_PWM_BITS * 3
 #define ADAMTX_FBRATE		30UL
-#define ADAMTX_BCD_TIME_NS	1000UL		
+#define ADAMTX_PERF_RATE	1UL
+// Framebuffer sampling on the update timer resumes when commits stop for this long
+#define ADAMTX_COMMIT_TIMEOUT_MS	1000
+// Idle policy, checked once per poll interval, parked displays are woken immediately by commits
+#define ADAMTX_IDLE_TIMEOUT_S		60
+#define ADAMTX_IDLE_POLL_MS			1000
+
+// Power limiter, off without a current limit
+#define ADAMTX_LED_CURRENT_UA		20000
+#define ADAMTX_CURRENT_LIMIT_MA		0
 
 // Macros
 #define ADAMTX_BITS_TO_BYTES(bits) (bits >> 3)
 #define ADAMTX_PIX_LEN ADAMTX_BITS_TO_BYTES(ADAMTX_DEPTH)
+#define ADAMTX_PANELDATA_LEN(bits, rows, columns) ((bits) * (rows) / 2 * (columns))
+// Chain frame plus a spare pixel that collects display pixels not covered by any panel
+#define ADAMTX_INTERMEDIATE_LEN(rows, columns) ((rows) * (columns) + 1)
 
 // Typdedefs
-typedef struct adamtx_panel_io {
-	uint32_t GPIO0	: 1;
-	uint32_t GPIO1	: 1;
-	uint32_t GPIO2	: 1;
-	uint32_t GPIO3	: 1;
-	uint32_t STR	: 1;
-	uint32_t GPIO5	: 1;
-	uint32_t GPIO6	: 1;
-	uint32_t B1		: 1;
-	uint32_t R2		: 1;
-	uint32_t G2		: 1;
-	uint32_t B2		: 1;
-	uint32_t R1		: 1;
-	uint32_t GPIO12 : 1;
-	uint32_t GPIO13 : 1;
-	uint32_t GPIO14 : 1;
-	uint32_t E		: 1;
-	uint32_t GPIO16 : 1;
-	uint32_t CLK	: 1;
-	uint32_t OE		: 1;
-	uint32_t GPIO19 : 1;
-	uint32_t GPIO20 : 1;
-	uint32_t GPIO21 : 1;
-	uint32_t A		: 1;
-	uint32_t B		: 1;
-	uint32_t C		: 1;
-	uint32_t D		: 1;
-	uint32_t GPIO26 : 1;
-	uint32_t G1		: 1;
-};
-
-typedef struct adamtx_frame
-{
-	int width;
-	int height;
-	int vertical_offset;
-	int rows;
-	int pwm_bits;
-	struct adamtx_panel_io* paneldata;
-	off_t paneloffset;
-	uint32_t* frame;
-	off_t frameoffset;
-};
-
 typedef struct adamtx_processable_frame
 {
 	int width;
@@ -97,22 +71,133 @@ typedef struct adamtx_processable_frame
 	int columns;
 	int rows;
 	int pwm_bits;
-	char* frame;
+	int dither_bits;
+	// Addresses to encode, the others keep their previous output words
+	int first_address;
+	int last_address;
+	// Sum of all channel values after remapping and color gains, 0 for a black frame
+	unsigned long lit;
+	int format;
+	void* frame;
+	uint32_t* intermediate;
 	struct adamtx_panel_io* iodata;
-	struct matrix_ledpanel** panels;
+	struct adamtx_encoder* encoder;
+	// Encoder line scratch, NULL for the encoder's own when not encoding concurrently
+	uint32_t* lines;
+	uint32_t* remap_table;
+	// Applied while remapping, NULL if no panel is calibrated
+	const struct adamtx_gain* gain;
 };
 
-typedef struct adamtx_update_param
+// Half open range of scan addresses
+typedef struct adamtx_address_range
 {
-	long rate;
-};
+	int first;
+	int last;
+} adamtx_address_range;
 
-typedef struct adamtx_draw_param
+typedef struct adamtx_thread
 {
-	long rate;
-};
-
-extern size_t dummyfb_get_fbsize(void);
-extern void dummyfb_copy(void* buffer);
+	struct task_struct*	task;
+	int					cpu;
+	unsigned long		rate;
+	struct hrtimer		timer;
+	ktime_t				period;
+	int					timer_enabled;
+	int					do_work;
+	// Last timer expiry, for the wakeup latency tracepoint
+	ktime_t				expired;
+} adamtx_thread;
+
+// Per display state, one instance per independent HUB75 chain
+typedef struct adamtx
+{
+	struct platform_device*		pdev;
+	int							id;
+	// Held by the device and by an open character device
+	struct kref					ref;
+
+	struct matrix_ledpanel**	panels;
+	struct matrix_ledpanel*		panel_store;
+	int							num_panels;
+	uint32_t*					remap_table;
+	uint8_t*					gain_lut;
+	uint16_t*					gain_map;
+	struct adamtx_gain			gain;
+
+	int							real_width;
+	int							real_height;
+	int							fb_x;
+	int							fb_y;
+	int							rows;
+	int							columns;
+	struct adamtx_scan			scan;
+	int							pwm_bits;
+	int							dither_bits;
+	int							dither_frames;
+	int							dither_frame;
+
+	struct adamtx_encoder		encoder;
+
+	// Power limiter budget and the on-time scale of the framebuffer frame
+	unsigned int				led_current;
+	unsigned int				current_limit;
+	unsigned int				power_scale;
+
+	char*						framedata;
+	uint32_t*					intermediate_frame;
+	struct adamtx_panel_io*		paneldata;
+	struct adamtx_chrdev		chrdev;
+	struct adamtx_playlist		playlist;
+
+	struct notifier_block		fb_notifier;
+	ktime_t						last_commit;
+	// Addresses driving each display row and those damaged since the last update
+	struct adamtx_address_range*	damage_map;
+	struct adamtx_address_range	damage;
+	spinlock_t					lock_damage;
+	// Fingerprint of the last encoded framebuffer area
+	u64							frame_hash;
+	int							frame_hash_valid;
+
+	// Idle policy, the draw and update threads are parked with the panel blanked while idle
+	struct delayed_work			idle_work;
+	unsigned int				idle_timeout;
+	int							idle;
+	int							idle_wake;
+	int							frame_black;
+	ktime_t						black_since;
+	ktime_t						last_change;
+
+	spinlock_t					lock_draw;
+
+	struct adamtx_thread		update;
+	struct adamtx_thread		draw;
+	struct adamtx_thread		perf;
+
+	struct adamtx_stats			stats;
+
+	unsigned long				updates;
+	unsigned long				update_skips;
+	unsigned long				update_irqs;
+	unsigned long				update_time;
+	unsigned long				draws;
+	unsigned long				draw_irqs;
+	unsigned long				draw_time;
+} adamtx;
+
+int process_frame(struct adamtx_processable_frame* frame);
+
+void adamtx_fill_frame(struct adamtx* adamtx, struct adamtx_processable_frame* frame);
+
+unsigned int adamtx_power_scale(struct adamtx* adamtx, unsigned long lit);
+
+void adamtx_idle_wake(struct adamtx* adamtx);
+
+void adamtx_force_update(struct adamtx* adamtx);
+
+void adamtx_get(struct adamtx* adamtx);
+
+void adamtx_put(struct adamtx* adamtx);
 
 #endif
@@ -0,0 +1,406 @@
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/errno.h>
+#include <linux/err.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "adafruit-matrix.h"
+#include "adafruit-matrix-ioctl.h"
+#include "chrdev.h"
+#include "playlist.h"
+#include "adafruit-matrix-trace.h"
+
+static struct class* adamtx_class;
+static dev_t adamtx_devt;
+// Displays by minor, open and remove synchronize on the lock
+static DEFINE_MUTEX(adamtx_chrdev_lock);
+static struct adamtx* adamtx_chrdev_devices[ADAMTX_MAX_DEVICES];
+
+static int dev_open(struct inode* inodep, struct file* filep)
+{
+	int err = 0;
+	struct adamtx* adamtx;
+	mutex_lock(&adamtx_chrdev_lock);
+	adamtx = adamtx_chrdev_devices[iminor(inodep)];
+	if(adamtx == NULL)
+	{
+		err = -ENODEV;
+		goto exit_unlock;
+	}
+	// One renderer per display
+	if(test_and_set_bit(ADAMTX_CHRDEV_BUSY, &adamtx->chrdev.flags))
+	{
+		err = -EBUSY;
+		goto exit_unlock;
+	}
+	adamtx_get(adamtx);
+	filep->private_data = adamtx;
+exit_unlock:
+	mutex_unlock(&adamtx_chrdev_lock);
+	return err;
+}
+
+static void adamtx_chrdev_release_display(struct adamtx_chrdev* chrdev)
+{
+	unsigned long irqflags;
+	spin_lock_irqsave(&chrdev->lock_queue, irqflags);
+	chrdev->queued = ADAMTX_USER_NONE;
+	chrdev->active = ADAMTX_USER_NONE;
+	spin_unlock_irqrestore(&chrdev->lock_queue, irqflags);
+	wake_up_interruptible(&chrdev->swap_wait);
+}
+
+static void adamtx_chrdev_upload_reset(struct adamtx_chrdev* chrdev)
+{
+	vfree(chrdev->upload);
+	chrdev->upload = NULL;
+	chrdev->upload_size = 0;
+	chrdev->upload_len = 0;
+}
+
+static int adamtx_chrdev_upload_start(struct adamtx_chrdev* chrdev)
+{
+	chrdev->upload_size = adamtx_playlist_container_size(&chrdev->upload_header);
+	if(chrdev->upload_size == 0)
+		return -EINVAL;
+	chrdev->upload = vmalloc(chrdev->upload_size);
+	if(chrdev->upload == NULL)
+		return -ENOMEM;
+	memcpy(chrdev->upload, &chrdev->upload_header, sizeof(struct adamtx_frames_header));
+	return 0;
+}
+
+// Accepts a frame container, possibly spread over multiple writes
+static ssize_t adamtx_chrdev_write(struct file* filep, const char __user* buffer, size_t len)
+{
+	int err;
+	size_t chunk;
+	ssize_t written = 0;
+	struct adamtx* adamtx = filep->private_data;
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	// The header tells the size of the whole container
+	if(chrdev->upload_len < sizeof(struct adamtx_frames_header))
+	{
+		chunk = min(len, sizeof(struct adamtx_frames_header) - chrdev->upload_len);
+		if(copy_from_user((char*)&chrdev->upload_header + chrdev->upload_len, buffer, chunk))
+		{
+			err = -EFAULT;
+			goto exit_reset;
+		}
+		chrdev->upload_len += chunk;
+		buffer += chunk;
+		len -= chunk;
+		written += chunk;
+		if(chrdev->upload_len < sizeof(struct adamtx_frames_header))
+			return written;
+		if((err = adamtx_chrdev_upload_start(chrdev)))
+			goto exit_reset;
+	}
+	chunk = min(len, chrdev->upload_size - chrdev->upload_len);
+	if(copy_from_user(chrdev->upload + chrdev->upload_len, buffer, chunk))
+	{
+		err = -EFAULT;
+		goto exit_reset;
+	}
+	chrdev->upload_len += chunk;
+	written += chunk;
+	if(chrdev->upload_len == chrdev->upload_size)
+	{
+		err = adamtx_playlist_load_container(adamtx, chrdev->upload, chrdev->upload_size);
+		adamtx_chrdev_upload_reset(chrdev);
+		if(err)
+			return err;
+	}
+	return written;
+exit_reset:
+	adamtx_chrdev_upload_reset(chrdev);
+	return err;
+}
+
+static ssize_t dev_write(struct file* filep, const char __user* buffer, size_t len, loff_t* offset)
+{
+	ssize_t ret;
+	struct adamtx* adamtx = filep->private_data;
+	mutex_lock(&adamtx->chrdev.lock);
+	ret = adamtx->chrdev.gone ? -ENODEV : adamtx_chrdev_write(filep, buffer, len);
+	mutex_unlock(&adamtx->chrdev.lock);
+	return ret;
+}
+
+static int dev_release(struct inode* inodep, struct file* filep)
+{
+	struct adamtx* adamtx = filep->private_data;
+	adamtx_chrdev_upload_reset(&adamtx->chrdev);
+	adamtx_chrdev_release_display(&adamtx->chrdev);
+	clear_bit(ADAMTX_CHRDEV_BUSY, &adamtx->chrdev.flags);
+	adamtx_put(adamtx);
+	return 0;
+}
+
+// Mappings keep the file open, the buffers live until the last reference is gone
+static int dev_mmap(struct file* filep, struct vm_area_struct* vma)
+{
+	int err;
+	struct adamtx* adamtx = filep->private_data;
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	mutex_lock(&chrdev->lock);
+	err = chrdev->gone ? -ENODEV : remap_vmalloc_range(vma, chrdev->buffers, vma->vm_pgoff);
+	mutex_unlock(&chrdev->lock);
+	return err;
+}
+
+static void adamtx_chrdev_get_info(struct adamtx* adamtx, struct adamtx_ioc_info* info)
+{
+	int i;
+	memset(info, 0, sizeof(struct adamtx_ioc_info));
+	info->rows = adamtx->rows;
+	info->columns = adamtx->columns;
+	info->addresses = adamtx->encoder.scan.addresses;
+	info->shift_len = adamtx->encoder.shift_len;
+	info->address_mode = adamtx->encoder.scan.address_mode;
+	info->pwm_bits = adamtx->pwm_bits;
+	info->dither_frames = adamtx->dither_frames;
+	info->buffers = adamtx->chrdev.num_buffers;
+	info->buffer_size = adamtx->chrdev.buffer_size;
+	info->buffer_stride = adamtx->chrdev.buffer_stride;
+	for(i = 0; i < ADAMTX_NUM_PINS; i++)
+		info->pins[i] = adamtx->encoder.pins[i];
+	info->width = adamtx->real_width;
+	info->height = adamtx->real_height;
+}
+
+static int adamtx_chrdev_load_frame(struct adamtx* adamtx, unsigned long arg)
+{
+	int err;
+	void* data;
+	struct adamtx_ioc_frame frame;
+	if(copy_from_user(&frame, (void __user*)arg, sizeof(frame)))
+		return -EFAULT;
+	// Larger than any valid frame
+	if(frame.length > adamtx->playlist.frame_len * sizeof(struct adamtx_panel_io) + adamtx->real_width * adamtx->real_height * ADAMTX_PIX_LEN)
+		return -EINVAL;
+	data = vmalloc(frame.length);
+	if(data == NULL)
+		return -ENOMEM;
+	if(copy_from_user(data, u64_to_user_ptr(frame.data), frame.length))
+	{
+		err = -EFAULT;
+		goto exit_dataalloc;
+	}
+	err = adamtx_playlist_load(adamtx, frame.index, frame.format, frame.duration_us, data, frame.length);
+exit_dataalloc:
+	vfree(data);
+	return err;
+}
+
+static long adamtx_chrdev_ioctl(struct file* filep, unsigned int cmd, unsigned long arg)
+{
+	__u32 index;
+	unsigned long irqflags;
+	struct adamtx_ioc_info info;
+	struct adamtx_ioc_playlist playlist;
+	struct adamtx_ioc_play play;
+	struct adamtx* adamtx = filep->private_data;
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	switch(cmd)
+	{
+		case ADAMTX_IOC_GET_INFO:
+			adamtx_chrdev_get_info(adamtx, &info);
+			if(copy_to_user((void __user*)arg, &info, sizeof(info)))
+				return -EFAULT;
+			return 0;
+		case ADAMTX_IOC_QUEUE:
+			if(get_user(index, (__u32 __user*)arg))
+				return -EFAULT;
+			if(index >= chrdev->num_buffers)
+				return -EINVAL;
+			spin_lock_irqsave(&chrdev->lock_queue, irqflags);
+			chrdev->queued = index;
+			spin_unlock_irqrestore(&chrdev->lock_queue, irqflags);
+			// The draw thread picks the buffer up
+			adamtx_idle_wake(adamtx);
+			return 0;
+		case ADAMTX_IOC_RELEASE:
+			adamtx_chrdev_release_display(chrdev);
+			return 0;
+		case ADAMTX_IOC_PLAYLIST_ALLOC:
+			if(copy_from_user(&playlist, (void __user*)arg, sizeof(playlist)))
+				return -EFAULT;
+			if(playlist.frames > INT_MAX)
+				return -EINVAL;
+			return adamtx_playlist_alloc(adamtx, playlist.frames);
+		case ADAMTX_IOC_PLAYLIST_LOAD:
+			return adamtx_chrdev_load_frame(adamtx, arg);
+		case ADAMTX_IOC_PLAYLIST_PLAY:
+			if(copy_from_user(&play, (void __user*)arg, sizeof(play)))
+				return -EFAULT;
+			if(play.first > INT_MAX || play.count > INT_MAX)
+				return -EINVAL;
+			return adamtx_playlist_play(adamtx, play.mode, play.first, play.count);
+		case ADAMTX_IOC_PLAYLIST_STOP:
+			adamtx_playlist_stop(adamtx);
+			return 0;
+	}
+	return -ENOTTY;
+}
+
+static long dev_ioctl(struct file* filep, unsigned int cmd, unsigned long arg)
+{
+	long err;
+	struct adamtx* adamtx = filep->private_data;
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	// Waits for the draw thread without the lock, removal wakes it up
+	if(cmd == ADAMTX_IOC_WAIT)
+	{
+		if((err = wait_event_interruptible(chrdev->swap_wait, chrdev->queued == ADAMTX_USER_NONE || READ_ONCE(chrdev->gone))))
+			return err;
+		if(READ_ONCE(chrdev->gone))
+			return -ENODEV;
+		if(chrdev->active == ADAMTX_USER_NONE)
+			return -ENODATA;
+		return chrdev->active;
+	}
+	mutex_lock(&chrdev->lock);
+	err = chrdev->gone ? -ENODEV : adamtx_chrdev_ioctl(filep, cmd, arg);
+	mutex_unlock(&chrdev->lock);
+	return err;
+}
+
+static struct file_operations fops =
+{
+	.owner = THIS_MODULE,
+	.open = dev_open,
+	.release = dev_release,
+	.write = dev_write,
+	.mmap = dev_mmap,
+	.unlocked_ioctl = dev_ioctl
+};
+
+// Called by the draw thread at frame boundaries, returns the user buffer to display or NULL
+struct adamtx_panel_io* adamtx_chrdev_swap(struct adamtx* adamtx)
+{
+	int active;
+	unsigned long irqflags;
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	spin_lock_irqsave(&chrdev->lock_queue, irqflags);
+	if(chrdev->queued != ADAMTX_USER_NONE)
+	{
+		chrdev->active = chrdev->queued;
+		chrdev->queued = ADAMTX_USER_NONE;
+		wake_up_interruptible(&chrdev->swap_wait);
+		trace_adamtx_swap(adamtx->id, ADAMTX_SOURCE_USER, chrdev->active);
+	}
+	active = chrdev->active;
+	spin_unlock_irqrestore(&chrdev->lock_queue, irqflags);
+	if(active == ADAMTX_USER_NONE)
+		return NULL;
+	return (struct adamtx_panel_io*)((char*)chrdev->buffers + active * chrdev->buffer_stride);
+}
+
+int adamtx_chrdev_alloc(struct adamtx* adamtx)
+{
+	int err;
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	BUILD_BUG_ON(ADAMTX_IOC_NUM_PINS != ADAMTX_NUM_PINS);
+	mutex_init(&chrdev->lock);
+	spin_lock_init(&chrdev->lock_queue);
+	init_waitqueue_head(&chrdev->swap_wait);
+	chrdev->queued = ADAMTX_USER_NONE;
+	chrdev->active = ADAMTX_USER_NONE;
+	chrdev->num_buffers = ADAMTX_USER_BUFFERS;
+	chrdev->buffer_size = adamtx->dither_frames * ADAMTX_PANELDATA_LEN(adamtx->pwm_bits, adamtx->rows, adamtx->columns) * sizeof(struct adamtx_panel_io);
+	chrdev->buffer_stride = PAGE_ALIGN(chrdev->buffer_size);
+	chrdev->buffers = vmalloc_user(chrdev->num_buffers * chrdev->buffer_stride);
+	if(chrdev->buffers == NULL)
+	{
+		err = -ENOMEM;
+		goto exit_noalloc;
+	}
+	chrdev->devt = MKDEV(MAJOR(adamtx_devt), adamtx->id);
+	// Not embedded, open files may hold the cdev past the adamtx
+	chrdev->cdev = cdev_alloc();
+	if(chrdev->cdev == NULL)
+	{
+		err = -ENOMEM;
+		goto exit_buffersalloc;
+	}
+	chrdev->cdev->ops = &fops;
+	chrdev->cdev->owner = THIS_MODULE;
+	mutex_lock(&adamtx_chrdev_lock);
+	adamtx_chrdev_devices[adamtx->id] = adamtx;
+	mutex_unlock(&adamtx_chrdev_lock);
+	if((err = cdev_add(chrdev->cdev, chrdev->devt, 1)))
+		goto exit_cdevalloc;
+	chrdev->dev = device_create(adamtx_class, &adamtx->pdev->dev, chrdev->devt, adamtx, ADAMTX_CHRDEV_NAME "%d", adamtx->id);
+	if(IS_ERR(chrdev->dev))
+	{
+		err = PTR_ERR(chrdev->dev);
+		goto exit_cdevadd;
+	}
+	return 0;
+exit_cdevadd:
+	cdev_del(chrdev->cdev);
+	goto exit_unregister;
+exit_cdevalloc:
+	kobject_put(&chrdev->cdev->kobj);
+exit_unregister:
+	mutex_lock(&adamtx_chrdev_lock);
+	adamtx_chrdev_devices[adamtx->id] = NULL;
+	mutex_unlock(&adamtx_chrdev_lock);
+exit_buffersalloc:
+	vfree(chrdev->buffers);
+	chrdev->buffers = NULL;
+exit_noalloc:
+	return err;
+}
+
+/*
+ * New opens fail from here on, an open file only sees -ENODEV. Its
+ * reference keeps the adamtx and the mapped buffers until it is released.
+ */
+void adamtx_chrdev_free(struct adamtx* adamtx)
+{
+	struct adamtx_chrdev* chrdev = &adamtx->chrdev;
+	mutex_lock(&adamtx_chrdev_lock);
+	adamtx_chrdev_devices[adamtx->id] = NULL;
+	mutex_unlock(&adamtx_chrdev_lock);
+	mutex_lock(&chrdev->lock);
+	WRITE_ONCE(chrdev->gone, 1);
+	mutex_unlock(&chrdev->lock);
+	adamtx_chrdev_release_display(chrdev);
+	device_destroy(adamtx_class, chrdev->devt);
+	cdev_del(chrdev->cdev);
+}
+
+// Last reference to the adamtx dropped
+void adamtx_chrdev_free_buffers(struct adamtx* adamtx)
+{
+	vfree(adamtx->chrdev.buffers);
+}
+
+int adamtx_chrdev_init(void)
+{
+	int err;
+	if((err = alloc_chrdev_region(&adamtx_devt, 0, ADAMTX_MAX_DEVICES, ADAMTX_CHRDEV_NAME)))
+		goto exit_noalloc;
+	adamtx_class = class_create(THIS_MODULE, ADAMTX_CHRDEV_CLASS);
+	if(IS_ERR(adamtx_class))
+	{
+		err = PTR_ERR(adamtx_class);
+		goto exit_unregchrdev;
+	}
+	return 0;
+exit_unregchrdev:
+	unregister_chrdev_region(adamtx_devt, ADAMTX_MAX_DEVICES);
+exit_noalloc:
+	return err;
+}
+
+void adamtx_chrdev_exit(void)
+{
+	class_destroy(adamtx_class);
+	unregister_chrdev_region(adamtx_devt, ADAMTX_MAX_DEVICES);
+}
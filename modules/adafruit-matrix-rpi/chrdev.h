@@ -0,0 +1,62 @@
+#ifndef _ADAMTX_CHRDEV_H
+#define _ADAMTX_CHRDEV_H
+
+#include <linux/device.h>
+#include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#include "encoder.h"
+#include "adafruit-matrix-frames.h"
+
+#define ADAMTX_CHRDEV_NAME		"adamtx"
+#define ADAMTX_CHRDEV_CLASS		"adamtx"
+#define ADAMTX_MAX_DEVICES		8
+#define ADAMTX_USER_BUFFERS		3
+#define ADAMTX_USER_NONE		-1
+
+// Bits of adamtx_chrdev.flags
+#define ADAMTX_CHRDEV_BUSY		0
+
+struct adamtx;
+
+// Bitplane buffers rendered by userspace, displayed instead of the framebuffer
+typedef struct adamtx_chrdev {
+	struct device*			dev;
+	struct cdev*			cdev;
+	dev_t					devt;
+	// One renderer per display, the open file keeps the adamtx alive
+	unsigned long			flags;
+	// Held within a syscall, the device is gone once removed
+	struct mutex			lock;
+	int						gone;
+	spinlock_t				lock_queue;
+	wait_queue_head_t		swap_wait;
+	struct adamtx_panel_io*	buffers;
+	size_t					buffer_size;
+	size_t					buffer_stride;
+	int						num_buffers;
+	int						queued;
+	int						active;
+
+	// Frame container being written, loaded into the playlist once complete
+	struct adamtx_frames_header	upload_header;
+	char*					upload;
+	size_t					upload_size;
+	size_t					upload_len;
+} adamtx_chrdev;
+
+int adamtx_chrdev_init(void);
+
+void adamtx_chrdev_exit(void);
+
+int adamtx_chrdev_alloc(struct adamtx* adamtx);
+
+void adamtx_chrdev_free(struct adamtx* adamtx);
+
+void adamtx_chrdev_free_buffers(struct adamtx* adamtx);
+
+struct adamtx_panel_io* adamtx_chrdev_swap(struct adamtx* adamtx);
+
+#endif
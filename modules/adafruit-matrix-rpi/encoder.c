@@ -0,0 +1,231 @@
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#else
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define vmalloc(size)	malloc(size)
+#define vfree(ptr)		free(ptr)
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#endif
+
+#include "encoder.h"
+
+// Threshold order of the dither frames, spreads the truncated LSBs evenly over time
+static const uint32_t adamtx_dither_order[ADAMTX_DITHER_MAX_FRAMES] = {0, 2, 1, 3};
+
+// Pins driven by the scatter tables, same order as the ADAMTX_LUT_* channels
+static const int adamtx_lut_pins[ADAMTX_LUT_CHANNELS] = {ADAMTX_PIN_B1, ADAMTX_PIN_G1, ADAMTX_PIN_R1, ADAMTX_PIN_B2, ADAMTX_PIN_G2, ADAMTX_PIN_R2};
+
+static const int adamtx_address_pins[ADAMTX_NUM_ADDRESS_PINS] = {ADAMTX_PIN_A, ADAMTX_PIN_B, ADAMTX_PIN_C, ADAMTX_PIN_D, ADAMTX_PIN_E};
+
+static int adamtx_encoder_init_scan(struct adamtx_encoder* encoder, const struct adamtx_scan* scan)
+{
+	int p, block, fold_row, x;
+	if(scan->rows <= 0 || scan->rows % 2 || scan->columns <= 0 || scan->addresses <= 0 || (scan->rows / 2) % scan->addresses)
+		return -EINVAL;
+	if(scan->address_mode == ADAMTX_ADDRESS_DIRECT && scan->addresses > (1 << ADAMTX_NUM_ADDRESS_PINS))
+		return -EINVAL;
+	if(scan->address_mode != ADAMTX_ADDRESS_DIRECT && scan->address_mode != ADAMTX_ADDRESS_SHIFT)
+		return -EINVAL;
+	if(scan->zigzag < 0 || (scan->zigzag && scan->columns % scan->zigzag))
+		return -EINVAL;
+	encoder->scan = *scan;
+	encoder->fold = scan->rows / 2 / scan->addresses;
+	encoder->shift_len = encoder->fold * scan->columns;
+	// Plain 1/(rows / 2) scan clocks out frame rows as they are
+	if(encoder->fold == 1)
+		return 0;
+	encoder->scan_map = vmalloc(encoder->shift_len * sizeof(uint32_t));
+	if(encoder->scan_map == NULL)
+		return -ENOMEM;
+	for(p = 0; p < encoder->shift_len; p++)
+	{
+		if(scan->zigzag)
+		{
+			block = p / scan->zigzag;
+			fold_row = block % encoder->fold;
+			x = (block / encoder->fold) * scan->zigzag + p % scan->zigzag;
+		}
+		else
+		{
+			fold_row = p / scan->columns;
+			x = p % scan->columns;
+		}
+		if(scan->zigzag_invert)
+			fold_row = encoder->fold - 1 - fold_row;
+		// Offset relative to the first row driven by the address
+		encoder->scan_map[p] = fold_row * scan->addresses * scan->columns + x;
+	}
+	return 0;
+}
+
+int adamtx_encoder_init(struct adamtx_encoder* encoder, const uint32_t* pins, int pwm_bits, const struct adamtx_scan* scan)
+{
+	int i, j, value, err;
+	int num_addresses = scan->addresses;
+	uint32_t* plane;
+	memset(encoder, 0, sizeof(struct adamtx_encoder));
+	for(i = 0; i < ADAMTX_NUM_PINS; i++)
+	{
+		if(pins[i] > ADAMTX_MAX_GPIO || encoder->mask_all & (1U << pins[i]))
+			return -EINVAL;
+		encoder->pins[i] = pins[i];
+		encoder->mask_all |= 1U << pins[i];
+	}
+	encoder->pwm_bits = pwm_bits;
+	for(i = 0; i < ADAMTX_LUT_CHANNELS; i++)
+		encoder->mask_data |= 1U << pins[adamtx_lut_pins[i]];
+	for(i = 0; i < ADAMTX_NUM_ADDRESS_PINS; i++)
+		encoder->mask_address |= 1U << pins[adamtx_address_pins[i]];
+	encoder->oe = 1U << pins[ADAMTX_PIN_OE];
+	encoder->str = 1U << pins[ADAMTX_PIN_STR];
+	encoder->clk = 1U << pins[ADAMTX_PIN_CLK];
+
+	if((err = adamtx_encoder_init_scan(encoder, scan)))
+		goto exit_err;
+
+	err = -ENOMEM;
+	encoder->lut = vmalloc(pwm_bits * ADAMTX_LUT_PLANE_LEN * sizeof(uint32_t));
+	if(encoder->lut == NULL)
+		goto exit_err;
+	encoder->address_lut = vmalloc(num_addresses * sizeof(uint32_t));
+	if(encoder->address_lut == NULL)
+		goto exit_err;
+	encoder->lines = vmalloc(ADAMTX_LINES_LEN(encoder) * sizeof(uint32_t));
+	if(encoder->lines == NULL)
+		goto exit_err;
+
+	for(i = 0; i < pwm_bits; i++)
+	{
+		plane = encoder->lut + i * ADAMTX_LUT_PLANE_LEN;
+		for(j = 0; j < ADAMTX_LUT_CHANNELS; j++)
+		{
+			for(value = 0; value < ADAMTX_LUT_CHANNEL_LEN; value++)
+				plane[j * ADAMTX_LUT_CHANNEL_LEN + value] = ((value >> i) & 1U) << pins[adamtx_lut_pins[j]];
+		}
+	}
+	// Shift register addressing is done by the draw loop, output words keep A-E low
+	for(i = 0; i < num_addresses; i++)
+	{
+		encoder->address_lut[i] = 0;
+		if(scan->address_mode != ADAMTX_ADDRESS_DIRECT)
+			continue;
+		for(j = 0; j < ADAMTX_NUM_ADDRESS_PINS; j++)
+			encoder->address_lut[i] |= ((i >> j) & 1U) << pins[adamtx_address_pins[j]];
+	}
+	return 0;
+
+exit_err:
+	adamtx_encoder_free(encoder);
+	return err;
+}
+
+void adamtx_encoder_free(struct adamtx_encoder* encoder)
+{
+	vfree(encoder->scan_map);
+	vfree(encoder->address_lut);
+	vfree(encoder->lut);
+	vfree(encoder->lines);
+	encoder->scan_map = NULL;
+	encoder->address_lut = NULL;
+	encoder->lut = NULL;
+	encoder->lines = NULL;
+}
+
+/*
+ * Reduces a row of 8 bit colors to pwm_bits. The threshold added before
+ * truncation cycles through all values over 1 << dither_bits frames, so the
+ * time average of all dither frames reproduces the full color depth. The
+ * threshold phase is offset per pixel to avoid whole areas flickering in sync.
+ */
+void dither_row(uint32_t* to, uint32_t* from, int columns, int row, int dither_frame, int dither_bits, int pwm_bits)
+{
+	int k, shift;
+	uint32_t threshold, channel, pixel;
+	uint32_t max = (1 << pwm_bits) - 1;
+	uint32_t mask = (1 << dither_bits) - 1;
+	for(k = 0; k < columns; k++)
+	{
+		threshold = adamtx_dither_order[(dither_frame + row + k) & mask] >> (ADAMTX_DITHER_MAX_BITS - dither_bits);
+		pixel = 0;
+		for(shift = 0; shift < 24; shift += 8)
+		{
+			channel = (((from[k] >> shift) & 0xFF) + threshold) >> dither_bits;
+			pixel |= min(channel, max) << shift;
+		}
+		to[k] = pixel;
+	}
+}
+
+/*
+ * Encodes the scan lines of the addresses covering rows
+ * [vertical_offset, vertical_offset + rows) of the upper half and the matching
+ * rows of the lower half. Paneldata is laid out as [address][bitplane][shift_len].
+ * Parts encoded concurrently with the same encoder need their own lines.
+ */
+void prerender_frame_part(struct adamtx_frame* framepart)
+{
+	int i, j, k, addr;
+	uint32_t* frame = framepart->frame;
+	int rows = framepart->height;
+	int columns = framepart->width;
+	int pwm_steps = framepart->pwm_bits;
+	struct adamtx_encoder* encoder = framepart->encoder;
+	int addresses = encoder->scan.addresses;
+	int shift_len = encoder->shift_len;
+	int first = framepart->vertical_offset / 2 / encoder->fold;
+	int last = (framepart->vertical_offset + framepart->rows) / 2 / encoder->fold;
+	struct adamtx_panel_io* row;
+	const uint32_t* lut;
+	uint32_t address;
+	uint32_t* lines = framepart->lines ? framepart->lines : encoder->lines;
+	uint32_t* row1;
+	uint32_t* row2;
+	for(i = first; i < last; i++)
+	{
+		row1 = frame + i * columns;
+		row2 = frame + (rows / 2 + i) * columns;
+		if(encoder->scan_map)
+		{
+			for(k = 0; k < shift_len; k++)
+			{
+				lines[k] = row1[encoder->scan_map[k]];
+				lines[shift_len + k] = row2[encoder->scan_map[k]];
+			}
+			row1 = lines;
+			row2 = lines + shift_len;
+		}
+		if(framepart->dither_bits)
+		{
+			dither_row(lines, row1, shift_len, i, framepart->dither_frame, framepart->dither_bits, pwm_steps);
+			dither_row(lines + shift_len, row2, shift_len, rows / 2 + i, framepart->dither_frame, framepart->dither_bits, pwm_steps);
+			row1 = lines;
+			row2 = lines + shift_len;
+		}
+		for(j = 0; j < pwm_steps; j++)
+		{
+			if(j == 0)
+				addr = (i + 1) % addresses;
+			else
+				addr = i;
+			address = encoder->address_lut[addr];
+			lut = encoder->lut + j * ADAMTX_LUT_PLANE_LEN;
+			row = framepart->paneldata + i * pwm_steps * shift_len + j * shift_len;
+			for(k = 0; k < shift_len; k++)
+			{
+				row[k].gpios = address |
+					lut[ADAMTX_LUT_B1 + (row1[k] & 0xFF)] |
+					lut[ADAMTX_LUT_G1 + ((row1[k] >> 8) & 0xFF)] |
+					lut[ADAMTX_LUT_R1 + ((row1[k] >> 16) & 0xFF)] |
+					lut[ADAMTX_LUT_B2 + (row2[k] & 0xFF)] |
+					lut[ADAMTX_LUT_G2 + ((row2[k] >> 8) & 0xFF)] |
+					lut[ADAMTX_LUT_R2 + ((row2[k] >> 16) & 0xFF)];
+			}
+		}
+	}
+}
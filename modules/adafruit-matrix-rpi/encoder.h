@@ -0,0 +1,122 @@
+#ifndef _ADAMTX_ENCODER_H
+#define _ADAMTX_ENCODER_H
+
+// Shared with the host tools in tools/adafruit-matrix
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <sys/types.h>
+#endif
+
+// Signal order used for pinout arrays (module parameter and device tree)
+enum adamtx_pin {
+	ADAMTX_PIN_R1 = 0,
+	ADAMTX_PIN_G1,
+	ADAMTX_PIN_B1,
+	ADAMTX_PIN_R2,
+	ADAMTX_PIN_G2,
+	ADAMTX_PIN_B2,
+	ADAMTX_PIN_A,
+	ADAMTX_PIN_B,
+	ADAMTX_PIN_C,
+	ADAMTX_PIN_D,
+	ADAMTX_PIN_E,
+	ADAMTX_PIN_OE,
+	ADAMTX_PIN_STR,
+	ADAMTX_PIN_CLK,
+	ADAMTX_NUM_PINS
+};
+
+#define ADAMTX_NUM_ADDRESS_PINS	5
+#define ADAMTX_DITHER_MAX_BITS	2
+#define ADAMTX_DITHER_MAX_FRAMES	(1 << ADAMTX_DITHER_MAX_BITS)
+#define ADAMTX_MAX_GPIO			31
+
+// Scatter tables, one per color channel and bitplane, indexed by the 8 bit channel value
+#define ADAMTX_LUT_CHANNELS		6
+#define ADAMTX_LUT_CHANNEL_LEN	256
+#define ADAMTX_LUT_PLANE_LEN	(ADAMTX_LUT_CHANNELS * ADAMTX_LUT_CHANNEL_LEN)
+
+// Words of line scratch one encoder run needs for dithering and scan maps
+#define ADAMTX_LINES_LEN(encoder)	(2 * (encoder)->shift_len)
+
+// Channel offsets inside a plane, ordered like the bytes of a remapped pixel
+#define ADAMTX_LUT_B1	(0 * ADAMTX_LUT_CHANNEL_LEN)
+#define ADAMTX_LUT_G1	(1 * ADAMTX_LUT_CHANNEL_LEN)
+#define ADAMTX_LUT_R1	(2 * ADAMTX_LUT_CHANNEL_LEN)
+#define ADAMTX_LUT_B2	(3 * ADAMTX_LUT_CHANNEL_LEN)
+#define ADAMTX_LUT_G2	(4 * ADAMTX_LUT_CHANNEL_LEN)
+#define ADAMTX_LUT_R2	(5 * ADAMTX_LUT_CHANNEL_LEN)
+
+enum adamtx_address_mode {
+	ADAMTX_ADDRESS_DIRECT = 0,	// Row address on A-E in parallel
+	ADAMTX_ADDRESS_SHIFT		// Row select shift register, A is clock and B is data
+};
+
+/*
+ * Scan multiplexing of a chain. With 1/addresses scan each address lights
+ * fold = rows / 2 / addresses rows per half, whose pixels are clocked out as
+ * one shift_len = fold * columns long line. Outdoor panels interleave the rows
+ * of such a line in blocks of zigzag pixels.
+ */
+typedef struct adamtx_scan {
+	int	rows;
+	int	columns;
+	int	addresses;
+	int	address_mode;
+	int	zigzag;
+	int	zigzag_invert;
+} adamtx_scan;
+
+// One GPIO output word, clocked out as is
+typedef struct adamtx_panel_io {
+	uint32_t gpios;
+} adamtx_panel_io;
+
+typedef struct adamtx_encoder {
+	uint32_t	pins[ADAMTX_NUM_PINS];
+	int			pwm_bits;
+	struct adamtx_scan	scan;
+	int			fold;
+	int			shift_len;
+	uint32_t	mask_data;
+	uint32_t	mask_address;
+	uint32_t	mask_all;
+	uint32_t	oe;
+	uint32_t	str;
+	uint32_t	clk;
+	uint32_t*	lut;
+	uint32_t*	address_lut;
+	uint32_t*	scan_map;
+	// Line scratch for callers encoding one part at a time
+	uint32_t*	lines;
+} adamtx_encoder;
+
+typedef struct adamtx_frame
+{
+	int width;
+	int height;
+	int vertical_offset;
+	int rows;
+	int pwm_bits;
+	int dither_bits;
+	int dither_frame;
+	struct adamtx_encoder* encoder;
+	struct adamtx_panel_io* paneldata;
+	off_t paneloffset;
+	uint32_t* frame;
+	off_t frameoffset;
+	// ADAMTX_LINES_LEN words private to this part, NULL to use the encoder's
+	uint32_t* lines;
+} adamtx_frame;
+
+int adamtx_encoder_init(struct adamtx_encoder* encoder, const uint32_t* pins, int pwm_bits, const struct adamtx_scan* scan);
+
+void adamtx_encoder_free(struct adamtx_encoder* encoder);
+
+void dither_row(uint32_t* to, uint32_t* from, int columns, int row, int dither_frame, int dither_bits, int pwm_bits);
+
+void prerender_frame_part(struct adamtx_frame* framepart);
+
+#endif
@@ -1,6 +1,7 @@
 #include <linux/ioport.h>
 #include <linux/errno.h>
 #include <linux/io.h>
+#include <linux/mutex.h>
 
 #include "io.h"
 
@@ -9,6 +10,10 @@ uint32_t* adamtx_gpio_clr = NULL;
 
 uint32_t* adamtx_gpio_map = NULL;
 
+// The register block is shared by all matrix instances
+static DEFINE_MUTEX(adamtx_gpio_lock);
+static int adamtx_gpio_users = 0;
+
 const uint32_t adamtx_valid_gpio_bits = ((1 <<  0) | (1 <<  1) | // RPi 1 - Revision 1 accessible
    (1 <<  2) | (1 <<  3) | // RPi 1 - Revision 2 accessible
    (1 <<  4) | (1 <<  7) | (1 << 8) | (1 <<  9) |
@@ -20,42 +25,64 @@ const uint32_t adamtx_valid_gpio_bits = ((1 <<  0) | (1 <<  1) | // RPi 1 - Revi
 
 int adamtx_gpio_alloc()
 {
+	int ret = 0;
+	mutex_lock(&adamtx_gpio_lock);
+	if(adamtx_gpio_users++ > 0)
+		goto exit_unlock;
 	#ifdef ADAMTX_REQUEST_EXCLUSIVE_GPIO
 	if(request_mem_region(ADAMTX_PERIPHERAL_BASE + ADAMTX_GPIO_OFFSET, ADAMTX_REGISTER_BLOCK_SIZE, "ADAMTX_GPIO") == NULL)
 	{
-		return -EIO;
+		ret = -EIO;
+		goto exit_unused;
 	}
 	#endif
 	adamtx_gpio_map = ioremap_nocache(ADAMTX_PERIPHERAL_BASE + ADAMTX_GPIO_OFFSET, ADAMTX_REGISTER_BLOCK_SIZE);
 	if(adamtx_gpio_map == NULL)
 	{
-		return -EIO;
+		#ifdef ADAMTX_REQUEST_EXCLUSIVE_GPIO
+		release_mem_region(ADAMTX_PERIPHERAL_BASE + ADAMTX_GPIO_OFFSET, ADAMTX_REGISTER_BLOCK_SIZE);
+		#endif
+		ret = -EIO;
+		goto exit_unused;
 	}
 	adamtx_gpio_set = adamtx_gpio_map + ADAMTX_GPIO_SET_OFFSET;
 	adamtx_gpio_clr = adamtx_gpio_map + ADAMTX_GPIO_CLR_OFFSET;	
-	return 0;
+	goto exit_unlock;
+exit_unused:
+	adamtx_gpio_users--;
+exit_unlock:
+	mutex_unlock(&adamtx_gpio_lock);
+	return ret;
 }
 
 void adamtx_gpio_free()
 {
+	mutex_lock(&adamtx_gpio_lock);
+	if(--adamtx_gpio_users > 0)
+		goto exit_unlock;
 	iounmap(adamtx_gpio_map);
 	#ifdef ADAMTX_REQUEST_EXCLUSIVE_GPIO
 	release_mem_region(ADAMTX_PERIPHERAL_BASE + ADAMTX_GPIO_OFFSET, ADAMTX_REGISTER_BLOCK_SIZE);
 	#endif
+exit_unlock:
+	mutex_unlock(&adamtx_gpio_lock);
 }
 
+// Function select registers hold the pins of several chains, their read-modify-write is serialized
 void adamtx_gpio_set_outputs(uint32_t outputs)
 {
 	outputs &= adamtx_valid_gpio_bits;
 	uint32_t b;
+	mutex_lock(&adamtx_gpio_lock);
 	for(b = 0; b <= 27; ++b)
 	{
-		if(outputs & (1 << b))
+		if(outputs & (1U << b))
 		{
 			ADAMTX_INP_GPIO(b);
 			ADAMTX_OUT_GPIO(b);
 		}
 	}
+	mutex_unlock(&adamtx_gpio_lock);
 }
 
 void adamtx_gpio_set_bits(uint32_t value)
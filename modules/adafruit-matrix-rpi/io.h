@@ -13,6 +13,8 @@
 #define ADAMTX_INP_GPIO(g) *(adamtx_gpio_map+((g)/10)) &= ~(7<<(((g)%10)*3))
 #define ADAMTX_OUT_GPIO(g) *(adamtx_gpio_map+((g)/10)) |=  (1<<(((g)%10)*3))
 
+extern const uint32_t adamtx_valid_gpio_bits;
+
 int adamtx_gpio_alloc(void);
 
 void adamtx_gpio_free(void);
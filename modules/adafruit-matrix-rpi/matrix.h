@@ -1,6 +1,9 @@
 #ifndef _ADAMTX_MATRIX_H
 #define _ADAMTX_MATRIX_H
 
+// Color gains of a panel, full scale keeps the channel as is
+#define MATRIX_GAIN_MAX	255
+
 typedef struct matrix_ledpanel
 {
 	char* name;
@@ -12,6 +15,8 @@ typedef struct matrix_ledpanel
 	int	realy;
 	int	flip_x : 1;
 	int	flip_y : 1;
+	// R, G, B
+	unsigned char gain[3];
 };
 
 typedef struct matrix_pos
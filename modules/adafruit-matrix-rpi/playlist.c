@@ -0,0 +1,324 @@
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/firmware.h>
+#include <linux/overflow.h>
+
+#include "adafruit-matrix.h"
+#include "adafruit-matrix-ioctl.h"
+#include "adafruit-matrix-frames.h"
+#include "playlist.h"
+#include "adafruit-matrix-trace.h"
+
+void adamtx_playlist_init(struct adamtx* adamtx)
+{
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	mutex_init(&playlist->lock);
+	spin_lock_init(&playlist->lock_state);
+	playlist->frame_len = adamtx->dither_frames * ADAMTX_PANELDATA_LEN(adamtx->pwm_bits, adamtx->rows, adamtx->columns);
+}
+
+static void adamtx_playlist_stop_locked(struct adamtx* adamtx)
+{
+	unsigned long irqflags;
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	spin_lock_irqsave(&playlist->lock_state, irqflags);
+	playlist->playing = 0;
+	spin_unlock_irqrestore(&playlist->lock_state, irqflags);
+	// The draw thread picks its frame under lock_draw, wait for a running draw to finish
+	spin_lock_irqsave(&adamtx->lock_draw, irqflags);
+	spin_unlock_irqrestore(&adamtx->lock_draw, irqflags);
+}
+
+static void adamtx_playlist_free_locked(struct adamtx* adamtx)
+{
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	adamtx_playlist_stop_locked(adamtx);
+	vfree(playlist->scales);
+	vfree(playlist->durations);
+	vfree(playlist->pool);
+	playlist->scales = NULL;
+	playlist->durations = NULL;
+	playlist->pool = NULL;
+	playlist->num_frames = 0;
+}
+
+int adamtx_playlist_alloc(struct adamtx* adamtx, int frames)
+{
+	int err = 0;
+	size_t pool_size;
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	if(frames <= 0)
+		return -EINVAL;
+	// Saturates on overflow, frames comes from userspace
+	pool_size = array3_size(frames, playlist->frame_len, sizeof(struct adamtx_panel_io));
+	if(pool_size > ADAMTX_PLAYLIST_MAX)
+		return -ENOMEM;
+	mutex_lock(&playlist->lock);
+	adamtx_playlist_free_locked(adamtx);
+	playlist->pool = vzalloc(pool_size);
+	playlist->durations = vzalloc(array_size(frames, sizeof(ktime_t)));
+	playlist->scales = vzalloc(array_size(frames, sizeof(unsigned int)));
+	if(playlist->pool == NULL || playlist->durations == NULL || playlist->scales == NULL)
+	{
+		err = -ENOMEM;
+		adamtx_playlist_free_locked(adamtx);
+		goto exit_mutex;
+	}
+	playlist->num_frames = frames;
+exit_mutex:
+	mutex_unlock(&playlist->lock);
+	return err;
+}
+
+void adamtx_playlist_free(struct adamtx* adamtx)
+{
+	mutex_lock(&adamtx->playlist.lock);
+	adamtx_playlist_free_locked(adamtx);
+	mutex_unlock(&adamtx->playlist.lock);
+}
+
+// Runs alongside the update thread, so nothing of the encoder's scratch is shared
+static int adamtx_playlist_encode(struct adamtx* adamtx, const void* data, struct adamtx_panel_io* to, unsigned int* scale)
+{
+	int err = -ENOMEM;
+	struct adamtx_processable_frame frame;
+	adamtx_fill_frame(adamtx, &frame);
+	frame.frame = (void*)data;
+	frame.format = DUMMYFB_FORMAT_RGB888;
+	frame.iodata = to;
+	frame.intermediate = vzalloc(ADAMTX_INTERMEDIATE_LEN(adamtx->rows, adamtx->columns) * sizeof(uint32_t));
+	frame.lines = vmalloc(ADAMTX_LINES_LEN(&adamtx->encoder) * sizeof(uint32_t));
+	if(frame.intermediate == NULL || frame.lines == NULL)
+		goto exit_free;
+	process_frame(&frame);
+	*scale = adamtx_power_scale(adamtx, frame.lit);
+	err = 0;
+exit_free:
+	vfree(frame.lines);
+	vfree(frame.intermediate);
+	return err;
+}
+
+// Stores a frame in the pool, either as RGB like the framebuffer or as encoded output words
+int adamtx_playlist_load(struct adamtx* adamtx, int index, int format, unsigned int duration_us, const void* data, size_t len)
+{
+	int err = 0;
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	struct adamtx_panel_io* to;
+	mutex_lock(&playlist->lock);
+	if(index < 0 || index >= playlist->num_frames)
+	{
+		err = -EINVAL;
+		goto exit_mutex;
+	}
+	if(playlist->playing)
+	{
+		err = -EBUSY;
+		goto exit_mutex;
+	}
+	to = playlist->pool + index * playlist->frame_len;
+	switch(format)
+	{
+		case ADAMTX_FRAME_RGB:
+			if(len != adamtx->real_width * adamtx->real_height * ADAMTX_PIX_LEN)
+			{
+				err = -EINVAL;
+				goto exit_mutex;
+			}
+			if((err = adamtx_playlist_encode(adamtx, data, to, &playlist->scales[index])))
+				goto exit_mutex;
+			break;
+		case ADAMTX_FRAME_ENCODED:
+			if(len != playlist->frame_len * sizeof(struct adamtx_panel_io))
+			{
+				err = -EINVAL;
+				goto exit_mutex;
+			}
+			memcpy(to, data, len);
+			// No lit sum without decoding the bitplanes, full on-time
+			playlist->scales[index] = adamtx_power_scale(adamtx, 0);
+			break;
+		default:
+			err = -EINVAL;
+			goto exit_mutex;
+	}
+	playlist->durations[index] = ns_to_ktime((u64)duration_us * NSEC_PER_USEC);
+exit_mutex:
+	mutex_unlock(&playlist->lock);
+	return err;
+}
+
+int adamtx_playlist_play(struct adamtx* adamtx, int mode, int first, int count)
+{
+	int err = 0;
+	unsigned long irqflags;
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	if(mode != ADAMTX_LOOP_ONCE && mode != ADAMTX_LOOP_REPEAT && mode != ADAMTX_LOOP_PINGPONG)
+		return -EINVAL;
+	mutex_lock(&playlist->lock);
+	if(first < 0 || count <= 0 || first + count > playlist->num_frames)
+	{
+		err = -EINVAL;
+		goto exit_mutex;
+	}
+	spin_lock_irqsave(&playlist->lock_state, irqflags);
+	playlist->mode = mode;
+	playlist->first = first;
+	playlist->count = count;
+	playlist->current = first;
+	playlist->direction = 1;
+	playlist->shown = ktime_get();
+	playlist->playing = 1;
+	spin_unlock_irqrestore(&playlist->lock_state, irqflags);
+	adamtx_idle_wake(adamtx);
+exit_mutex:
+	mutex_unlock(&playlist->lock);
+	return err;
+}
+
+void adamtx_playlist_stop(struct adamtx* adamtx)
+{
+	mutex_lock(&adamtx->playlist.lock);
+	adamtx_playlist_stop_locked(adamtx);
+	mutex_unlock(&adamtx->playlist.lock);
+}
+
+// Returns 0 once a playlist played once is past its last frame
+static int adamtx_playlist_advance(struct adamtx_playlist* playlist)
+{
+	int last = playlist->first + playlist->count - 1;
+	switch(playlist->mode)
+	{
+		case ADAMTX_LOOP_ONCE:
+			if(playlist->current == last)
+				return 0;
+			playlist->current++;
+			break;
+		case ADAMTX_LOOP_REPEAT:
+			playlist->current = playlist->current < last ? playlist->current + 1 : playlist->first;
+			break;
+		case ADAMTX_LOOP_PINGPONG:
+			if(playlist->count == 1)
+				break;
+			if(playlist->current + playlist->direction > last || playlist->current + playlist->direction < playlist->first)
+				playlist->direction = -playlist->direction;
+			playlist->current += playlist->direction;
+			break;
+	}
+	return 1;
+}
+
+/*
+ * Called by the draw thread under lock_draw at frame boundaries, returns the
+ * playlist frame to display and its on-time scale or NULL. Frames only change
+ * after all of their dither frames were shown, a playlist played once ends
+ * after the duration of its last frame.
+ */
+struct adamtx_panel_io* adamtx_playlist_next(struct adamtx* adamtx, unsigned int* scale)
+{
+	ktime_t now, due;
+	struct adamtx_panel_io* frame = NULL;
+	struct adamtx_playlist* playlist = &adamtx->playlist;
+	spin_lock(&playlist->lock_state);
+	if(!playlist->playing)
+		goto exit_unlock;
+	now = ktime_get();
+	due = ktime_add(playlist->shown, playlist->durations[playlist->current]);
+	if(adamtx->dither_frame == 0 && ktime_compare(now, due) >= 0)
+	{
+		if(!adamtx_playlist_advance(playlist))
+		{
+			// The framebuffer wasn't encoded while playing, e.g. fbcon behind a boot splash
+			playlist->playing = 0;
+			adamtx_force_update(adamtx);
+			goto exit_unlock;
+		}
+		trace_adamtx_swap(adamtx->id, ADAMTX_SOURCE_PLAYLIST, playlist->current);
+		// Keep the animation on its own time base unless the draw thread fell behind a whole frame
+		playlist->shown = ktime_compare(ktime_sub(now, due), playlist->durations[playlist->current]) < 0 ? due : now;
+	}
+	frame = playlist->pool + playlist->current * playlist->frame_len;
+	*scale = playlist->scales[playlist->current];
+exit_unlock:
+	spin_unlock(&playlist->lock_state);
+	return frame;
+}
+
+// Size of the whole container described by a header, 0 if the header is invalid
+size_t adamtx_playlist_container_size(const struct adamtx_frames_header* header)
+{
+	u64 size;
+	if(le32_to_cpu(header->magic) != ADAMTX_FRAMES_MAGIC || le32_to_cpu(header->version) != ADAMTX_FRAMES_VERSION)
+		return 0;
+	if(le32_to_cpu(header->header_size) < sizeof(struct adamtx_frames_header))
+		return 0;
+	size = (u64)le32_to_cpu(header->num_frames) * (sizeof(struct adamtx_frames_entry) + le32_to_cpu(header->frame_size));
+	size += le32_to_cpu(header->header_size);
+	if(size > ADAMTX_CONTAINER_MAX)
+		return 0;
+	return size;
+}
+
+static int adamtx_playlist_container_matches(struct adamtx* adamtx, const struct adamtx_frames_header* header)
+{
+	int i;
+	if(le32_to_cpu(header->rows) != adamtx->rows || le32_to_cpu(header->columns) != adamtx->columns ||
+		le32_to_cpu(header->addresses) != adamtx->encoder.scan.addresses || le32_to_cpu(header->shift_len) != adamtx->encoder.shift_len ||
+		le32_to_cpu(header->address_mode) != adamtx->encoder.scan.address_mode || le32_to_cpu(header->pwm_bits) != adamtx->pwm_bits ||
+		le32_to_cpu(header->dither_frames) != adamtx->dither_frames ||
+		le32_to_cpu(header->frame_size) != adamtx->playlist.frame_len * sizeof(struct adamtx_panel_io))
+		return 0;
+	for(i = 0; i < ADAMTX_NUM_PINS; i++)
+	{
+		if(le32_to_cpu(header->pins[i]) != adamtx->encoder.pins[i])
+			return 0;
+	}
+	return 1;
+}
+
+// Replaces the playlist with the frames of a container and starts playing it
+int adamtx_playlist_load_container(struct adamtx* adamtx, const void* data, size_t len)
+{
+	int i, err, frames;
+	size_t header_size, record;
+	const struct adamtx_frames_header* header = data;
+	const struct adamtx_frames_entry* entry;
+	BUILD_BUG_ON(ADAMTX_FRAMES_NUM_PINS != ADAMTX_NUM_PINS);
+	if(len < sizeof(struct adamtx_frames_header) || adamtx_playlist_container_size(header) != len)
+	{
+		dev_warn(&adamtx->pdev->dev, "invalid frame container\n");
+		return -EINVAL;
+	}
+	if(!adamtx_playlist_container_matches(adamtx, header))
+	{
+		dev_warn(&adamtx->pdev->dev, "frame container does not match display geometry or pinout\n");
+		return -EINVAL;
+	}
+	frames = le32_to_cpu(header->num_frames);
+	header_size = le32_to_cpu(header->header_size);
+	record = sizeof(struct adamtx_frames_entry) + le32_to_cpu(header->frame_size);
+	if((err = adamtx_playlist_alloc(adamtx, frames)))
+		return err;
+	for(i = 0; i < frames; i++)
+	{
+		entry = (const struct adamtx_frames_entry*)((const char*)data + header_size + i * record);
+		if((err = adamtx_playlist_load(adamtx, i, ADAMTX_FRAME_ENCODED, le32_to_cpu(entry->duration_us), entry + 1, record - sizeof(struct adamtx_frames_entry))))
+			return err;
+	}
+	return adamtx_playlist_play(adamtx, le32_to_cpu(header->loop_mode), 0, frames);
+}
+
+int adamtx_playlist_load_firmware(struct adamtx* adamtx, const char* name)
+{
+	int err;
+	const struct firmware* fw;
+	if((err = request_firmware(&fw, name, &adamtx->pdev->dev)))
+		return err;
+	err = adamtx_playlist_load_container(adamtx, fw->data, fw->size);
+	release_firmware(fw);
+	if(!err)
+		dev_info(&adamtx->pdev->dev, "playing %s\n", name);
+	return err;
+}
@@ -0,0 +1,59 @@
+#ifndef _ADAMTX_PLAYLIST_H
+#define _ADAMTX_PLAYLIST_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+
+#include "encoder.h"
+#include "adafruit-matrix-frames.h"
+
+// Largest frame container accepted
+#define ADAMTX_CONTAINER_MAX	(64 << 20)
+// Largest pool of encoded frames
+#define ADAMTX_PLAYLIST_MAX		(128 << 20)
+
+struct adamtx;
+
+// Pool of encoded frames cycled through by the draw thread
+typedef struct adamtx_playlist {
+	struct mutex			lock;
+	spinlock_t				lock_state;
+	struct adamtx_panel_io*	pool;
+	ktime_t*				durations;
+	// Power limiter on-time scale of each frame
+	unsigned int*			scales;
+	size_t					frame_len;
+	int						num_frames;
+
+	int						playing;
+	int						mode;
+	int						first;
+	int						count;
+	int						current;
+	int						direction;
+	ktime_t					shown;
+} adamtx_playlist;
+
+void adamtx_playlist_init(struct adamtx* adamtx);
+
+int adamtx_playlist_alloc(struct adamtx* adamtx, int frames);
+
+void adamtx_playlist_free(struct adamtx* adamtx);
+
+int adamtx_playlist_load(struct adamtx* adamtx, int index, int format, unsigned int duration_us, const void* data, size_t len);
+
+int adamtx_playlist_play(struct adamtx* adamtx, int mode, int first, int count);
+
+void adamtx_playlist_stop(struct adamtx* adamtx);
+
+struct adamtx_panel_io* adamtx_playlist_next(struct adamtx* adamtx, unsigned int* scale);
+
+size_t adamtx_playlist_container_size(const struct adamtx_frames_header* header);
+
+int adamtx_playlist_load_container(struct adamtx* adamtx, const void* data, size_t len);
+
+int adamtx_playlist_load_firmware(struct adamtx* adamtx, const char* name);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * GPIO sequence of a refresh. Shared with the host tools in
+ * tools/adafruit-matrix, which link it against a simulated io backend that
+ * also provides ndelay().
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+
+#include "adafruit-matrix-trace.h"
+#else
+#include <stdint.h>
+
+void ndelay(unsigned long ns);
+
+#define trace_adamtx_row_enabled()	0
+#define trace_adamtx_row(id, address, ns)	((void)(ns))
+#define ktime_get_ns()				0
+#endif
+
+#include "encoder.h"
+#include "io.h"
+#include "refresh.h"
+
+// Output words keep OE low, masking it out leaves the panel dark while shifting
+void adamtx_clock_out_row(struct adamtx_encoder* encoder, struct adamtx_panel_io* data, int length, uint32_t mask)
+{
+	while(--length >= 0)
+	{
+		adamtx_gpio_write_masked_bits(data[length].gpios, mask);
+		adamtx_gpio_set_bits(encoder->clk);
+	}
+}
+
+void adamtx_set_address(struct adamtx_encoder* encoder, int i)
+{
+	int k;
+	uint32_t clk, data;
+	if(encoder->scan.address_mode == ADAMTX_ADDRESS_SHIFT)
+	{
+		// Shift a single low bit into the row select register, the trailing clock latches it
+		clk = 1U << encoder->pins[ADAMTX_PIN_A];
+		data = 1U << encoder->pins[ADAMTX_PIN_B];
+		for(k = 0; k < encoder->scan.addresses; k++)
+		{
+			adamtx_gpio_clr_bits(clk);
+			if(k == encoder->scan.addresses - 1 - i)
+				adamtx_gpio_clr_bits(data);
+			else
+				adamtx_gpio_set_bits(data);
+			adamtx_gpio_set_bits(clk);
+		}
+		adamtx_gpio_clr_bits(clk);
+		adamtx_gpio_set_bits(clk);
+		return;
+	}
+	adamtx_gpio_write_masked_bits(encoder->address_lut[i], encoder->mask_address);
+}
+
+/*
+ * Unless scale is ADAMTX_POWER_SCALE_OFF the panel is blanked for the rest
+ * of every bitplane slot and while the next plane is clocked out, so the
+ * on-time follows the scale while the refresh rate stays about the same.
+ */
+void show_frame(int id, struct adamtx_encoder* encoder, struct adamtx_panel_io* frame, int bits, unsigned int scale)
+{
+	adamtx_gpio_clr_bits(encoder->oe);
+	int i, j;
+	unsigned long slot, on;
+	uint32_t mask = scale <= ADAMTX_POWER_SCALE_ONE ? encoder->mask_all & ~encoder->oe : encoder->mask_all;
+	int pwm_steps = bits;
+	int shift_len = encoder->shift_len;
+	int tracing = trace_adamtx_row_enabled();
+	uint64_t row_start = 0;
+	for(i = encoder->scan.addresses - 1; i >= 0; i--)
+	{
+		if(tracing)
+			row_start = ktime_get_ns();
+		for(j = 0; j < pwm_steps; j++)
+		{
+			adamtx_clock_out_row(encoder, frame + i * pwm_steps * shift_len + j * shift_len, shift_len, mask);
+			adamtx_gpio_set_bits(encoder->oe);
+			// Direct addresses are part of the output words
+			if(j == 0 && encoder->scan.address_mode == ADAMTX_ADDRESS_SHIFT)
+				adamtx_set_address(encoder, i);
+			adamtx_gpio_set_bits(encoder->str);
+			adamtx_gpio_clr_bits(encoder->str);
+			adamtx_gpio_clr_bits(encoder->oe);
+			slot = (1 << j) * ADAMTX_BCD_TIME_NS;
+			if(scale > ADAMTX_POWER_SCALE_ONE)
+			{
+				ndelay(slot);
+				continue;
+			}
+			on = (slot * scale) >> ADAMTX_POWER_SCALE_SHIFT;
+			ndelay(on);
+			adamtx_gpio_set_bits(encoder->oe);
+			ndelay(slot - on);
+		}
+		if(tracing)
+			trace_adamtx_row(id, i, ktime_get_ns() - row_start);
+	}
+	adamtx_gpio_set_bits(encoder->oe);
+}
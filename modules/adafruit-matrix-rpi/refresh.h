@@ -0,0 +1,25 @@
+#ifndef _ADAMTX_REFRESH_H
+#define _ADAMTX_REFRESH_H
+
+#include "encoder.h"
+
+// On-time of the least significant bitplane, doubled for every further plane
+#define ADAMTX_BCD_TIME_NS	1000UL
+
+/*
+ * Fraction of each bitplane slot the LEDs are on, set by the power limiter.
+ * Up to ADAMTX_POWER_SCALE_ONE the on-time is exactly the scaled slot, OFF
+ * keeps the panel lit while the next plane is clocked out, which stretches
+ * the low planes beyond their weight.
+ */
+#define ADAMTX_POWER_SCALE_SHIFT	8
+#define ADAMTX_POWER_SCALE_ONE		(1U << ADAMTX_POWER_SCALE_SHIFT)
+#define ADAMTX_POWER_SCALE_OFF		(~0U)
+
+void adamtx_clock_out_row(struct adamtx_encoder* encoder, struct adamtx_panel_io* data, int length, uint32_t mask);
+
+void adamtx_set_address(struct adamtx_encoder* encoder, int i);
+
+void show_frame(int id, struct adamtx_encoder* encoder, struct adamtx_panel_io* frame, int bits, unsigned int scale);
+
+#endif
@@ -0,0 +1,79 @@
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+// Free of kernel headers, the host tools build this file as well
+#include "dummyfb-format.h"
+#include "remap.h"
+
+/*
+ * Every frame source passes here, so the panel's color gains are applied on
+ * the way. Returns the channel sum of the stored pixel for the power limiter,
+ * 0 for pixels only the spare slot receives.
+ */
+static inline unsigned long remap_store(const uint32_t* table, const struct adamtx_gain* gain, int i, uint32_t pixel, uint32_t* to, uint32_t spare)
+{
+	if(gain)
+		pixel = adamtx_gain_apply(gain->lut + gain->map[i] * ADAMTX_GAIN_LUT_LEN, pixel);
+	to[table[i]] = pixel;
+	if(table[i] == spare)
+		return 0;
+	return (pixel & 0xFF) + ((pixel >> 8) & 0xFF) + ((pixel >> 16) & 0xFF);
+}
+
+/*
+ * Decoders from the framebuffer formats to 0x00RRGGBB, scattered into the
+ * intermediate chain frame through the remap table
+ */
+static unsigned long remap_xrgb8888(const uint32_t* table, const struct adamtx_gain* gain, const uint32_t* from, int pixels, uint32_t* to, uint32_t spare)
+{
+	int i;
+	unsigned long lit = 0;
+	for(i = 0; i < pixels; i++)
+		lit += remap_store(table, gain, i, from[i] & 0x00FFFFFF, to, spare);
+	return lit;
+}
+
+static unsigned long remap_rgb888(const uint32_t* table, const struct adamtx_gain* gain, const uint8_t* from, int pixels, uint32_t* to, uint32_t spare)
+{
+	int i;
+	unsigned long lit = 0;
+	for(i = 0; i < pixels; i++)
+	{
+		lit += remap_store(table, gain, i, from[0] | from[1] << 8 | from[2] << 16, to, spare);
+		from += 3;
+	}
+	return lit;
+}
+
+static unsigned long remap_rgb565(const uint32_t* table, const struct adamtx_gain* gain, const uint16_t* from, int pixels, uint32_t* to, uint32_t spare)
+{
+	int i;
+	uint32_t r, g, b;
+	unsigned long lit = 0;
+	for(i = 0; i < pixels; i++)
+	{
+		// Replicate the top bits so full intensity stays full intensity
+		r = (from[i] >> 11) & 0x1F;
+		g = (from[i] >> 5) & 0x3F;
+		b = from[i] & 0x1F;
+		lit += remap_store(table, gain, i, ((r << 3) | (r >> 2)) << 16 | ((g << 2) | (g >> 4)) << 8 | ((b << 3) | (b >> 2)), to, spare);
+	}
+	return lit;
+}
+
+unsigned long remap_frame(const uint32_t* table, const struct adamtx_gain* gain, const void* from, int format, int pixels, uint32_t* to, uint32_t spare)
+{
+	switch(format)
+	{
+		case DUMMYFB_FORMAT_XRGB8888:
+			return remap_xrgb8888(table, gain, from, pixels, to, spare);
+		case DUMMYFB_FORMAT_RGB888:
+			return remap_rgb888(table, gain, from, pixels, to, spare);
+		case DUMMYFB_FORMAT_RGB565:
+			return remap_rgb565(table, gain, from, pixels, to, spare);
+	}
+	return 0;
+}
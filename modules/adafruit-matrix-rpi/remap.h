@@ -0,0 +1,50 @@
+#ifndef _ADAMTX_REMAP_H
+#define _ADAMTX_REMAP_H
+
+// Shared with the host tools in tools/adafruit-matrix
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+// Color gain tables, one per panel, indexed by the 8 bit channel value
+#define ADAMTX_GAIN_UNITY		255
+#define ADAMTX_GAIN_CHANNEL_LEN	256
+#define ADAMTX_GAIN_LUT_LEN		(3 * ADAMTX_GAIN_CHANNEL_LEN)
+#define ADAMTX_GAIN_R			(0 * ADAMTX_GAIN_CHANNEL_LEN)
+#define ADAMTX_GAIN_G			(1 * ADAMTX_GAIN_CHANNEL_LEN)
+#define ADAMTX_GAIN_B			(2 * ADAMTX_GAIN_CHANNEL_LEN)
+
+// Gain tables of all panels and the panel index of every display pixel
+struct adamtx_gain
+{
+	const uint8_t* lut;
+	const uint16_t* map;
+};
+
+// Fills one panel's table from its R, G and B gain, ADAMTX_GAIN_UNITY keeps a channel as is
+static inline void adamtx_gain_fill_lut(uint8_t* lut, const unsigned char* gain)
+{
+	int i, value;
+	for(i = 0; i < 3; i++)
+	{
+		for(value = 0; value < ADAMTX_GAIN_CHANNEL_LEN; value++)
+			lut[i * ADAMTX_GAIN_CHANNEL_LEN + value] = (value * gain[i] + ADAMTX_GAIN_UNITY / 2) / ADAMTX_GAIN_UNITY;
+	}
+}
+
+static inline uint32_t adamtx_gain_apply(const uint8_t* lut, uint32_t pixel)
+{
+	return lut[ADAMTX_GAIN_R + ((pixel >> 16) & 0xFF)] << 16 |
+		lut[ADAMTX_GAIN_G + ((pixel >> 8) & 0xFF)] << 8 |
+		lut[ADAMTX_GAIN_B + (pixel & 0xFF)];
+}
+
+/*
+ * Returns the sum of all channel values after the gains, leaving out pixels
+ * the table sends to the spare slot because no panel shows them
+ */
+unsigned long remap_frame(const uint32_t* table, const struct adamtx_gain* gain, const void* from, int format, int pixels, uint32_t* to, uint32_t spare);
+
+#endif
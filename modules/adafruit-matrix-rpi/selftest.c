@@ -0,0 +1,138 @@
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/timex.h>
+#include <linux/crc32.h>
+
+#include "adafruit-matrix.h"
+#include "encoder.h"
+#include "matrix.h"
+#include "selftest.h"
+
+/*
+ * Checks of the device itself on probe: the remap table built from its
+ * panels and the time remap and encoder take on its chain. The pipeline
+ * is covered by the KUnit suites in adafruit-matrix-test.c, this only
+ * covers what depends on the device tree of the board.
+ */
+
+static u64 adamtx_selftest_ns(u64 start, int runs)
+{
+	return div_u64(ktime_get_ns() - start, runs);
+}
+
+// xorshift32 noise, the same image on every run
+static void adamtx_selftest_fill(uint32_t* image, int pixels)
+{
+	int i;
+	uint32_t seed = 0x2545F491;
+	for(i = 0; i < pixels; i++)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		image[i] = seed & 0x00FFFFFF;
+	}
+}
+
+// Every display pixel lands on its panel as wired and no chain pixel is used twice
+static int adamtx_selftest_geometry(struct adamtx* adamtx, uint8_t* used)
+{
+	int i, x, y;
+	uint32_t pos, expected;
+	struct matrix_ledpanel* panel;
+	memset(used, 0, adamtx->rows * adamtx->columns);
+	for(i = 0; i < adamtx->real_width * adamtx->real_height; i++)
+	{
+		pos = adamtx->remap_table[i];
+		if(pos == adamtx->rows * adamtx->columns)
+			continue;
+		if(pos > adamtx->rows * adamtx->columns || used[pos]++)
+		{
+			dev_warn(&adamtx->pdev->dev, "selftest geometry: chain pixel %u used twice or out of range\n", pos);
+			return -EINVAL;
+		}
+	}
+	for(i = 0; i < adamtx->num_panels; i++)
+	{
+		panel = adamtx->panels[i];
+		// Top left of the panel in the framebuffer, unless another panel covers it
+		x = panel->realx;
+		y = panel->realy;
+		if(matrix_get_panel_at_real(adamtx->panels, adamtx->num_panels, x, y) != panel)
+			continue;
+		expected = (panel->virtual_y + (panel->flip_y ? panel->yres - 1 : 0)) * adamtx->columns + panel->virtual_x + (panel->flip_x ? panel->xres - 1 : 0);
+		if(adamtx->remap_table[y * adamtx->real_width + x] != expected)
+		{
+			dev_warn(&adamtx->pdev->dev, "selftest geometry: panel %d maps %d,%d to %u, expected %u\n", i, x, y, adamtx->remap_table[y * adamtx->real_width + x], expected);
+			return -EINVAL;
+		}
+	}
+	dev_info(&adamtx->pdev->dev, "selftest geometry: ok\n");
+	return 0;
+}
+
+// Remap and encode of a framebuffer sized frame, the stages of every update
+static void adamtx_selftest_timing(struct adamtx* adamtx, uint32_t* chain, struct adamtx_panel_io* paneldata)
+{
+	int i, len;
+	u64 start, remap_ns;
+	cycles_t cycles, remap_cycles;
+	struct adamtx_frame frame = {
+		.width = adamtx->columns,
+		.height = adamtx->rows,
+		.vertical_offset = 0,
+		.rows = adamtx->rows,
+		.paneldata = paneldata,
+		.frame = chain,
+		.pwm_bits = adamtx->pwm_bits,
+		.dither_bits = 0,
+		.dither_frame = 0,
+		.encoder = &adamtx->encoder
+	};
+	uint32_t* image = vmalloc(adamtx->real_width * adamtx->real_height * sizeof(uint32_t));
+	if(image == NULL)
+		return;
+	adamtx_selftest_fill(image, adamtx->real_width * adamtx->real_height);
+	start = ktime_get_ns();
+	cycles = get_cycles();
+	for(i = 0; i < ADAMTX_SELFTEST_RUNS; i++)
+		remap_frame(adamtx->remap_table, NULL, image, DUMMYFB_FORMAT_XRGB8888, adamtx->real_width * adamtx->real_height, chain, adamtx->rows * adamtx->columns);
+	remap_cycles = get_cycles() - cycles;
+	remap_ns = adamtx_selftest_ns(start, ADAMTX_SELFTEST_RUNS);
+
+	len = ADAMTX_PANELDATA_LEN(adamtx->pwm_bits, adamtx->rows, adamtx->columns);
+	start = ktime_get_ns();
+	cycles = get_cycles();
+	for(i = 0; i < ADAMTX_SELFTEST_RUNS; i++)
+		prerender_frame_part(&frame);
+	cycles = get_cycles() - cycles;
+	// CRCs depend on the pinout and panels only, compare them between builds to catch changes
+	dev_info(&adamtx->pdev->dev, "selftest: remap %llu ns, %lu cycles, encode %llu ns, %lu cycles, crc %08x\n",
+		remap_ns, (unsigned long)(remap_cycles / ADAMTX_SELFTEST_RUNS),
+		adamtx_selftest_ns(start, ADAMTX_SELFTEST_RUNS), (unsigned long)(cycles / ADAMTX_SELFTEST_RUNS),
+		crc32_le(~0, (const u8*)paneldata, len * sizeof(struct adamtx_panel_io)));
+	vfree(image);
+}
+
+int adamtx_selftest(struct adamtx* adamtx)
+{
+	int err;
+	int len = ADAMTX_PANELDATA_LEN(adamtx->pwm_bits, adamtx->rows, adamtx->columns);
+	uint32_t* chain = vzalloc(ADAMTX_INTERMEDIATE_LEN(adamtx->rows, adamtx->columns) * sizeof(uint32_t));
+	struct adamtx_panel_io* paneldata = vmalloc(len * sizeof(struct adamtx_panel_io));
+	uint8_t* used = vmalloc(adamtx->rows * adamtx->columns);
+	err = -ENOMEM;
+	if(chain == NULL || paneldata == NULL || used == NULL)
+		goto exit_free;
+
+	err = adamtx_selftest_geometry(adamtx, used);
+	adamtx_selftest_timing(adamtx, chain, paneldata);
+exit_free:
+	vfree(used);
+	vfree(paneldata);
+	vfree(chain);
+	return err;
+}
@@ -0,0 +1,11 @@
+#ifndef _ADAMTX_SELFTEST_H
+#define _ADAMTX_SELFTEST_H
+
+struct adamtx;
+
+// Timing runs averaged per stage
+#define ADAMTX_SELFTEST_RUNS	8
+
+int adamtx_selftest(struct adamtx* adamtx);
+
+#endif
@@ -0,0 +1,138 @@
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "adafruit-matrix.h"
+#include "stats.h"
+
+static const char* const adamtx_hist_names[ADAMTX_NUM_HISTS] = {
+	[ADAMTX_HIST_UPDATE] =			"update",
+	[ADAMTX_HIST_DRAW] =			"draw",
+	[ADAMTX_HIST_UPDATE_WAKEUP] =	"update_wakeup",
+	[ADAMTX_HIST_DRAW_WAKEUP] =		"draw_wakeup",
+	[ADAMTX_HIST_REFRESH] =			"refresh_period",
+	[ADAMTX_HIST_COMMIT_LATENCY] =	"commit_latency"
+};
+
+static const char* const adamtx_counter_names[ADAMTX_NUM_COUNTERS] = {
+	[ADAMTX_COUNT_DRAW_MISSED] =	"draw_missed",
+	[ADAMTX_COUNT_DRAW_PENDING] =	"draw_pending",
+	[ADAMTX_COUNT_UPDATE_MISSED] =	"update_missed",
+	[ADAMTX_COUNT_UPDATE_PENDING] =	"update_pending",
+	[ADAMTX_COUNT_UPDATE_SKIPPED] =	"update_skipped",
+	[ADAMTX_COUNT_POWER_LIMITED] =	"power_limited"
+};
+
+// One line per histogram: name, max, then the bucket counts from 1 ns up
+static int adamtx_stats_hist_show(struct seq_file* file, void* data)
+{
+	int cpu, i, j;
+	u64 count, max;
+	struct adamtx_stats* stats = file->private;
+	for(i = 0; i < ADAMTX_NUM_HISTS; i++)
+	{
+		max = 0;
+		for_each_possible_cpu(cpu)
+			max = max(max, per_cpu_ptr(stats->cpu, cpu)->max[i]);
+		seq_printf(file, "%s max_ns=%llu", adamtx_hist_names[i], max);
+		for(j = 0; j < ADAMTX_HIST_BUCKETS; j++)
+		{
+			count = 0;
+			for_each_possible_cpu(cpu)
+				count += per_cpu_ptr(stats->cpu, cpu)->hist[i][j];
+			seq_printf(file, " %llu", count);
+		}
+		seq_putc(file, '\n');
+	}
+	return 0;
+}
+
+static int adamtx_stats_counters_show(struct seq_file* file, void* data)
+{
+	int cpu, i;
+	u64 count;
+	struct adamtx_stats* stats = file->private;
+	for(i = 0; i < ADAMTX_NUM_COUNTERS; i++)
+	{
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu_ptr(stats->cpu, cpu)->counters[i];
+		seq_printf(file, "%s %llu\n", adamtx_counter_names[i], count);
+	}
+	return 0;
+}
+
+static int adamtx_stats_hist_open(struct inode* inode, struct file* filep)
+{
+	return single_open(filep, adamtx_stats_hist_show, inode->i_private);
+}
+
+static int adamtx_stats_counters_open(struct inode* inode, struct file* filep)
+{
+	return single_open(filep, adamtx_stats_counters_show, inode->i_private);
+}
+
+// Any write clears everything, values racing with the reset may survive it
+static ssize_t adamtx_stats_reset_write(struct file* filep, const char __user* buffer, size_t len, loff_t* offset)
+{
+	int cpu;
+	struct adamtx_stats* stats = filep->private_data;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(stats->cpu, cpu), 0, sizeof(struct adamtx_stats_cpu));
+	return len;
+}
+
+static const struct file_operations adamtx_stats_hist_fops = {
+	.owner =	THIS_MODULE,
+	.open =		adamtx_stats_hist_open,
+	.read =		seq_read,
+	.llseek =	seq_lseek,
+	.release =	single_release
+};
+
+static const struct file_operations adamtx_stats_counters_fops = {
+	.owner =	THIS_MODULE,
+	.open =		adamtx_stats_counters_open,
+	.read =		seq_read,
+	.llseek =	seq_lseek,
+	.release =	single_release
+};
+
+static const struct file_operations adamtx_stats_reset_fops = {
+	.owner =	THIS_MODULE,
+	.open =		simple_open,
+	.write =	adamtx_stats_reset_write
+};
+
+int adamtx_stats_alloc(struct adamtx* adamtx)
+{
+	char name[16];
+	struct adamtx_stats* stats = &adamtx->stats;
+	stats->cpu = alloc_percpu(struct adamtx_stats_cpu);
+	if(stats->cpu == NULL)
+		return -ENOMEM;
+	atomic64_set(&stats->commit_pending, 0);
+	atomic64_set(&stats->commit_encoded, 0);
+	// Statistics are optional, the display works without debugfs
+	snprintf(name, sizeof(name), "adamtx%d", adamtx->id);
+	stats->dir = debugfs_create_dir(name, NULL);
+	if(IS_ERR_OR_NULL(stats->dir))
+	{
+		stats->dir = NULL;
+		return 0;
+	}
+	debugfs_create_file("histograms", 0444, stats->dir, stats, &adamtx_stats_hist_fops);
+	debugfs_create_file("counters", 0444, stats->dir, stats, &adamtx_stats_counters_fops);
+	debugfs_create_file("reset", 0200, stats->dir, stats, &adamtx_stats_reset_fops);
+	return 0;
+}
+
+void adamtx_stats_free(struct adamtx* adamtx)
+{
+	debugfs_remove_recursive(adamtx->stats.dir);
+	adamtx->stats.dir = NULL;
+	free_percpu(adamtx->stats.cpu);
+	adamtx->stats.cpu = NULL;
+}
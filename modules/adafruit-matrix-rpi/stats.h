@@ -0,0 +1,89 @@
+#ifndef _ADAMTX_STATS_H
+#define _ADAMTX_STATS_H
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+
+struct adamtx;
+struct dentry;
+
+// Bucket n counts durations of [2^n, 2^(n+1)) ns, the last one everything above
+#define ADAMTX_HIST_BUCKETS	34
+
+enum adamtx_hist {
+	ADAMTX_HIST_UPDATE = 0,			// process_frame
+	ADAMTX_HIST_DRAW,				// show_frame
+	ADAMTX_HIST_UPDATE_WAKEUP,		// timer expiry or commit to update thread
+	ADAMTX_HIST_DRAW_WAKEUP,		// timer expiry to draw thread
+	ADAMTX_HIST_REFRESH,			// draw start to draw start
+	ADAMTX_HIST_COMMIT_LATENCY,		// fb commit to the first draw showing it
+	ADAMTX_NUM_HISTS
+};
+
+enum adamtx_counter {
+	ADAMTX_COUNT_DRAW_MISSED = 0,	// Draw periods the timer skipped
+	ADAMTX_COUNT_DRAW_PENDING,		// Draw timer fired before the last draw started
+	ADAMTX_COUNT_UPDATE_MISSED,
+	ADAMTX_COUNT_UPDATE_PENDING,
+	ADAMTX_COUNT_UPDATE_SKIPPED,	// Unchanged frames
+	ADAMTX_COUNT_POWER_LIMITED,		// Frames encoded with reduced on-time
+	ADAMTX_NUM_COUNTERS
+};
+
+typedef struct adamtx_stats_cpu {
+	u64			hist[ADAMTX_NUM_HISTS][ADAMTX_HIST_BUCKETS];
+	u64			max[ADAMTX_NUM_HISTS];
+	u64			counters[ADAMTX_NUM_COUNTERS];
+} adamtx_stats_cpu;
+
+// Cumulative statistics, written lock free per cpu and summed up when read
+typedef struct adamtx_stats {
+	struct adamtx_stats_cpu __percpu*	cpu;
+	struct dentry*			dir;
+	ktime_t					last_draw;
+	// Oldest commit not yet encoded and oldest encoded commit not yet drawn, 0 if none
+	atomic64_t				commit_pending;
+	atomic64_t				commit_encoded;
+} adamtx_stats;
+
+int adamtx_stats_alloc(struct adamtx* adamtx);
+
+void adamtx_stats_free(struct adamtx* adamtx);
+
+static inline void adamtx_stats_record(struct adamtx_stats* stats, int hist, s64 ns)
+{
+	int bucket = ns > 0 ? min_t(int, ilog2((u64)ns), ADAMTX_HIST_BUCKETS - 1) : 0;
+	this_cpu_inc(stats->cpu->hist[hist][bucket]);
+	if(ns > 0 && ns > this_cpu_read(stats->cpu->max[hist]))
+		this_cpu_write(stats->cpu->max[hist], ns);
+}
+
+static inline void adamtx_stats_count(struct adamtx_stats* stats, int counter, u64 n)
+{
+	this_cpu_add(stats->cpu->counters[counter], n);
+}
+
+// Commit latency, called on commit, after encoding and when the framebuffer frame is drawn
+static inline void adamtx_stats_commit(struct adamtx_stats* stats, u64 now)
+{
+	atomic64_cmpxchg(&stats->commit_pending, 0, now);
+}
+
+static inline void adamtx_stats_encoded(struct adamtx_stats* stats)
+{
+	u64 commit = atomic64_xchg(&stats->commit_pending, 0);
+	if(commit)
+		atomic64_cmpxchg(&stats->commit_encoded, 0, commit);
+}
+
+static inline void adamtx_stats_shown(struct adamtx_stats* stats, u64 now)
+{
+	u64 commit = atomic64_xchg(&stats->commit_encoded, 0);
+	if(commit)
+		adamtx_stats_record(stats, ADAMTX_HIST_COMMIT_LATENCY, now - commit);
+}
+
+#endif
@@ -4,7 +4,6 @@
 #include <linux/interrupt.h>
 #include <linux/hrtimer.h>
 #include <linux/sched.h>
-#include <linux/gpio.h>
 #include <linux/vmalloc.h>
 #include <asm/uaccess.h>
 #include <linux/time.h>
@@ -14,11 +13,7 @@ static struct timespec last_call_time;
 
 #include "matrix.h"
 #include "adafruit-matrix.h"
-
-#define ADAMTX_GPIO_HI(gpio) ADAMTX_GPIO_SET(gpio, 1)
-#define ADAMTX_GPIO_LO(gpio) ADAMTX_GPIO_SET(gpio, 0)
-#define ADAMTX_GPIO_SET(gpio, state) gpio_set_value(gpio, state)
-//#define ADAMTX_GPIO_SET(gpio, state) asm("nop")
+#include "io.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Tobas Schramm");
@@ -27,9 +22,14 @@ MODULE_VERSION("0.1");
 
 static DEFINE_MUTEX(adamtx_draw_mutex);
 
-static unsigned adamtx_gpio_ids[ADAMTX_NUM_GPIOS] = {ADAMTX_GPIO_R1, ADAMTX_GPIO_R2, ADAMTX_GPIO_G1, ADAMTX_GPIO_G2, ADAMTX_GPIO_B1, ADAMTX_GPIO_B2, ADAMTX_GPIO_A, ADAMTX_GPIO_B, ADAMTX_GPIO_C, ADAMTX_GPIO_D, ADAMTX_GPIO_E, ADAMTX_GPIO_OE, ADAMTX_GPIO_STR, ADAMTX_GPIO_CLK};
+static unsigned adamtx_gpio_ids[ADAMTX_NUM_PINS] = {ADAMTX_GPIO_R1, ADAMTX_GPIO_R2, ADAMTX_GPIO_G1, ADAMTX_GPIO_G2, ADAMTX_GPIO_B1, ADAMTX_GPIO_B2, ADAMTX_GPIO_A, ADAMTX_GPIO_B, ADAMTX_GPIO_C, ADAMTX_GPIO_D, ADAMTX_GPIO_E, ADAMTX_GPIO_OE, ADAMTX_GPIO_STR, ADAMTX_GPIO_CLK};
+static unsigned int adamtx_gpio_ids_len = ADAMTX_NUM_PINS;
+module_param_array_named(pinout, adamtx_gpio_ids, uint, &adamtx_gpio_ids_len, S_IRUGO);
+MODULE_PARM_DESC(pinout, "GPIOs of R1,R2,G1,G2,B1,B2,A,B,C,D,E,OE,STR,CLK");
 
-static struct gpio* adamtx_gpios;
+static int adamtx_io_backend = ADAMTX_IO_ARRAY;
+module_param_named(io_backend, adamtx_io_backend, int, S_IRUGO);
+MODULE_PARM_DESC(io_backend, "0 for gpio_set_value() per line, 1 for gpiod descriptor arrays (default)");
 
 static struct matrix_ledpanel** adamtx_panels;
 
@@ -66,52 +66,17 @@ static struct hrtimer adamtx_frametimer;
 static ktime_t adamtx_frameperiod;
 static int adamtx_frametimer_enabled = 0;
 
-static int __init adamtx_alloc_gpio(void)
-{
-	int i;
-	adamtx_gpios = vmalloc(ADAMTX_NUM_GPIOS * sizeof(struct gpio));
-	if(adamtx_gpios == NULL)
-		return -ENOMEM;
-	for(i = 0; i < ADAMTX_NUM_GPIOS; i++)
-	{
-		adamtx_gpios[i].gpio = adamtx_gpio_ids[i];
-		adamtx_gpios[i].flags = GPIOF_OUT_INIT_LOW;
-		adamtx_gpios[i].label = ADAMTX_NAME;
-	}
-	return gpio_request_array(adamtx_gpios, ADAMTX_NUM_GPIOS);
-}
-
-static int adamtx_free_gpio(void)
-{
-	gpio_free_array(adamtx_gpios, ADAMTX_NUM_GPIOS);
-	vfree(adamtx_gpios);
-	return 0;
-}
-
 void adamtx_clock_out_row(uint32_t* data, int length)
 {
 	while(--length >= 0)
-	{
-		ADAMTX_GPIO_LO(ADAMTX_GPIO_CLK);
-		ADAMTX_GPIO_SET(ADAMTX_GPIO_R1, (data[length] >> 0) & 0b1);
-		ADAMTX_GPIO_SET(ADAMTX_GPIO_R2, (data[length] >> 1) & 0b1);
-		ADAMTX_GPIO_SET(ADAMTX_GPIO_G1, (data[length] >> 2) & 0b1);
-		ADAMTX_GPIO_SET(ADAMTX_GPIO_G2, (data[length] >> 3) & 0b1);
-		ADAMTX_GPIO_SET(ADAMTX_GPIO_B1, (data[length] >> 4) & 0b1);
-		ADAMTX_GPIO_SET(ADAMTX_GPIO_B2, (data[length] >> 5) & 0b1);
-		ADAMTX_GPIO_HI(ADAMTX_GPIO_CLK);
-	}
-	ADAMTX_GPIO_HI(ADAMTX_GPIO_STR);
-	ADAMTX_GPIO_LO(ADAMTX_GPIO_STR);
+		adamtx_io_shift(data[length]);
+	adamtx_io_set(ADAMTX_PIN_STR, 1);
+	adamtx_io_set(ADAMTX_PIN_STR, 0);
 }
 
 void adamtx_set_address(int address)
 {
-	ADAMTX_GPIO_SET(ADAMTX_GPIO_A, (address >> 0) & 0b1);
-	ADAMTX_GPIO_SET(ADAMTX_GPIO_B, (address >> 1) & 0b1);
-	ADAMTX_GPIO_SET(ADAMTX_GPIO_C, (address >> 2) & 0b1);
-	ADAMTX_GPIO_SET(ADAMTX_GPIO_D, (address >> 3) & 0b1);
-	ADAMTX_GPIO_SET(ADAMTX_GPIO_E, (address >> 4) & 0b1);
+	adamtx_io_set_address(address);
 }
 
 void remap_frame(struct matrix_ledpanel** panels, uint32_t* from, int width_from, int height_from, uint32_t* to, int width_to, int height_to)
@@ -297,7 +262,14 @@ static int __init adamtx_init(void)
 {
 	int i, j, ret;
 	
-	if((ret = adamtx_alloc_gpio()))
+	if(adamtx_gpio_ids_len != ADAMTX_NUM_PINS)
+	{
+		printk(KERN_WARNING ADAMTX_NAME ": pinout needs %d gpios, got %u\n", ADAMTX_NUM_PINS, adamtx_gpio_ids_len);
+		ret = -EINVAL;
+		goto none_alloced;
+	}
+
+	if((ret = adamtx_io_alloc(adamtx_gpio_ids, adamtx_io_backend)))
 	{
 		printk(KERN_WARNING ADAMTX_NAME ": failed to allocate gpios (%d)\n", ret);
 		goto none_alloced;
@@ -368,7 +340,7 @@ framedata_alloced:
 panels_alloced:
 	vfree(adamtx_panels);
 gpio_alloced:
-	adamtx_free_gpio();
+	adamtx_io_free();
 none_alloced:
 	return ret;
 }
@@ -380,7 +352,7 @@ static void __exit adamtx_exit(void)
 	vfree(paneldata);
 	vfree(framedata);
 	vfree(adamtx_panels);
-	adamtx_free_gpio();
+	adamtx_io_free();
 	printk(KERN_INFO ADAMTX_NAME ": shutting down\n");
 }
 
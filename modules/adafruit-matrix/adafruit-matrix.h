@@ -4,8 +4,6 @@
 #define ADAMTX_NAME "adafruit-matrix"
 
 // GPIO setup
-#define ADAMTX_NUM_GPIOS 14
-
 #define ADAMTX_GPIO_R1	11
 #define ADAMTX_GPIO_R2	8
 #define ADAMTX_GPIO_G1	27
@@ -0,0 +1,259 @@
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/machine.h>
+#include <linux/platform_device.h>
+
+#include "adafruit-matrix.h"
+#include "io.h"
+
+static int adamtx_io_backend = ADAMTX_IO_LINES;
+static struct gpio adamtx_io_lines[ADAMTX_NUM_PINS];
+
+/*
+ * The array backend gets its descriptors through a lookup table on a device
+ * of its own, so gpiolib can prepare the bitmap fast path. Data lines and
+ * CLK share one array, bits 0-5 are R1 to B2 and bit 6 is CLK.
+ */
+static struct platform_device* adamtx_io_pdev;
+static struct gpiod_lookup_table* adamtx_io_lookup;
+static struct gpio_descs* adamtx_io_data;
+static struct gpio_descs* adamtx_io_address;
+static struct gpio_desc* adamtx_io_oe;
+static struct gpio_desc* adamtx_io_str;
+
+static int adamtx_io_lookup_entry(struct gpiod_lookup* entry, unsigned gpio, const char* con_id, unsigned idx)
+{
+	struct gpio_desc* desc = gpio_to_desc(gpio);
+	struct gpio_chip* chip;
+	if(desc == NULL)
+		return -EINVAL;
+	chip = gpiod_to_chip(desc);
+	if(chip == NULL)
+		return -ENODEV;
+	entry->chip_label = chip->label;
+	entry->chip_hwnum = gpio - chip->base;
+	entry->con_id = con_id;
+	entry->idx = idx;
+	entry->flags = GPIO_ACTIVE_HIGH;
+	return 0;
+}
+
+static int adamtx_io_build_lookup(const unsigned* gpios)
+{
+	int i, ret;
+	const char* con_id;
+	unsigned idx;
+	adamtx_io_lookup = kzalloc(sizeof(struct gpiod_lookup_table) + (ADAMTX_NUM_PINS + 1) * sizeof(struct gpiod_lookup), GFP_KERNEL);
+	if(adamtx_io_lookup == NULL)
+		return -ENOMEM;
+	adamtx_io_lookup->dev_id = ADAMTX_NAME;
+	for(i = 0; i < ADAMTX_NUM_PINS; i++)
+	{
+		if(i < ADAMTX_NUM_DATA_PINS)
+		{
+			con_id = "data";
+			idx = i;
+		}
+		else if(i == ADAMTX_PIN_CLK)
+		{
+			con_id = "data";
+			idx = ADAMTX_NUM_DATA_PINS;
+		}
+		else if(i < ADAMTX_PIN_A + ADAMTX_NUM_ADDRESS_PINS)
+		{
+			con_id = "address";
+			idx = i - ADAMTX_PIN_A;
+		}
+		else
+		{
+			con_id = i == ADAMTX_PIN_OE ? "oe" : "str";
+			idx = 0;
+		}
+		if((ret = adamtx_io_lookup_entry(&adamtx_io_lookup->table[i], gpios[i], con_id, idx)))
+		{
+			printk(KERN_WARNING ADAMTX_NAME ": gpio %u has no controller (%d)\n", gpios[i], ret);
+			kfree(adamtx_io_lookup);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// Lines are driven from the refresh timer, sleeping controllers can't be used there
+static int adamtx_io_check_cansleep(struct gpio_descs* descs)
+{
+	int i;
+	for(i = 0; i < descs->ndescs; i++)
+	{
+		if(gpiod_cansleep(descs->desc[i]))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static int adamtx_io_alloc_array(const unsigned* gpios)
+{
+	int ret;
+	struct device* dev;
+	if((ret = adamtx_io_build_lookup(gpios)))
+		goto none_alloced;
+	gpiod_add_lookup_table(adamtx_io_lookup);
+
+	adamtx_io_pdev = platform_device_register_simple(ADAMTX_NAME, PLATFORM_DEVID_NONE, NULL, 0);
+	if(IS_ERR(adamtx_io_pdev))
+	{
+		ret = PTR_ERR(adamtx_io_pdev);
+		goto lookup_alloced;
+	}
+	dev = &adamtx_io_pdev->dev;
+
+	adamtx_io_data = gpiod_get_array(dev, "data", GPIOD_OUT_LOW);
+	if(IS_ERR(adamtx_io_data))
+	{
+		ret = PTR_ERR(adamtx_io_data);
+		goto pdev_alloced;
+	}
+	adamtx_io_address = gpiod_get_array(dev, "address", GPIOD_OUT_LOW);
+	if(IS_ERR(adamtx_io_address))
+	{
+		ret = PTR_ERR(adamtx_io_address);
+		goto data_alloced;
+	}
+	adamtx_io_oe = gpiod_get(dev, "oe", GPIOD_OUT_LOW);
+	if(IS_ERR(adamtx_io_oe))
+	{
+		ret = PTR_ERR(adamtx_io_oe);
+		goto address_alloced;
+	}
+	adamtx_io_str = gpiod_get(dev, "str", GPIOD_OUT_LOW);
+	if(IS_ERR(adamtx_io_str))
+	{
+		ret = PTR_ERR(adamtx_io_str);
+		goto oe_alloced;
+	}
+
+	if(adamtx_io_check_cansleep(adamtx_io_data) || adamtx_io_check_cansleep(adamtx_io_address) ||
+		gpiod_cansleep(adamtx_io_oe) || gpiod_cansleep(adamtx_io_str))
+	{
+		printk(KERN_WARNING ADAMTX_NAME ": gpio controller may sleep, can't refresh from timer\n");
+		ret = -EINVAL;
+		goto str_alloced;
+	}
+	return 0;
+
+str_alloced:
+	gpiod_put(adamtx_io_str);
+oe_alloced:
+	gpiod_put(adamtx_io_oe);
+address_alloced:
+	gpiod_put_array(adamtx_io_address);
+data_alloced:
+	gpiod_put_array(adamtx_io_data);
+pdev_alloced:
+	platform_device_unregister(adamtx_io_pdev);
+lookup_alloced:
+	gpiod_remove_lookup_table(adamtx_io_lookup);
+	kfree(adamtx_io_lookup);
+none_alloced:
+	return ret;
+}
+
+static void adamtx_io_free_array(void)
+{
+	gpiod_put(adamtx_io_str);
+	gpiod_put(adamtx_io_oe);
+	gpiod_put_array(adamtx_io_address);
+	gpiod_put_array(adamtx_io_data);
+	platform_device_unregister(adamtx_io_pdev);
+	gpiod_remove_lookup_table(adamtx_io_lookup);
+	kfree(adamtx_io_lookup);
+}
+
+static int adamtx_io_alloc_lines(const unsigned* gpios)
+{
+	int i;
+	for(i = 0; i < ADAMTX_NUM_PINS; i++)
+	{
+		adamtx_io_lines[i].gpio = gpios[i];
+		adamtx_io_lines[i].flags = GPIOF_OUT_INIT_LOW;
+		adamtx_io_lines[i].label = ADAMTX_NAME;
+	}
+	return gpio_request_array(adamtx_io_lines, ADAMTX_NUM_PINS);
+}
+
+int adamtx_io_alloc(const unsigned* gpios, int backend)
+{
+	adamtx_io_backend = backend;
+	switch(backend)
+	{
+		case ADAMTX_IO_LINES:
+			return adamtx_io_alloc_lines(gpios);
+		case ADAMTX_IO_ARRAY:
+			return adamtx_io_alloc_array(gpios);
+	}
+	return -EINVAL;
+}
+
+void adamtx_io_free(void)
+{
+	if(adamtx_io_backend == ADAMTX_IO_ARRAY)
+		adamtx_io_free_array();
+	else
+		gpio_free_array(adamtx_io_lines, ADAMTX_NUM_PINS);
+}
+
+void adamtx_io_shift(uint32_t data)
+{
+	int i;
+	unsigned long bits;
+	if(adamtx_io_backend == ADAMTX_IO_ARRAY)
+	{
+		// Data with CLK low in one go, then the rising edge
+		bits = data & ((1 << ADAMTX_NUM_DATA_PINS) - 1);
+		gpiod_set_array_value(adamtx_io_data->ndescs, adamtx_io_data->desc, adamtx_io_data->info, &bits);
+		gpiod_set_value(adamtx_io_data->desc[ADAMTX_NUM_DATA_PINS], 1);
+		return;
+	}
+	gpio_set_value(adamtx_io_lines[ADAMTX_PIN_CLK].gpio, 0);
+	for(i = 0; i < ADAMTX_NUM_DATA_PINS; i++)
+		gpio_set_value(adamtx_io_lines[i].gpio, (data >> i) & 0b1);
+	gpio_set_value(adamtx_io_lines[ADAMTX_PIN_CLK].gpio, 1);
+}
+
+void adamtx_io_set_address(int address)
+{
+	int i;
+	unsigned long bits;
+	if(adamtx_io_backend == ADAMTX_IO_ARRAY)
+	{
+		bits = address & ((1 << ADAMTX_NUM_ADDRESS_PINS) - 1);
+		gpiod_set_array_value(adamtx_io_address->ndescs, adamtx_io_address->desc, adamtx_io_address->info, &bits);
+		return;
+	}
+	for(i = 0; i < ADAMTX_NUM_ADDRESS_PINS; i++)
+		gpio_set_value(adamtx_io_lines[ADAMTX_PIN_A + i].gpio, (address >> i) & 0b1);
+}
+
+void adamtx_io_set(int pin, int state)
+{
+	struct gpio_desc* desc;
+	if(adamtx_io_backend != ADAMTX_IO_ARRAY)
+	{
+		gpio_set_value(adamtx_io_lines[pin].gpio, state);
+		return;
+	}
+	if(pin < ADAMTX_NUM_DATA_PINS)
+		desc = adamtx_io_data->desc[pin];
+	else if(pin == ADAMTX_PIN_CLK)
+		desc = adamtx_io_data->desc[ADAMTX_NUM_DATA_PINS];
+	else if(pin < ADAMTX_PIN_A + ADAMTX_NUM_ADDRESS_PINS)
+		desc = adamtx_io_address->desc[pin - ADAMTX_PIN_A];
+	else
+		desc = pin == ADAMTX_PIN_OE ? adamtx_io_oe : adamtx_io_str;
+	gpiod_set_value(desc, state);
+}
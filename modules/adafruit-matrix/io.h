@@ -0,0 +1,44 @@
+#ifndef _ADAMTX_IO_H
+#define _ADAMTX_IO_H
+
+#include <linux/types.h>
+
+// Order of the pinout, data word bits 0-5 are R1 to B2
+enum adamtx_pin {
+	ADAMTX_PIN_R1 = 0,
+	ADAMTX_PIN_R2,
+	ADAMTX_PIN_G1,
+	ADAMTX_PIN_G2,
+	ADAMTX_PIN_B1,
+	ADAMTX_PIN_B2,
+	ADAMTX_PIN_A,
+	ADAMTX_PIN_B,
+	ADAMTX_PIN_C,
+	ADAMTX_PIN_D,
+	ADAMTX_PIN_E,
+	ADAMTX_PIN_OE,
+	ADAMTX_PIN_STR,
+	ADAMTX_PIN_CLK,
+	ADAMTX_NUM_PINS
+};
+
+#define ADAMTX_NUM_DATA_PINS	6
+#define ADAMTX_NUM_ADDRESS_PINS	5
+
+enum adamtx_io_backend {
+	ADAMTX_IO_LINES = 0,	// gpio_set_value() per line
+	ADAMTX_IO_ARRAY			// Descriptor arrays, one call per column and per address
+};
+
+int adamtx_io_alloc(const unsigned* gpios, int backend);
+
+void adamtx_io_free(void);
+
+// Clocks one data word into the shift registers
+void adamtx_io_shift(uint32_t data);
+
+void adamtx_io_set_address(int address);
+
+void adamtx_io_set(int pin, int state);
+
+#endif
@@ -0,0 +1,312 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/platform_device.h>
+#include <drm/drm_atomic.h>
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_damage_helper.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_gem_shmem_helper.h>
+#include <drm/drm_modes.h>
+#include <drm/drm_probe_helper.h>
+#include <drm/drm_rect.h>
+#include <drm/drm_vblank.h>
+
+#include "dummydrm.h"
+#include "dummyfb-client.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Tobas Schramm");
+MODULE_DESCRIPTION("Memory only DRM/KMS module scanning out to dummyfb");
+MODULE_VERSION("0.1");
+
+static struct dummydrm* dummydrm_device;
+
+static const uint32_t dummydrm_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_RGB888,
+	DRM_FORMAT_RGB565
+};
+
+static int dummydrm_format(uint32_t fourcc)
+{
+	switch(fourcc)
+	{
+		case DRM_FORMAT_XRGB8888:
+			return DUMMYFB_FORMAT_XRGB8888;
+		case DRM_FORMAT_RGB888:
+			return DUMMYFB_FORMAT_RGB888;
+		case DRM_FORMAT_RGB565:
+			return DUMMYFB_FORMAT_RGB565;
+	}
+	return -EINVAL;
+}
+
+static int dummydrm_get_modes(struct drm_connector* connector)
+{
+	struct dummydrm* dummy = container_of(connector, struct dummydrm, connector);
+	struct drm_display_mode* mode;
+	// dummyfb geometry is rarely a standard mode
+	mode = drm_cvt_mode(connector->dev, READ_ONCE(dummy->width), READ_ONCE(dummy->height), DUMMYDRM_REFRESH, false, false, false);
+	if(mode == NULL)
+		return 0;
+	mode->type |= DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED;
+	drm_mode_probed_add(connector, mode);
+	return 1;
+}
+
+static const struct drm_connector_helper_funcs dummydrm_connector_helper_funcs = {
+	.get_modes =	dummydrm_get_modes
+};
+
+static const struct drm_connector_funcs dummydrm_connector_funcs = {
+	.fill_modes =	drm_helper_probe_single_connector_modes,
+	.destroy =		drm_connector_cleanup,
+	.reset =		drm_atomic_helper_connector_reset,
+	.atomic_duplicate_state =	drm_atomic_helper_connector_duplicate_state,
+	.atomic_destroy_state =		drm_atomic_helper_connector_destroy_state
+};
+
+// Scanout is a copy into dummyfb, only its geometry can be displayed
+static enum drm_mode_status dummydrm_mode_valid(struct drm_crtc* crtc, const struct drm_display_mode* mode)
+{
+	struct dummydrm* dummy = container_of(crtc, struct dummydrm, pipe.crtc);
+	if(mode->hdisplay != READ_ONCE(dummy->width) || mode->vdisplay != READ_ONCE(dummy->height))
+		return MODE_BAD;
+	return MODE_OK;
+}
+
+// A mode set before a dummyfb resize no longer matches its pages
+static int dummydrm_mode_current(const struct drm_display_mode* mode)
+{
+	return mode->hdisplay == dummyfb_get_width() && mode->vdisplay == dummyfb_get_height();
+}
+
+static void dummydrm_send_event(struct drm_crtc* crtc)
+{
+	struct drm_pending_vblank_event* event = crtc->state->event;
+	if(event == NULL)
+		return;
+	crtc->state->event = NULL;
+	spin_lock_irq(&crtc->dev->event_lock);
+	drm_crtc_send_vblank_event(crtc, event);
+	spin_unlock_irq(&crtc->dev->event_lock);
+}
+
+/*
+ * Copies the damage clips of the new framebuffer into dummyfb and commits
+ * their bounding box, consumers see one frame per atomic commit.
+ */
+static void dummydrm_flush(struct drm_plane_state* state, struct drm_plane_state* old_state)
+{
+	struct drm_framebuffer* fb = state->fb;
+	struct drm_atomic_helper_damage_iter iter;
+	struct drm_rect clip;
+	struct drm_rect bounds = { 0 };
+	struct dummyfb_damage damage;
+	int format = dummydrm_format(fb->format->format);
+	int src_x = state->src.x1 >> 16;
+	int src_y = state->src.y1 >> 16;
+	char* vaddr;
+	int damaged = 0;
+
+	vaddr = drm_gem_shmem_vmap(fb->obj[0]);
+	if(IS_ERR_OR_NULL(vaddr))
+		return;
+	drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+	drm_atomic_for_each_plane_damage(&iter, &clip)
+	{
+		// Clips are in framebuffer coordinates, dummyfb in display coordinates
+		drm_rect_translate(&clip, -src_x, -src_y);
+		damage.x = clip.x1;
+		damage.y = clip.y1;
+		damage.width = drm_rect_width(&clip);
+		damage.height = drm_rect_height(&clip);
+		dummyfb_present(vaddr + fb->offsets[0] + src_y * fb->pitches[0] + src_x * fb->format->cpp[0], fb->pitches[0], format, &damage);
+		if(!damaged)
+			bounds = clip;
+		bounds.x1 = min(bounds.x1, clip.x1);
+		bounds.y1 = min(bounds.y1, clip.y1);
+		bounds.x2 = max(bounds.x2, clip.x2);
+		bounds.y2 = max(bounds.y2, clip.y2);
+		damaged = 1;
+	}
+	drm_gem_shmem_vunmap(fb->obj[0], vaddr);
+	if(!damaged)
+		return;
+	damage.x = bounds.x1;
+	damage.y = bounds.y1;
+	damage.width = drm_rect_width(&bounds);
+	damage.height = drm_rect_height(&bounds);
+	dummyfb_commit_damage(&damage);
+}
+
+static void dummydrm_enable(struct drm_simple_display_pipe* pipe, struct drm_crtc_state* crtc_state, struct drm_plane_state* plane_state)
+{
+	struct dummyfb_damage damage = { 0 };
+	struct drm_framebuffer* fb = plane_state->fb;
+	int src_x = plane_state->src.x1 >> 16;
+	int src_y = plane_state->src.y1 >> 16;
+	char* vaddr;
+	if(fb == NULL || !dummydrm_mode_current(&crtc_state->mode))
+		return;
+	vaddr = drm_gem_shmem_vmap(fb->obj[0]);
+	if(IS_ERR_OR_NULL(vaddr))
+		return;
+	// A newly enabled pipe presents a complete frame
+	damage.width = crtc_state->mode.hdisplay;
+	damage.height = crtc_state->mode.vdisplay;
+	dummyfb_present(vaddr + fb->offsets[0] + src_y * fb->pitches[0] + src_x * fb->format->cpp[0], fb->pitches[0], dummydrm_format(fb->format->format), &damage);
+	drm_gem_shmem_vunmap(fb->obj[0], vaddr);
+	dummyfb_commit_damage(&damage);
+}
+
+static void dummydrm_update(struct drm_simple_display_pipe* pipe, struct drm_plane_state* old_state)
+{
+	struct drm_plane_state* state = pipe->plane.state;
+	struct drm_crtc* crtc = &pipe->crtc;
+	// Frames for a stale mode are dropped until the compositor picks up the new one
+	if(state->fb && crtc->state->active && !drm_atomic_crtc_needs_modeset(crtc->state) && dummydrm_mode_current(&crtc->state->mode))
+		dummydrm_flush(state, old_state);
+	// There is no scanout to wait for, the frame is with dummyfb now
+	dummydrm_send_event(crtc);
+}
+
+static const struct drm_simple_display_pipe_funcs dummydrm_pipe_funcs = {
+	.mode_valid =	dummydrm_mode_valid,
+	.enable =		dummydrm_enable,
+	.update =		dummydrm_update,
+	.prepare_fb =	drm_gem_fb_simple_display_pipe_prepare_fb
+};
+
+static const struct drm_mode_config_funcs dummydrm_mode_config_funcs = {
+	.fb_create =		drm_gem_fb_create_with_dirty,
+	.atomic_check =		drm_atomic_helper_check,
+	.atomic_commit =	drm_atomic_helper_commit
+};
+
+static void dummydrm_release(struct drm_device* drm)
+{
+	struct dummydrm* dummy = container_of(drm, struct dummydrm, drm);
+	drm_mode_config_cleanup(drm);
+	drm_dev_fini(drm);
+	kfree(dummy);
+}
+
+DEFINE_DRM_GEM_FOPS(dummydrm_fops);
+
+static struct drm_driver dummydrm_driver = {
+	.driver_features =	DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+	.release =			dummydrm_release,
+	.fops =				&dummydrm_fops,
+	DRM_GEM_SHMEM_DRIVER_OPS,
+	.name =				DUMMYDRM_NAME,
+	.desc =				DUMMYDRM_DESC,
+	.date =				DUMMYDRM_DATE,
+	.major =			0,
+	.minor =			1
+};
+
+static void dummydrm_hotplug(struct work_struct* work)
+{
+	struct dummydrm* dummy = container_of(work, struct dummydrm, hotplug_work);
+	drm_kms_helper_hotplug_event(&dummy->drm);
+}
+
+// Runs in atomic context, userspace is told to reprobe from process context
+static int dummydrm_fb_notify(struct notifier_block* nb, unsigned long event, void* data)
+{
+	struct dummydrm* dummy = container_of(nb, struct dummydrm, fb_notifier);
+	if(event != DUMMYFB_EVENT_RESIZE)
+		return NOTIFY_DONE;
+	WRITE_ONCE(dummy->width, dummyfb_get_width());
+	WRITE_ONCE(dummy->height, dummyfb_get_height());
+	schedule_work(&dummy->hotplug_work);
+	return NOTIFY_OK;
+}
+
+static int dummydrm_modeset_init(struct dummydrm* dummy)
+{
+	int ret;
+	struct drm_device* drm = &dummy->drm;
+	drm_mode_config_init(drm);
+	drm->mode_config.min_width = 1;
+	drm->mode_config.min_height = 1;
+	drm->mode_config.max_width = DUMMYDRM_MAX_WIDTH;
+	drm->mode_config.max_height = DUMMYDRM_MAX_HEIGHT;
+	drm->mode_config.preferred_depth = 24;
+	drm->mode_config.funcs = &dummydrm_mode_config_funcs;
+
+	drm_connector_helper_add(&dummy->connector, &dummydrm_connector_helper_funcs);
+	if((ret = drm_connector_init(drm, &dummy->connector, &dummydrm_connector_funcs, DRM_MODE_CONNECTOR_VIRTUAL)))
+		return ret;
+	if((ret = drm_simple_display_pipe_init(drm, &dummy->pipe, &dummydrm_pipe_funcs, dummydrm_formats, ARRAY_SIZE(dummydrm_formats), NULL, &dummy->connector)))
+		return ret;
+	drm_plane_enable_fb_damage_clips(&dummy->pipe.plane);
+	drm_mode_config_reset(drm);
+	return 0;
+}
+
+static int __init dummydrm_init(void)
+{
+	int ret;
+	struct platform_device* pdev;
+	struct dummydrm* dummy;
+	printk(KERN_INFO "dummydrm: PROBE");
+	// No hardware behind it, like vkms the device only parents the DRM device
+	pdev = platform_device_register_simple(DUMMYDRM_NAME, -1, NULL, 0);
+	if(IS_ERR(pdev))
+		return PTR_ERR(pdev);
+	dummy = kzalloc(sizeof(struct dummydrm), GFP_KERNEL);
+	if(dummy == NULL)
+	{
+		ret = -ENOMEM;
+		goto pdev_alloced;
+	}
+	dummy->pdev = pdev;
+	dummy->width = dummyfb_get_width();
+	dummy->height = dummyfb_get_height();
+	if((ret = drm_dev_init(&dummy->drm, &dummydrm_driver, &pdev->dev)))
+	{
+		kfree(dummy);
+		goto pdev_alloced;
+	}
+	// From here on dummydrm_release frees the device
+	if((ret = dummydrm_modeset_init(dummy)))
+	{
+		printk(KERN_WARNING "dummydrm: failed to set up modesetting (%d)", ret);
+		goto drm_alloced;
+	}
+	if((ret = drm_dev_register(&dummy->drm, 0)))
+		goto drm_alloced;
+	dummydrm_device = dummy;
+	INIT_WORK(&dummy->hotplug_work, dummydrm_hotplug);
+	dummy->fb_notifier.notifier_call = dummydrm_fb_notify;
+	dummyfb_register_client(&dummy->fb_notifier);
+	printk(KERN_INFO "dummydrm: %dx%d scanout to dummyfb", dummy->width, dummy->height);
+	return 0;
+
+drm_alloced:
+	drm_dev_put(&dummy->drm);
+pdev_alloced:
+	platform_device_unregister(pdev);
+	return ret;
+}
+
+static void __exit dummydrm_exit(void)
+{
+	struct platform_device* pdev = dummydrm_device->pdev;
+	printk(KERN_INFO "dummydrm: REMOVE");
+	dummyfb_unregister_client(&dummydrm_device->fb_notifier);
+	cancel_work_sync(&dummydrm_device->hotplug_work);
+	drm_dev_unregister(&dummydrm_device->drm);
+	drm_atomic_helper_shutdown(&dummydrm_device->drm);
+	drm_dev_put(&dummydrm_device->drm);
+	platform_device_unregister(pdev);
+}
+
+module_init(dummydrm_init);
+module_exit(dummydrm_exit);
@@ -0,0 +1,31 @@
+#ifndef _DUMMYDRM_H
+#define _DUMMYDRM_H
+
+#include <linux/platform_device.h>
+#include <linux/notifier.h>
+#include <linux/workqueue.h>
+#include <drm/drm_device.h>
+#include <drm/drm_connector.h>
+#include <drm/drm_simple_kms_helper.h>
+
+#define DUMMYDRM_NAME "dummydrm"
+#define DUMMYDRM_DESC "Memory only DRM device feeding dummyfb"
+#define DUMMYDRM_DATE "20190101"
+
+// Limits accepted for framebuffers, the mode follows dummyfb resizes
+#define DUMMYDRM_MAX_WIDTH 4096
+#define DUMMYDRM_MAX_HEIGHT 4096
+#define DUMMYDRM_REFRESH 60
+
+typedef struct dummydrm {
+	struct drm_device				drm;
+	struct platform_device*			pdev;
+	struct drm_simple_display_pipe	pipe;
+	struct drm_connector			connector;
+	struct notifier_block			fb_notifier;
+	struct work_struct				hotplug_work;
+	int								width;
+	int								height;
+} dummydrm;
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _DUMMYFB_CLIENT_H
+#define _DUMMYFB_CLIENT_H
+
+#include <linux/types.h>
+#include <linux/notifier.h>
+
+#include "dummyfb-ioctl.h"
+#include "dummyfb-format.h"
+
+// Interface for consumer modules
+
+#define DUMMYFB_EVENT_COMMIT 1
+// Sent without data after the geometry changed, clients read the new size
+#define DUMMYFB_EVENT_RESIZE 2
+
+// Passed to clients with DUMMYFB_EVENT_COMMIT, damage is clipped to the page
+typedef struct dummyfb_commit {
+	u64						seq;
+	struct dummyfb_damage*	damage;
+} dummyfb_commit;
+
+size_t dummyfb_get_fbsize(void);
+int dummyfb_get_width(void);
+int dummyfb_get_height(void);
+char* dummyfb_get_fbmem(void);
+void dummyfb_copy(void* buffer);
+void dummyfb_copy_part(void* buffer, size_t len);
+int dummyfb_get_format(void);
+int dummyfb_get_users(void);
+int dummyfb_copy_rect(void* buffer, int x, int y, int width, int height);
+u64 dummyfb_fingerprint(int x, int y, int width, int height);
+void dummyfb_present(const void* src, unsigned int pitch, int format, const struct dummyfb_damage* damage);
+void dummyfb_commit_damage(struct dummyfb_damage* damage);
+void dummyfb_vsync(void);
+u64 dummyfb_get_frame_seq(void);
+int dummyfb_register_client(struct notifier_block* nb);
+int dummyfb_unregister_client(struct notifier_block* nb);
+
+#endif
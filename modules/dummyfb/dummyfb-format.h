@@ -0,0 +1,15 @@
+#ifndef _DUMMYFB_FORMAT_H
+#define _DUMMYFB_FORMAT_H
+
+// Pixel formats, all little endian words. No kernel dependencies, host tools include it as is
+
+enum dummyfb_format {
+	DUMMYFB_FORMAT_RGB565 = 0,
+	DUMMYFB_FORMAT_RGB888,		// Bytes B, G, R
+	DUMMYFB_FORMAT_XRGB8888,
+	DUMMYFB_NUM_FORMATS
+};
+
+#define DUMMYFB_MAX_PIX_LEN 4
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _DUMMYFB_IOCTL_H
+#define _DUMMYFB_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define DUMMYFB_IOC_MAGIC 0xDF
+
+// Damaged area of a committed frame in displayed page coordinates, width or height 0 for all of it
+typedef struct dummyfb_damage {
+	__u32	x;
+	__u32	y;
+	__u32	width;
+	__u32	height;
+} dummyfb_damage;
+
+// Marks the displayed page as a complete frame and notifies consumers
+#define DUMMYFB_IOC_COMMIT		_IOW(DUMMYFB_IOC_MAGIC, 0, struct dummyfb_damage)
+// Returns the sequence number of the last committed frame
+#define DUMMYFB_IOC_GET_SEQ		_IOR(DUMMYFB_IOC_MAGIC, 1, __u64)
+
+#endif
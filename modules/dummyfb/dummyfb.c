@@ -3,7 +3,17 @@
 #include <linux/kernel.h>
 #include <linux/fb.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/notifier.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/xxhash.h>
 
+#include "dummyfb-ioctl.h"
 #include "dummyfb.h"
 
 MODULE_LICENSE("GPL");
@@ -15,21 +25,76 @@ MODULE_VERSION("0.1");
 
 static char* fbmem = NULL;
 
+// Held for reading while fbmem and the geometry are used, for writing while they change
+static DEFINE_RWLOCK(dummyfb_lock);
+// Serializes mmap, read and write against reallocation, fbmem can't move while it is mapped
+static DEFINE_MUTEX(dummyfb_mmap_lock);
+static atomic_t dummyfb_mmaps = ATOMIC_INIT(0);
+// Userspace opens, consumers treat a framebuffer nobody has open as unused
+static atomic_t dummyfb_users = ATOMIC_INIT(0);
+
 static struct fb_info* dummy_fbinfo;
 
 static int dummyfb_width = DUMMYFB_DEFAULT_WIDTH;
 static int dummyfb_height = DUMMYFB_DEFAULT_HEIGHT;
 static int dummyfb_depth = DUMMYFB_DEFAULT_DEPTH;
 static int dummyfb_refresh = DUMMYFB_DEFAULT_REFRESH;
+static int dummyfb_pages = DUMMYFB_DEFAULT_PAGES;
+static int dummyfb_format;
+
+// First line of the page consumers read, moved by panning
+static int dummyfb_yoffset = 0;
+
+static DECLARE_WAIT_QUEUE_HEAD(dummyfb_vsync_wait);
+static unsigned int dummyfb_vsync_count = 0;
+
+// Consumers notified on every committed frame, callbacks run in atomic context
+static ATOMIC_NOTIFIER_HEAD(dummyfb_clients);
+static atomic64_t dummyfb_frame_seq = ATOMIC64_INIT(0);
 
 module_param_named(width, dummyfb_width, int, S_IRUGO);
 MODULE_PARM_DESC(width, "Framebuffer horizontal resolution");
 module_param_named(height, dummyfb_height, int, S_IRUGO);
 MODULE_PARM_DESC(height, "Framebuffer vertical resolution");
 module_param_named(depth, dummyfb_depth, int, S_IRUGO);
-MODULE_PARM_DESC(depth, "Framebuffer depth/bpp");
+MODULE_PARM_DESC(depth, "Initial framebuffer depth/bpp, 16 (RGB565), 24 (RGB888) or 32 (XRGB8888)");
 module_param_named(refresh, dummyfb_refresh, int, S_IRUGO);
 MODULE_PARM_DESC(refresh, "Framebuffer refresh rate in Hz");
+module_param_named(pages, dummyfb_pages, int, S_IRUGO);
+MODULE_PARM_DESC(pages, "Number of pages in the virtual framebuffer for page flipping (1-3)");
+
+typedef struct dummyfb_pixfmt {
+	int					bpp;
+	struct fb_bitfield	red;
+	struct fb_bitfield	green;
+	struct fb_bitfield	blue;
+} dummyfb_pixfmt;
+
+static const struct dummyfb_pixfmt dummyfb_formats[DUMMYFB_NUM_FORMATS] =
+{
+	[DUMMYFB_FORMAT_RGB565] =	{ 16, { 11, 5, 0 }, { 5, 6, 0 }, { 0, 5, 0 } },
+	[DUMMYFB_FORMAT_RGB888] =	{ 24, { 16, 8, 0 }, { 8, 8, 0 }, { 0, 8, 0 } },
+	[DUMMYFB_FORMAT_XRGB8888] =	{ 32, { 16, 8, 0 }, { 8, 8, 0 }, { 0, 8, 0 } }
+};
+
+static int dummyfb_format_from_bpp(int bpp)
+{
+	int i;
+	for(i = 0; i < DUMMYFB_NUM_FORMATS; i++)
+	{
+		if(dummyfb_formats[i].bpp == bpp)
+			return i;
+	}
+	return -EINVAL;
+}
+
+static void dummyfb_set_bitfields(struct fb_var_screeninfo* var, int format)
+{
+	var->red = dummyfb_formats[format].red;
+	var->green = dummyfb_formats[format].green;
+	var->blue = dummyfb_formats[format].blue;
+	memset(&var->transp, 0, sizeof(var->transp));
+}
 
 #define NUM_MODES 1
 static struct fb_videomode dummy_modedb[NUM_MODES] =
@@ -54,59 +119,302 @@ static struct fb_ops dummy_fbops =
 	.owner =	THIS_MODULE,
 	.fb_check_var =	dummy_check_var,
 	.fb_set_par =	dummy_set_par,
-	.fb_mmap =	dummy_mmap
+	.fb_mmap =	dummy_mmap,
+	.fb_pan_display =	dummy_pan_display,
+	.fb_ioctl =	dummy_ioctl,
+	.fb_open =	dummy_open,
+	.fb_release =	dummy_release,
+	.fb_fillrect =	dummy_fillrect,
+	.fb_copyarea =	dummy_copyarea,
+	.fb_imageblit =	dummy_imageblit,
+	.fb_read =	dummy_read,
+	.fb_write =	dummy_write
 };
 
 static int dummy_check_var(struct fb_var_screeninfo* var, struct fb_info* info)
 {
+	int format = dummyfb_format_from_bpp(var->bits_per_pixel);
 	printk(KERN_INFO "dummyfb: check_var");
 	printk(KERN_INFO "dummyfb: size: %dx%d virtualsize:%dx%d bpp: %d", var->xres, var->yres, var->xres_virtual, var->yres_virtual, var->bits_per_pixel);
-	if(var->bits_per_pixel != dummyfb_depth) // Accept only fixed color depth
+	if(format < 0)
+		return -EINVAL;
+	// One fixed layout per depth
+	dummyfb_set_bitfields(var, format);
+	if(var->xres < 1 || var->xres > DUMMYFB_MAX_WIDTH || var->yres < 1 || var->yres > DUMMYFB_MAX_HEIGHT)
 		return -EINVAL;
-	if(var->xres != dummyfb_width || var->yres != dummyfb_height)
+	// Any whole number of pages up to the allocated ones
+	if(var->xres_virtual != var->xres || var->yres_virtual % var->yres || var->yres_virtual / var->yres < 1 || var->yres_virtual / var->yres > dummyfb_pages)
 		return -EINVAL;
-	if(var->xres_virtual != dummyfb_width || var->yres_virtual != dummyfb_height)
+	if(var->xoffset != 0 || var->yoffset + var->yres > var->yres_virtual)
 		return -EINVAL;
 	return 0;
 }
 
+static void dummyfb_commit_frame(struct dummyfb_damage* damage)
+{
+	struct dummyfb_commit commit;
+	// Clip to the page, empty rectangles damage all of it
+	if(damage->width == 0 || damage->height == 0 || damage->x >= dummyfb_width || damage->y >= dummyfb_height)
+	{
+		damage->x = 0;
+		damage->y = 0;
+		damage->width = dummyfb_width;
+		damage->height = dummyfb_height;
+	}
+	damage->width = min_t(u32, damage->width, dummyfb_width - damage->x);
+	damage->height = min_t(u32, damage->height, dummyfb_height - damage->y);
+	commit.seq = atomic64_inc_return(&dummyfb_frame_seq);
+	commit.damage = damage;
+	atomic_notifier_call_chain(&dummyfb_clients, DUMMYFB_EVENT_COMMIT, &commit);
+}
+
+/*
+ * Commits the part of a drawing operation in virtual coordinates that
+ * lands on the displayed page, drawing to a back page damages nothing.
+ */
+static void dummyfb_damage_area(int x, int y, int width, int height)
+{
+	struct dummyfb_damage damage;
+	int top = max(y, dummyfb_yoffset);
+	int bottom = min(y + height, dummyfb_yoffset + dummyfb_height);
+	if(width <= 0 || top >= bottom)
+		return;
+	damage.x = x;
+	damage.y = top - dummyfb_yoffset;
+	damage.width = width;
+	damage.height = bottom - top;
+	dummyfb_commit_frame(&damage);
+}
+
+// Drawing holds dummyfb_lock so a resize can't free the memory under it
+static void dummy_fillrect(struct fb_info* info, const struct fb_fillrect* rect)
+{
+	read_lock(&dummyfb_lock);
+	sys_fillrect(info, rect);
+	read_unlock(&dummyfb_lock);
+	dummyfb_damage_area(rect->dx, rect->dy, rect->width, rect->height);
+}
+
+static void dummy_copyarea(struct fb_info* info, const struct fb_copyarea* area)
+{
+	read_lock(&dummyfb_lock);
+	sys_copyarea(info, area);
+	read_unlock(&dummyfb_lock);
+	dummyfb_damage_area(area->dx, area->dy, area->width, area->height);
+}
+
+static void dummy_imageblit(struct fb_info* info, const struct fb_image* image)
+{
+	read_lock(&dummyfb_lock);
+	sys_imageblit(info, image);
+	read_unlock(&dummyfb_lock);
+	dummyfb_damage_area(image->dx, image->dy, image->width, image->height);
+}
+
+// Copies to and from userspace may fault, they exclude resizes through the mutex
+static ssize_t dummy_read(struct fb_info* info, char __user* buf, size_t count, loff_t* ppos)
+{
+	ssize_t ret;
+	mutex_lock(&dummyfb_mmap_lock);
+	ret = fb_sys_read(info, buf, count, ppos);
+	mutex_unlock(&dummyfb_mmap_lock);
+	return ret;
+}
+
+// Writes damage the full width of every line they touch
+static ssize_t dummy_write(struct fb_info* info, const char __user* buf, size_t count, loff_t* ppos)
+{
+	int first, last;
+	loff_t start = *ppos;
+	ssize_t ret;
+	mutex_lock(&dummyfb_mmap_lock);
+	ret = fb_sys_write(info, buf, count, ppos);
+	if(ret <= 0)
+		goto exit_mutex;
+	first = div_u64(start, info->fix.line_length);
+	last = div_u64(start + ret - 1, info->fix.line_length);
+	dummyfb_damage_area(0, first, dummyfb_width, last - first + 1);
+exit_mutex:
+	mutex_unlock(&dummyfb_mmap_lock);
+	return ret;
+}
+
+static int dummy_pan_display(struct fb_var_screeninfo* var, struct fb_info* info)
+{
+	struct dummyfb_damage damage = { 0 };
+	if(var->xoffset != 0 || var->yoffset + info->var.yres > info->var.yres_virtual)
+		return -EINVAL;
+	// Consumers pick the new page up with their next copy
+	WRITE_ONCE(dummyfb_yoffset, var->yoffset);
+	// A flip always presents a complete frame
+	dummyfb_commit_frame(&damage);
+	return 0;
+}
+
+static int dummy_ioctl(struct fb_info* info, unsigned int cmd, unsigned long arg)
+{
+	u32 crtc;
+	long ret;
+	u64 seq;
+	unsigned int count;
+	struct dummyfb_damage damage;
+	switch(cmd)
+	{
+		case DUMMYFB_IOC_COMMIT:
+			if(copy_from_user(&damage, (void __user*)arg, sizeof(damage)))
+				return -EFAULT;
+			dummyfb_commit_frame(&damage);
+			return 0;
+		case DUMMYFB_IOC_GET_SEQ:
+			seq = atomic64_read(&dummyfb_frame_seq);
+			if(copy_to_user((void __user*)arg, &seq, sizeof(seq)))
+				return -EFAULT;
+			return 0;
+		case FBIO_WAITFORVSYNC:
+			if(get_user(crtc, (u32 __user*)arg))
+				return -EFAULT;
+			if(crtc != 0)
+				return -ENODEV;
+			count = READ_ONCE(dummyfb_vsync_count);
+			ret = wait_event_interruptible_timeout(dummyfb_vsync_wait, READ_ONCE(dummyfb_vsync_count) != count, msecs_to_jiffies(DUMMYFB_VSYNC_TIMEOUT_MS));
+			if(ret < 0)
+				return ret;
+			// No consumer is reading the framebuffer
+			if(ret == 0)
+				return -ETIMEDOUT;
+			return 0;
+	}
+	return -ENOTTY;
+}
+
+// Replaces fbmem with a cleared buffer for the new geometry
+static int dummyfb_resize(struct fb_info* info, int width, int height)
+{
+	int ret = 0;
+	char* mem;
+	char* old;
+	size_t size = DUMMYFB_VIRTUAL_SIZE(width, height);
+	mutex_lock(&dummyfb_mmap_lock);
+	if(atomic_read(&dummyfb_mmaps))
+	{
+		ret = -EBUSY;
+		goto exit_mutex;
+	}
+	mem = vmalloc_user(size);
+	if(!mem)
+	{
+		ret = -ENOMEM;
+		goto exit_mutex;
+	}
+	// Everything the drawing ops use moves together, the old buffer is unused once unlocked
+	write_lock(&dummyfb_lock);
+	old = fbmem;
+	fbmem = mem;
+	dummyfb_width = width;
+	dummyfb_height = height;
+	dummyfb_yoffset = 0;
+	info->screen_base = (char __iomem *)fbmem;
+	info->fix.smem_len = size;
+	info->fix.line_length = width * (dummyfb_depth >> 3);
+	write_unlock(&dummyfb_lock);
+	vfree(old);
+	dummy_modedb[0].xres = width;
+	dummy_modedb[0].yres = height;
+exit_mutex:
+	mutex_unlock(&dummyfb_mmap_lock);
+	return ret;
+}
+
 static int dummy_set_par(struct fb_info* info)
 {
+	int ret;
+	struct dummyfb_damage damage = { 0 };
+	int format = dummyfb_format_from_bpp(info->var.bits_per_pixel);
+	int resize = info->var.xres != dummyfb_width || info->var.yres != dummyfb_height;
 	printk(KERN_INFO "dummyfb: set_par");
+	if(format < 0)
+		return -EINVAL;
+	if(resize && (ret = dummyfb_resize(info, info->var.xres, info->var.yres)))
+	{
+		printk(KERN_WARNING "dummyfb: resize to %dx%d failed (%d)", info->var.xres, info->var.yres, ret);
+		return ret;
+	}
+	write_lock(&dummyfb_lock);
+	dummyfb_depth = info->var.bits_per_pixel;
+	dummyfb_format = format;
+	info->fix.line_length = dummyfb_width * (dummyfb_depth >> 3);
+	write_unlock(&dummyfb_lock);
+	// The new buffer is blank
+	if(resize)
+	{
+		atomic_notifier_call_chain(&dummyfb_clients, DUMMYFB_EVENT_RESIZE, NULL);
+		dummyfb_commit_frame(&damage);
+	}
+	return 0;
+}
+
+static int dummy_open(struct fb_info* info, int user)
+{
+	if(user)
+		atomic_inc(&dummyfb_users);
+	return 0;
+}
+
+static int dummy_release(struct fb_info* info, int user)
+{
+	if(user)
+		atomic_dec(&dummyfb_users);
 	return 0;
 }
 
+static void dummy_vm_open(struct vm_area_struct* vma)
+{
+	atomic_inc(&dummyfb_mmaps);
+}
+
+static void dummy_vm_close(struct vm_area_struct* vma)
+{
+	atomic_dec(&dummyfb_mmaps);
+}
+
+static const struct vm_operations_struct dummy_vm_ops =
+{
+	.open =		dummy_vm_open,
+	.close =	dummy_vm_close
+};
+
 static int dummy_mmap(struct fb_info *info, struct vm_area_struct *vma)
 {
-	if(remap_pfn_range(vma, vma->vm_start, virt_to_phys((void *)fbmem) >> PAGE_SHIFT, DUMMYFB_MEMSIZE, vma->vm_page_prot) < 0)
+	int ret;
+	mutex_lock(&dummyfb_mmap_lock);
+	ret = remap_vmalloc_range(vma, fbmem, vma->vm_pgoff);
+	if(ret == 0)
 	{
-		return -EIO;
+		vma->vm_ops = &dummy_vm_ops;
+		dummy_vm_open(vma);
 	}
-	return 0;
+	mutex_unlock(&dummyfb_mmap_lock);
+	return ret;
 }
 
 static void init_fb_info(struct fb_info* dummy_fb_info)
 {
 	dummy_fb_info->fbops = &dummy_fbops;
-	dummy_fb_info->flags = FBINFO_DEFAULT;
+	// Drawing ops work on system memory
+	dummy_fb_info->flags = FBINFO_DEFAULT | FBINFO_VIRTFB;
 	strcpy(dummy_fb_info->fix.id, "Dummy");
 	dummy_fb_info->fix.type = FB_TYPE_PACKED_PIXELS;
 	dummy_fb_info->fix.visual = FB_VISUAL_TRUECOLOR;
 	dummy_fb_info->fix.line_length = dummyfb_width * (dummyfb_depth >> 3); // Line length (in bytes!)
 	dummy_fb_info->fix.accel = FB_ACCEL_NONE;
+	dummy_fb_info->fix.ypanstep = 1;
 	memset(&dummy_fb_info->var, 0, sizeof(dummy_fb_info->var));
 	dummy_fb_info->var.xres = dummyfb_width;
 	dummy_fb_info->var.yres = dummyfb_height;
 	dummy_fb_info->var.xres_virtual = dummyfb_width;
-	dummy_fb_info->var.yres_virtual = dummyfb_height;
-	dummy_fb_info->var.red.length = 8;
-	dummy_fb_info->var.red.offset = 16;
-	dummy_fb_info->var.green.length = 8;
-	dummy_fb_info->var.green.offset = 8;
-	dummy_fb_info->var.blue.length = 8;
-	dummy_fb_info->var.blue.offset = 0;
+	dummy_fb_info->var.yres_virtual = dummyfb_height * dummyfb_pages;
+	dummyfb_set_bitfields(&dummy_fb_info->var, dummyfb_format);
 	dummy_fb_info->var.bits_per_pixel = dummyfb_depth;
-	dummy_fb_info->var.transp.length = 0;
 	dummy_fb_info->var.activate = FB_ACTIVATE_NOW;
 	dummy_fb_info->var.vmode = FB_VMODE_NONINTERLACED;
 	dummy_fb_info->monspecs = dummy_monspecs;
@@ -122,7 +430,7 @@ static void __exit dummyfb_exit(void)
 	if(dummy_fbinfo)
 	{
 		unregister_framebuffer(dummy_fbinfo);
-		kfree(dummy_fbinfo->screen_base);
+		vfree(fbmem);
 		framebuffer_release(dummy_fbinfo);
 	}
 }
@@ -132,7 +440,23 @@ static int __init dummyfb_init(void)
 	int ret;
 	dummy_fbinfo = NULL;
 	printk(KERN_INFO "dummyfb: PROBE");
-	printk(KERN_INFO "dummyfb: memsize=%d", DUMMYFB_MEMSIZE);
+	if(dummyfb_pages < 1 || dummyfb_pages > DUMMYFB_MAX_PAGES)
+	{
+		printk(KERN_WARNING "dummyfb: pages must be between 1 and %d", DUMMYFB_MAX_PAGES);
+		return -EINVAL;
+	}
+	if(dummyfb_width < 1 || dummyfb_width > DUMMYFB_MAX_WIDTH || dummyfb_height < 1 || dummyfb_height > DUMMYFB_MAX_HEIGHT)
+	{
+		printk(KERN_WARNING "dummyfb: resolution must be between 1x1 and %dx%d", DUMMYFB_MAX_WIDTH, DUMMYFB_MAX_HEIGHT);
+		return -EINVAL;
+	}
+	dummyfb_format = dummyfb_format_from_bpp(dummyfb_depth);
+	if(dummyfb_format < 0)
+	{
+		printk(KERN_WARNING "dummyfb: unsupported depth %d", dummyfb_depth);
+		return -EINVAL;
+	}
+	printk(KERN_INFO "dummyfb: memsize=%d pages=%d", DUMMYFB_MEMSIZE, dummyfb_pages);
 	ret = -ENOMEM;
 	dummy_fbinfo = framebuffer_alloc(0, NULL);
 
@@ -140,12 +464,13 @@ static int __init dummyfb_init(void)
 		goto noalloced;
 
 	init_fb_info(dummy_fbinfo);
-	fbmem = kzalloc(DUMMYFB_MEMSIZE, GFP_KERNEL);
+	// Page backed, large framebuffers need no physically contiguous memory
+	fbmem = vmalloc_user(DUMMYFB_VIRTUAL_MEMSIZE);
 	if(!fbmem)
 		goto fballoced;
 
-	dummy_fbinfo->fix.smem_start = virt_to_phys((void *)fbmem);
-	dummy_fbinfo->fix.smem_len = DUMMYFB_MEMSIZE;
+	dummy_fbinfo->fix.smem_start = 0;
+	dummy_fbinfo->fix.smem_len = DUMMYFB_VIRTUAL_MEMSIZE;
 	dummy_fbinfo->screen_base = (char __iomem *)fbmem;
 
 	ret = register_framebuffer(dummy_fbinfo);
@@ -158,7 +483,7 @@ static int __init dummyfb_init(void)
 	return 0;
 
 memalloced:
-	kfree(fbmem);
+	vfree(fbmem);
 fballoced:
 	framebuffer_release(dummy_fbinfo);
 noalloced:
@@ -173,22 +498,211 @@ size_t dummyfb_get_fbsize(void)
 	return DUMMYFB_MEMSIZE;
 }
 
+int dummyfb_get_width(void)
+{
+	return dummyfb_width;
+}
+
+int dummyfb_get_height(void)
+{
+	return dummyfb_height;
+}
+
+// Displayed page
+static char* dummyfb_front(int pix_len)
+{
+	return fbmem + READ_ONCE(dummyfb_yoffset) * dummyfb_width * pix_len;
+}
+
+int dummyfb_get_users(void)
+{
+	return atomic_read(&dummyfb_users);
+}
+
+int dummyfb_get_format(void)
+{
+	return READ_ONCE(dummyfb_format);
+}
+
+// Only valid until the next geometry change, prefer the copy functions
 char* dummyfb_get_fbmem(void)
 {
-	return fbmem;
+	return dummyfb_front(dummyfb_depth >> 3);
 }
 
 void dummyfb_copy(void* buffer)
 {
-	memcpy(buffer, fbmem, DUMMYFB_MEMSIZE);
+	read_lock(&dummyfb_lock);
+	memcpy(buffer, dummyfb_front(dummyfb_depth >> 3), DUMMYFB_MEMSIZE);
+	read_unlock(&dummyfb_lock);
 }
 
 void dummyfb_copy_part(void* buffer, size_t len)
 {
-	memcpy(buffer, fbmem, len);
+	read_lock(&dummyfb_lock);
+	memcpy(buffer, dummyfb_front(dummyfb_depth >> 3), min_t(size_t, len, DUMMYFB_MEMSIZE));
+	read_unlock(&dummyfb_lock);
+}
+
+/*
+ * Copies a rectangular area of the framebuffer into a tightly packed buffer
+ * of up to DUMMYFB_MAX_PIX_LEN bytes per pixel, returns the pixel format of the copy.
+ * Parts outside of the current geometry read as black.
+ */
+int dummyfb_copy_rect(void* buffer, int x, int y, int width, int height)
+{
+	int i, format, pix_len, line_length, copy_width, copy_height;
+	char* front;
+	read_lock(&dummyfb_lock);
+	format = dummyfb_format;
+	pix_len = dummyfb_formats[format].bpp >> 3;
+	line_length = dummyfb_width * pix_len;
+	front = dummyfb_front(pix_len);
+	copy_width = clamp(dummyfb_width - x, 0, width);
+	copy_height = clamp(dummyfb_height - y, 0, height);
+	if(copy_width < width || copy_height < height)
+		memset(buffer, 0, width * height * pix_len);
+	for(i = 0; i < copy_height; i++)
+		memcpy(buffer + i * width * pix_len, front + (y + i) * line_length + x * pix_len, copy_width * pix_len);
+	read_unlock(&dummyfb_lock);
+	return format;
+}
+
+/*
+ * Hash of a rectangular area of the displayed page as dummyfb_copy_rect would
+ * copy it, lets consumers skip frames that did not change without copying them.
+ */
+u64 dummyfb_fingerprint(int x, int y, int width, int height)
+{
+	int i, pix_len, copy_width, copy_height;
+	u64 hash;
+	char* front;
+	read_lock(&dummyfb_lock);
+	pix_len = dummyfb_formats[dummyfb_format].bpp >> 3;
+	front = dummyfb_front(pix_len);
+	copy_width = clamp(dummyfb_width - x, 0, width);
+	copy_height = clamp(dummyfb_height - y, 0, height);
+	// Format and clipping change the copy even if the memory doesn't
+	hash = (u64)dummyfb_format << 32 | copy_width << 16 | copy_height;
+	for(i = 0; i < copy_height; i++)
+		hash = xxh64(front + ((y + i) * dummyfb_width + x) * pix_len, copy_width * pix_len, hash);
+	read_unlock(&dummyfb_lock);
+	return hash;
+}
+
+static u32 dummyfb_read_pixel(const u8* pix, int format)
+{
+	u32 r, g, b;
+	switch(format)
+	{
+		case DUMMYFB_FORMAT_RGB565:
+			r = (pix[1] >> 3) & 0x1F;
+			g = ((pix[1] & 0x07) << 3) | (pix[0] >> 5);
+			b = pix[0] & 0x1F;
+			return ((r << 3) | (r >> 2)) << 16 | ((g << 2) | (g >> 4)) << 8 | ((b << 3) | (b >> 2));
+		default:
+			// RGB888 and XRGB8888 share the byte order of the colors
+			return pix[2] << 16 | pix[1] << 8 | pix[0];
+	}
+}
+
+static void dummyfb_write_pixel(u8* pix, int format, u32 rgb)
+{
+	u16 rgb565;
+	switch(format)
+	{
+		case DUMMYFB_FORMAT_RGB565:
+			rgb565 = ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F);
+			pix[0] = rgb565 & 0xFF;
+			pix[1] = rgb565 >> 8;
+			break;
+		case DUMMYFB_FORMAT_XRGB8888:
+			pix[3] = 0;
+			// fall through
+		case DUMMYFB_FORMAT_RGB888:
+			pix[0] = rgb & 0xFF;
+			pix[1] = (rgb >> 8) & 0xFF;
+			pix[2] = (rgb >> 16) & 0xFF;
+			break;
+	}
+}
+
+/*
+ * Copies the damaged area of an external scanout buffer into the displayed
+ * page, converting to the current format if needed. src points at the pixel
+ * that maps to the top left corner of the page. Does not commit.
+ */
+void dummyfb_present(const void* src, unsigned int pitch, int format, const struct dummyfb_damage* damage)
+{
+	int i, j, to_format, to_len, from_len, width, height;
+	char* front;
+	const u8* from;
+	u8* to;
+	if(format < 0 || format >= DUMMYFB_NUM_FORMATS)
+		return;
+	read_lock(&dummyfb_lock);
+	to_format = dummyfb_format;
+	to_len = dummyfb_formats[to_format].bpp >> 3;
+	from_len = dummyfb_formats[format].bpp >> 3;
+	front = dummyfb_front(to_len);
+	width = damage->x < dummyfb_width ? min_t(int, damage->width, dummyfb_width - damage->x) : 0;
+	height = damage->y < dummyfb_height ? min_t(int, damage->height, dummyfb_height - damage->y) : 0;
+	for(i = 0; i < height; i++)
+	{
+		from = (const u8*)src + (damage->y + i) * pitch + damage->x * from_len;
+		to = front + ((damage->y + i) * dummyfb_width + damage->x) * to_len;
+		if(format == to_format)
+		{
+			memcpy(to, from, width * to_len);
+			continue;
+		}
+		for(j = 0; j < width; j++)
+			dummyfb_write_pixel(to + j * to_len, to_format, dummyfb_read_pixel(from + j * from_len, format));
+	}
+	read_unlock(&dummyfb_lock);
+}
+
+// Lets producers other than fbdev clients hand frames to the consumers
+void dummyfb_commit_damage(struct dummyfb_damage* damage)
+{
+	dummyfb_commit_frame(damage);
+}
+
+// Called by consumers at their frame boundary, after they copied the displayed page
+void dummyfb_vsync(void)
+{
+	WRITE_ONCE(dummyfb_vsync_count, dummyfb_vsync_count + 1);
+	wake_up_interruptible_all(&dummyfb_vsync_wait);
 }
 
 EXPORT_SYMBOL(dummyfb_get_fbsize);
+EXPORT_SYMBOL(dummyfb_get_width);
+EXPORT_SYMBOL(dummyfb_get_height);
 EXPORT_SYMBOL(dummyfb_get_fbmem);
 EXPORT_SYMBOL(dummyfb_copy);
 EXPORT_SYMBOL(dummyfb_copy_part);
+EXPORT_SYMBOL(dummyfb_get_format);
+EXPORT_SYMBOL(dummyfb_get_users);
+EXPORT_SYMBOL(dummyfb_copy_rect);
+EXPORT_SYMBOL(dummyfb_fingerprint);
+EXPORT_SYMBOL(dummyfb_present);
+EXPORT_SYMBOL(dummyfb_commit_damage);
+u64 dummyfb_get_frame_seq(void)
+{
+	return atomic64_read(&dummyfb_frame_seq);
+}
+
+int dummyfb_register_client(struct notifier_block* nb)
+{
+	return atomic_notifier_chain_register(&dummyfb_clients, nb);
+}
+
+int dummyfb_unregister_client(struct notifier_block* nb)
+{
+	return atomic_notifier_chain_unregister(&dummyfb_clients, nb);
+}
+
+EXPORT_SYMBOL(dummyfb_vsync);
+EXPORT_SYMBOL(dummyfb_get_frame_seq);
+EXPORT_SYMBOL(dummyfb_register_client);
+EXPORT_SYMBOL(dummyfb_unregister_client);
@@ -2,14 +2,27 @@
 #define DUMMYFB_DEFAULT_HEIGHT 64
 #define DUMMYFB_DEFAULT_DEPTH 24
 #define DUMMYFB_DEFAULT_REFRESH 60
+#define DUMMYFB_DEFAULT_PAGES 2
+#define DUMMYFB_MAX_PAGES 3
+#define DUMMYFB_VSYNC_TIMEOUT_MS 100
+#define DUMMYFB_MAX_WIDTH 4096
+#define DUMMYFB_MAX_HEIGHT 4096
 
+// Size of one page, the virtual framebuffer holds dummyfb_pages of them at the largest pixel size
 #define DUMMYFB_MEMSIZE (dummyfb_width * dummyfb_height * (dummyfb_depth >> 3))
+#define DUMMYFB_VIRTUAL_SIZE(width, height) PAGE_ALIGN((size_t)(width) * (height) * DUMMYFB_MAX_PIX_LEN * dummyfb_pages)
+#define DUMMYFB_VIRTUAL_MEMSIZE DUMMYFB_VIRTUAL_SIZE(dummyfb_width, dummyfb_height)
 
 static int dummy_check_var(struct fb_var_screeninfo* var, struct fb_info* info);
 static int dummy_set_par(struct fb_info* info);
 static int dummy_mmap(struct fb_info *info, struct vm_area_struct *vma);
+static int dummy_pan_display(struct fb_var_screeninfo* var, struct fb_info* info);
+static int dummy_ioctl(struct fb_info* info, unsigned int cmd, unsigned long arg);
+static void dummy_fillrect(struct fb_info* info, const struct fb_fillrect* rect);
+static void dummy_copyarea(struct fb_info* info, const struct fb_copyarea* area);
+static void dummy_imageblit(struct fb_info* info, const struct fb_image* image);
+static int dummy_open(struct fb_info* info, int user);
+static int dummy_release(struct fb_info* info, int user);
+static ssize_t dummy_write(struct fb_info* info, const char __user* buf, size_t count, loff_t* ppos);
 
-size_t dummyfb_get_fbsize(void);
-char* dummyfb_get_fbmem(void);
-void dummyfb_copy(void* buffer);
-void dummyfb_copy_part(void* buffer, size_t len);
+#include "dummyfb-client.h"
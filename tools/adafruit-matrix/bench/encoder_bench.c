@@ -0,0 +1,386 @@
+/*
+ * Benchmarks the frame pipeline of the adafruit-matrix-rpi driver on the
+ * host, built from the module sources themselves so the numbers match what
+ * the kernel runs, pixel formats included.
+ *
+ * Build:
+ *   gcc -O3 -Wall -I../../../modules/dummyfb -I../../../modules/adafruit-matrix-rpi -o encoder_bench encoder_bench.c \
+ *       ../../../modules/adafruit-matrix-rpi/encoder.c ../../../modules/adafruit-matrix-rpi/remap.c \
+ *       ../../../modules/adafruit-matrix-rpi/matrix.c
+ *
+ * Usage:
+ *   encoder_bench [-n iterations] [-f xrgb8888|rgb888|rgb565]
+ *
+ * Every combination of chain length (1-8 chained 64x32 panels, two rows of
+ * them like the default wall), bit depth (8, 7 + 1 dither, 6 + 2 dither),
+ * scan fold (1 and 2) and corpus frame is run. Reported per stage are ns per
+ * frame and throughput, plus cycles, instructions and cache misses from
+ * perf_event_open where the kernel allows it (see perf_event_paranoid).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "matrix.h"
+#include "encoder.h"
+#include "remap.h"
+#include "dummyfb-format.h"
+
+#define PANEL_WIDTH		64
+#define PANEL_HEIGHT	32
+#define PWM_BITS		8
+#define DEFAULT_ITERATIONS	200
+
+enum pattern {
+	PATTERN_BLACK = 0,
+	PATTERN_GRADIENT,
+	PATTERN_NOISE,
+	PATTERN_TEXT,
+	NUM_PATTERNS
+};
+
+static const char* const pattern_names[NUM_PATTERNS] = {"black", "gradient", "noise", "text"};
+
+// Default pinout of the driver
+static const uint32_t pins[ADAMTX_NUM_PINS] = {11, 27, 7, 8, 9, 10, 22, 23, 24, 25, 15, 18, 4, 17};
+
+enum counter {
+	COUNTER_CYCLES = 0,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CACHE_MISSES,
+	NUM_COUNTERS
+};
+
+static const uint64_t counter_configs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+
+struct stage {
+	uint64_t ns;
+	uint64_t counters[NUM_COUNTERS];
+};
+
+struct bench {
+	int width;
+	int height;
+	int columns;
+	int rows;
+	int format;
+	int pix_len;
+	int num_panels;
+	struct matrix_ledpanel panel_store[16];
+	struct matrix_ledpanel* panels[16];
+	uint32_t* remap_table;
+	void* frame;
+	uint32_t* intermediate;
+	struct adamtx_panel_io* paneldata;
+	int perf_fds[NUM_COUNTERS];
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int perf_open(uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_start(struct bench* bench)
+{
+	int i;
+	for(i = 0; i < NUM_COUNTERS; i++)
+	{
+		if(bench->perf_fds[i] < 0)
+			continue;
+		ioctl(bench->perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench->perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static void perf_stop(struct bench* bench, struct stage* stage)
+{
+	int i;
+	uint64_t value;
+	for(i = 0; i < NUM_COUNTERS; i++)
+	{
+		stage->counters[i] = 0;
+		if(bench->perf_fds[i] < 0)
+			continue;
+		ioctl(bench->perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if(read(bench->perf_fds[i], &value, sizeof(value)) == sizeof(value))
+			stage->counters[i] = value;
+	}
+}
+
+// Same corpus as the selftest of the driver, on the framebuffer instead of the chain
+static uint32_t pattern_pixel(int pattern, int x, int y, int width, int height, uint32_t* seed)
+{
+	switch(pattern)
+	{
+		case PATTERN_GRADIENT:
+			return (x * 255 / (width - 1)) << 16 | (y * 255 / (height - 1)) << 8 | ((x + y) & 0xFF);
+		case PATTERN_NOISE:
+			*seed ^= *seed << 13;
+			*seed ^= *seed >> 17;
+			*seed ^= *seed << 5;
+			return *seed & 0x00FFFFFF;
+		case PATTERN_TEXT:
+			// Blocky glyph cells, dense edges like rendered text
+			return ((x % 6) < 5 && (y % 8) < 7 && ((x * 7 + y * 3) % 5) < 2) ? 0xFF << (8 * ((y / 8) % 3)) : 0;
+	}
+	return 0;
+}
+
+static void fill_frame(struct bench* bench, int pattern)
+{
+	int x, y;
+	uint32_t rgb, seed = 0x2545F491;
+	uint8_t* pix = bench->frame;
+	for(y = 0; y < bench->height; y++)
+	{
+		for(x = 0; x < bench->width; x++)
+		{
+			rgb = pattern_pixel(pattern, x, y, bench->width, bench->height, &seed);
+			switch(bench->format)
+			{
+				case DUMMYFB_FORMAT_RGB565:
+					*(uint16_t*)pix = ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F);
+					break;
+				case DUMMYFB_FORMAT_RGB888:
+					pix[0] = rgb & 0xFF;
+					pix[1] = (rgb >> 8) & 0xFF;
+					pix[2] = (rgb >> 16) & 0xFF;
+					break;
+				default:
+					*(uint32_t*)pix = rgb;
+					break;
+			}
+			pix += bench->pix_len;
+		}
+	}
+}
+
+/*
+ * Chains of length panels, half of them in an upper row of the framebuffer
+ * flipped like the default wall. Remap table built like the driver does.
+ */
+static int setup_bench(struct bench* bench, int chain, int format)
+{
+	int i, x, y;
+	struct matrix_pos pos;
+	struct matrix_ledpanel* panel;
+	int per_row = chain > 1 ? chain / 2 : 1;
+	bench->num_panels = chain;
+	bench->columns = chain * PANEL_WIDTH;
+	bench->rows = PANEL_HEIGHT;
+	bench->width = per_row * PANEL_WIDTH;
+	bench->height = (chain > 1 ? 2 : 1) * PANEL_HEIGHT;
+	bench->format = format;
+	bench->pix_len = format == DUMMYFB_FORMAT_RGB565 ? 2 : format == DUMMYFB_FORMAT_RGB888 ? 3 : 4;
+	for(i = 0; i < chain; i++)
+	{
+		panel = &bench->panel_store[i];
+		memset(panel, 0, sizeof(*panel));
+		panel->xres = PANEL_WIDTH;
+		panel->yres = PANEL_HEIGHT;
+		panel->virtual_x = (chain - 1 - i) * PANEL_WIDTH;
+		panel->virtual_y = 0;
+		panel->realx = (i % per_row) * PANEL_WIDTH;
+		panel->realy = (i / per_row) * PANEL_HEIGHT;
+		panel->flip_x = 1;
+		bench->panels[i] = panel;
+	}
+	bench->remap_table = malloc(bench->width * bench->height * sizeof(uint32_t));
+	bench->frame = malloc(bench->width * bench->height * DUMMYFB_MAX_PIX_LEN);
+	bench->intermediate = calloc(bench->rows * bench->columns + 1, sizeof(uint32_t));
+	bench->paneldata = calloc((1 << ADAMTX_DITHER_MAX_BITS) * PWM_BITS * bench->rows / 2 * bench->columns, sizeof(struct adamtx_panel_io));
+	if(!bench->remap_table || !bench->frame || !bench->intermediate || !bench->paneldata)
+		return -1;
+	for(y = 0; y < bench->height; y++)
+	{
+		for(x = 0; x < bench->width; x++)
+		{
+			panel = matrix_get_panel_at_real(bench->panels, bench->num_panels, x, y);
+			if(panel == NULL)
+			{
+				bench->remap_table[y * bench->width + x] = bench->rows * bench->columns;
+				continue;
+			}
+			matrix_panel_get_position(&pos, panel, x, y);
+			bench->remap_table[y * bench->width + x] = pos.y * bench->columns + pos.x;
+		}
+	}
+	return 0;
+}
+
+static void free_bench(struct bench* bench)
+{
+	free(bench->remap_table);
+	free(bench->frame);
+	free(bench->intermediate);
+	free(bench->paneldata);
+}
+
+// Mirrors process_frame() of the driver, all dither frames of a full frame
+static void encode(struct bench* bench, struct adamtx_encoder* encoder, int pwm_bits, int dither_bits)
+{
+	int i;
+	struct adamtx_frame frame = {
+		.width = bench->columns,
+		.height = bench->rows,
+		.vertical_offset = 0,
+		.rows = bench->rows,
+		.frame = bench->intermediate,
+		.pwm_bits = pwm_bits,
+		.dither_bits = dither_bits,
+		.encoder = encoder
+	};
+	for(i = 0; i < 1 << dither_bits; i++)
+	{
+		frame.dither_frame = i;
+		frame.paneldata = bench->paneldata + i * pwm_bits * bench->rows / 2 * bench->columns;
+		prerender_frame_part(&frame);
+	}
+}
+
+static void print_stage(const char* name, const struct stage* stage, int iterations, double pixels)
+{
+	double ns = (double)stage->ns / iterations;
+	printf("  %-6s %10.0f ns/frame %8.1f Mpx/s", name, ns, pixels * 1000.0 / ns);
+	if(stage->counters[COUNTER_CYCLES])
+		printf(" %10.0f cycles %10.0f instructions %8.0f cache-misses",
+			(double)stage->counters[COUNTER_CYCLES] / iterations, (double)stage->counters[COUNTER_INSTRUCTIONS] / iterations,
+			(double)stage->counters[COUNTER_CACHE_MISSES] / iterations);
+	printf("\n");
+}
+
+static int run(struct bench* bench, int dither_bits, int fold, int pattern, int iterations)
+{
+	int i;
+	uint64_t start;
+	struct stage remap, prerender;
+	struct adamtx_encoder encoder;
+	int pwm_bits = PWM_BITS - dither_bits;
+	struct adamtx_scan scan = {
+		.rows = bench->rows,
+		.columns = bench->columns,
+		.addresses = bench->rows / 2 / fold,
+		.address_mode = ADAMTX_ADDRESS_DIRECT
+	};
+	if(adamtx_encoder_init(&encoder, pins, pwm_bits, &scan))
+		return -1;
+	fill_frame(bench, pattern);
+
+	perf_start(bench);
+	start = now_ns();
+	for(i = 0; i < iterations; i++)
+		remap_frame(bench->remap_table, NULL, bench->frame, bench->format, bench->width * bench->height, bench->intermediate, bench->rows * bench->columns);
+	remap.ns = now_ns() - start;
+	perf_stop(bench, &remap);
+
+	perf_start(bench);
+	start = now_ns();
+	for(i = 0; i < iterations; i++)
+		encode(bench, &encoder, pwm_bits, dither_bits);
+	prerender.ns = now_ns() - start;
+	perf_stop(bench, &prerender);
+
+	printf("%dx%d chain, %d bits + %d dither, 1/%d scan, %s:\n", bench->columns, bench->rows, pwm_bits, dither_bits, scan.addresses, pattern_names[pattern]);
+	print_stage("remap", &remap, iterations, bench->width * bench->height);
+	print_stage("encode", &prerender, iterations, bench->rows * bench->columns);
+	adamtx_encoder_free(&encoder);
+	return 0;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-f xrgb8888|rgb888|rgb565]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt, i, chain, dither_bits, fold, pattern;
+	int iterations = DEFAULT_ITERATIONS;
+	int format = DUMMYFB_FORMAT_XRGB8888;
+	struct bench bench;
+	while((opt = getopt(argc, argv, "n:f:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'f':
+				if(!strcmp(optarg, "rgb565"))
+					format = DUMMYFB_FORMAT_RGB565;
+				else if(!strcmp(optarg, "rgb888"))
+					format = DUMMYFB_FORMAT_RGB888;
+				else if(!strcmp(optarg, "xrgb8888"))
+					format = DUMMYFB_FORMAT_XRGB8888;
+				else
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(iterations <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(&bench, 0, sizeof(bench));
+	for(i = 0; i < NUM_COUNTERS; i++)
+		bench.perf_fds[i] = perf_open(counter_configs[i]);
+	if(bench.perf_fds[COUNTER_CYCLES] < 0)
+		fprintf(stderr, "perf counters unavailable, reporting time only\n");
+
+	for(chain = 1; chain <= 8; chain *= 2)
+	{
+		if(setup_bench(&bench, chain, format))
+		{
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		for(dither_bits = 0; dither_bits <= ADAMTX_DITHER_MAX_BITS; dither_bits++)
+		{
+			for(fold = 1; fold <= 2; fold++)
+			{
+				for(pattern = 0; pattern < NUM_PATTERNS; pattern++)
+				{
+					if(run(&bench, dither_bits, fold, pattern, iterations))
+						fprintf(stderr, "invalid configuration\n");
+				}
+			}
+		}
+		free_bench(&bench);
+	}
+	for(i = 0; i < NUM_COUNTERS; i++)
+	{
+		if(bench.perf_fds[i] >= 0)
+			close(bench.perf_fds[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "delay.h"
+
+#define DELAY_SHIFT		16
+#define DELAY_TSC_CALIBRATION_NS	20000000
+
+// Counter ticks per ns in fixed point, and the ns per tick the other way round
+static uint64_t delay_mult = 1 << DELAY_SHIFT;
+static uint64_t delay_div = 1 << DELAY_SHIFT;
+static unsigned long delay_spin = DELAY_MAX_SPIN_NS;
+static struct delay_stats delay_stats;
+
+static uint64_t delay_monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Cycle counter where userspace can read one, the vDSO clock elsewhere
+static inline uint64_t delay_counter(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t value;
+	asm volatile("isb; mrs %0, cntvct_el0" : "=r" (value) :: "memory");
+	return value;
+#else
+	return delay_monotonic_ns();
+#endif
+}
+
+static void delay_calibrate_counter(void)
+{
+	uint64_t freq = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t start_ns, start, end_ns, end;
+	start_ns = delay_monotonic_ns();
+	start = delay_counter();
+	do
+	{
+		end_ns = delay_monotonic_ns();
+		end = delay_counter();
+	}
+	while(end_ns - start_ns < DELAY_TSC_CALIBRATION_NS);
+	freq = (end - start) * 1000000000ULL / (end_ns - start_ns);
+#elif defined(__aarch64__)
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+#endif
+	if(freq == 0)
+		return;
+	delay_mult = (freq << DELAY_SHIFT) / 1000000000ULL;
+	delay_div = (1000000000ULL << DELAY_SHIFT) / freq;
+}
+
+static inline uint64_t delay_ns_to_ticks(uint64_t ns)
+{
+	return (ns * delay_mult) >> DELAY_SHIFT;
+}
+
+static inline uint64_t delay_ticks_to_ns(uint64_t ticks)
+{
+	return (ticks * delay_div) >> DELAY_SHIFT;
+}
+
+static int delay_compare(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// 99th percentile of the oversleep plus a margin, outliers would make every delay a spin
+static void delay_calibrate_spin(void)
+{
+	int i;
+	uint64_t late[DELAY_CALIBRATION_RUNS];
+	uint64_t deadline;
+	struct timespec ts;
+	for(i = 0; i < DELAY_CALIBRATION_RUNS; i++)
+	{
+		deadline = delay_monotonic_ns() + DELAY_CALIBRATION_NS;
+		ts.tv_sec = deadline / 1000000000ULL;
+		ts.tv_nsec = deadline % 1000000000ULL;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		late[i] = delay_monotonic_ns() - deadline;
+	}
+	qsort(late, DELAY_CALIBRATION_RUNS, sizeof(uint64_t), delay_compare);
+	delay_spin = late[DELAY_CALIBRATION_RUNS * 99 / 100] + DELAY_MARGIN_NS;
+	if(delay_spin < DELAY_MIN_SPIN_NS)
+		delay_spin = DELAY_MIN_SPIN_NS;
+	if(delay_spin > DELAY_MAX_SPIN_NS)
+		delay_spin = DELAY_MAX_SPIN_NS;
+}
+
+int delay_init(long spin_ns)
+{
+	delay_calibrate_counter();
+	if(spin_ns < 0)
+		delay_calibrate_spin();
+	else
+		delay_spin = spin_ns;
+	delay_stats_reset();
+	return 0;
+}
+
+unsigned long delay_spin_ns(void)
+{
+	return delay_spin;
+}
+
+static void delay_stats_min(int64_t* min, int64_t value)
+{
+	int64_t old = __atomic_load_n(min, __ATOMIC_RELAXED);
+	while(value < old && !__atomic_compare_exchange_n(min, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void delay_stats_max(int64_t* max, int64_t value)
+{
+	int64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
+	while(value > old && !__atomic_compare_exchange_n(max, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void delay_ns(unsigned long ns)
+{
+	uint64_t start = delay_counter();
+	uint64_t end = start + delay_ns_to_ticks(ns);
+	uint64_t deadline;
+	int64_t error;
+	struct timespec ts;
+	if(ns > delay_spin)
+	{
+		deadline = delay_monotonic_ns() + ns - delay_spin;
+		ts.tv_sec = deadline / 1000000000ULL;
+		ts.tv_nsec = deadline % 1000000000ULL;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		__atomic_add_fetch(&delay_stats.slept, 1, __ATOMIC_RELAXED);
+	}
+	while((int64_t)(delay_counter() - end) < 0);
+	error = (int64_t)delay_ticks_to_ns(delay_counter() - start) - (int64_t)ns;
+	delay_stats_min(&delay_stats.min_error, error);
+	delay_stats_max(&delay_stats.max_error, error);
+	if(error > DELAY_LATE_NS)
+		__atomic_add_fetch(&delay_stats.late, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&delay_stats.sum_error, error, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&delay_stats.calls, 1, __ATOMIC_RELAXED);
+}
+
+void delay_stats_get(struct delay_stats* stats)
+{
+	stats->calls = __atomic_load_n(&delay_stats.calls, __ATOMIC_RELAXED);
+	stats->slept = __atomic_load_n(&delay_stats.slept, __ATOMIC_RELAXED);
+	stats->late = __atomic_load_n(&delay_stats.late, __ATOMIC_RELAXED);
+	stats->min_error = __atomic_load_n(&delay_stats.min_error, __ATOMIC_RELAXED);
+	stats->max_error = __atomic_load_n(&delay_stats.max_error, __ATOMIC_RELAXED);
+	stats->sum_error = __atomic_load_n(&delay_stats.sum_error, __ATOMIC_RELAXED);
+}
+
+void delay_stats_take(struct delay_stats* stats)
+{
+	stats->calls = __atomic_exchange_n(&delay_stats.calls, 0, __ATOMIC_RELAXED);
+	stats->slept = __atomic_exchange_n(&delay_stats.slept, 0, __ATOMIC_RELAXED);
+	stats->late = __atomic_exchange_n(&delay_stats.late, 0, __ATOMIC_RELAXED);
+	stats->min_error = __atomic_exchange_n(&delay_stats.min_error, INT64_MAX, __ATOMIC_RELAXED);
+	stats->max_error = __atomic_exchange_n(&delay_stats.max_error, INT64_MIN, __ATOMIC_RELAXED);
+	stats->sum_error = __atomic_exchange_n(&delay_stats.sum_error, 0, __ATOMIC_RELAXED);
+}
+
+void delay_stats_reset(void)
+{
+	struct delay_stats stats;
+	delay_stats_take(&stats);
+}
+
+void delay_stats_print(FILE* file, const struct delay_stats* stats)
+{
+	// An interval holding nothing but part of a concurrent delay has no error range
+	if(stats->calls == 0 || stats->min_error > stats->max_error)
+	{
+		fprintf(file, "delay: no calls\n");
+		return;
+	}
+	fprintf(file, "delay: %lu calls, %lu slept, error mean %lld ns min %lld ns max %lld ns, %lu late, spin %lu ns\n",
+		stats->calls, stats->slept, (long long)(stats->sum_error / (int64_t)stats->calls),
+		(long long)stats->min_error, (long long)stats->max_error, stats->late, delay_spin);
+}
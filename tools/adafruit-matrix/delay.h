@@ -0,0 +1,55 @@
+#ifndef _DELAY_H
+#define _DELAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Sleeps shorter than the spin threshold busy-wait entirely
+#define DELAY_CALIBRATION_RUNS	200
+#define DELAY_CALIBRATION_NS	100000
+#define DELAY_MARGIN_NS			5000
+#define DELAY_MIN_SPIN_NS		2000
+#define DELAY_MAX_SPIN_NS		2000000
+// Errors above this are counted as late
+#define DELAY_LATE_NS			1000
+
+struct delay_stats {
+	unsigned long calls;
+	unsigned long slept;
+	unsigned long late;
+	int64_t min_error;
+	int64_t max_error;
+	int64_t sum_error;
+};
+
+/*
+ * Calibrates the cycle counter and, for spin_ns < 0, the spin threshold from
+ * the wakeup latency of clock_nanosleep(). Must be called before delay_ns().
+ */
+int delay_init(long spin_ns);
+
+// Spin threshold in use
+unsigned long delay_spin_ns(void);
+
+/*
+ * Waits ns nanoseconds, sleeping with clock_nanosleep(TIMER_ABSTIME) up to the
+ * spin threshold before the deadline and spinning on the cycle counter for
+ * the rest.
+ */
+void delay_ns(unsigned long ns);
+
+/*
+ * Statistics are atomic per field, any thread may read them while another
+ * one delays. A delay running concurrently may land in different intervals
+ * for different fields.
+ */
+void delay_stats_get(struct delay_stats* stats);
+
+// Reads the statistics and starts a new interval without losing a delay in between
+void delay_stats_take(struct delay_stats* stats);
+
+void delay_stats_reset(void);
+
+void delay_stats_print(FILE* file, const struct delay_stats* stats);
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * Compiles RGB frames into a container of pre-encoded bitplanes that the
+ * adafruit-matrix-rpi driver plays without any per frame work, either as
+ * firmware (firmware= module parameter, adafruit,firmware property) or by
+ * writing it to /dev/adamtxN.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I../../modules/adafruit-matrix-rpi -o frame_compiler \
+ *       frame_compiler.c topology.c matrix.c ../../modules/adafruit-matrix-rpi/encoder.c
+ *
+ * Usage:
+ *   frame_compiler -t topology -o frames.bin [-d duration_us] [-l once|repeat|pingpong] frame[@duration_us]...
+ *
+ * Frames are binary PPM (P6) or raw RGB files, width * height * 3 bytes each.
+ * A raw file may hold several frames back to back. The topology file must
+ * describe the display exactly like its device tree node:
+ *
+ *   pinout 11 27 7 8 9 10 22 23 24 25 15 18 4 17
+ *   scan 16
+ *   address-mode direct
+ *   zigzag 0 0
+ *   dither-bits 0
+ *   panel upper 64 32 64 0 0 0 flip-x
+ *   panel lower 64 32 0 0 0 32 flip-x
+ *
+ * Panels are given as name xres yres chain-x chain-y fb-x fb-y [flip-x] [flip-y]
+ * [gain=r,g,b]. The gain is the panel's adafruit,color-gain, it is applied
+ * here since the driver plays compiled frames as they are.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include "matrix.h"
+#include "encoder.h"
+#include "topology.h"
+#include "adafruit-matrix-frames.h"
+
+#define PWM_BITS	8
+#define PIX_LEN		3
+
+struct compiler {
+	struct topology topology;
+	struct adamtx_encoder encoder;
+	int pwm_bits;
+	int dither_frames;
+	size_t frame_len;
+	uint8_t gain_lut[MAX_PANELS * ADAMTX_GAIN_LUT_LEN];
+	uint32_t* intermediate;
+	struct adamtx_panel_io* paneldata;
+	FILE* out;
+	unsigned int num_frames;
+};
+
+// Same as remap_frame in the driver including the color gains, input is RGB and converted to the framebuffer's BGR
+static void remap(struct compiler* compiler, const unsigned char* rgb)
+{
+	int x, y;
+	const unsigned char* pixel;
+	struct matrix_ledpanel* panel;
+	struct matrix_pos pos;
+	struct topology* topology = &compiler->topology;
+	for(y = 0; y < topology->height; y++)
+	{
+		for(x = 0; x < topology->width; x++)
+		{
+			panel = matrix_get_panel_at_real(topology->panels, topology->num_panels, x, y);
+			if(panel == NULL)
+				continue;
+			matrix_panel_get_position(&pos, panel, x, y);
+			pixel = rgb + (y * topology->width + x) * PIX_LEN;
+			compiler->intermediate[pos.y * topology->scan.columns + pos.x] = adamtx_gain_apply(compiler->gain_lut + (panel - topology->panel_store) * ADAMTX_GAIN_LUT_LEN,
+				pixel[2] | pixel[1] << 8 | pixel[0] << 16);
+		}
+	}
+}
+
+static int emit_frame(struct compiler* compiler, const unsigned char* rgb, unsigned int duration_us)
+{
+	int i;
+	size_t j;
+	struct adamtx_frames_entry entry = {
+		.duration_us = htole32(duration_us),
+		.reserved = 0
+	};
+	struct topology* topology = &compiler->topology;
+	size_t plane_len = compiler->frame_len / compiler->dither_frames;
+	struct adamtx_frame frame = {
+		.width = topology->scan.columns,
+		.height = topology->scan.rows,
+		.vertical_offset = 0,
+		.rows = topology->scan.rows,
+		.pwm_bits = compiler->pwm_bits,
+		.dither_bits = topology->dither_bits,
+		.encoder = &compiler->encoder,
+		.frame = compiler->intermediate
+	};
+
+	memset(compiler->intermediate, 0, topology->scan.rows * topology->scan.columns * sizeof(uint32_t));
+	remap(compiler, rgb);
+	for(i = 0; i < compiler->dither_frames; i++)
+	{
+		frame.dither_frame = i;
+		frame.paneldata = compiler->paneldata + i * plane_len;
+		prerender_frame_part(&frame);
+	}
+	for(j = 0; j < compiler->frame_len; j++)
+		compiler->paneldata[j].gpios = htole32(compiler->paneldata[j].gpios);
+	if(fwrite(&entry, sizeof(entry), 1, compiler->out) != 1 ||
+		fwrite(compiler->paneldata, sizeof(struct adamtx_panel_io), compiler->frame_len, compiler->out) != compiler->frame_len)
+		return -1;
+	compiler->num_frames++;
+	return 0;
+}
+
+// Skips PPM whitespace and comments
+static void ppm_skip(FILE* file)
+{
+	int c;
+	while((c = fgetc(file)) != EOF)
+	{
+		if(c == '#')
+		{
+			while((c = fgetc(file)) != EOF && c != '\n');
+		}
+		else if(c != ' ' && c != '\t' && c != '\n' && c != '\r')
+		{
+			ungetc(c, file);
+			return;
+		}
+	}
+}
+
+static int compile_file(struct compiler* compiler, char* arg, unsigned int duration_us)
+{
+	int width, height, maxval, ret = 0, frames = 0;
+	size_t framesize = compiler->topology.width * compiler->topology.height * PIX_LEN;
+	unsigned char* rgb;
+	char magic[2];
+	char* duration = strrchr(arg, '@');
+	FILE* file;
+	if(duration)
+	{
+		*duration = '\0';
+		duration_us = strtoul(duration + 1, NULL, 10);
+	}
+	file = fopen(arg, "rb");
+	if(file == NULL)
+	{
+		perror(arg);
+		return -1;
+	}
+	rgb = malloc(framesize);
+	if(rgb == NULL)
+	{
+		ret = -1;
+		goto exit_file;
+	}
+	if(fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && magic[1] == '6')
+	{
+		ppm_skip(file);
+		if(fscanf(file, "%d", &width) != 1)
+			goto exit_format;
+		ppm_skip(file);
+		if(fscanf(file, "%d", &height) != 1)
+			goto exit_format;
+		ppm_skip(file);
+		if(fscanf(file, "%d", &maxval) != 1 || fgetc(file) == EOF)
+			goto exit_format;
+		if(width != compiler->topology.width || height != compiler->topology.height || maxval != 255)
+		{
+			fprintf(stderr, "%s: need a %dx%d image with 8 bit channels\n", arg, compiler->topology.width, compiler->topology.height);
+			ret = -1;
+			goto exit_rgb;
+		}
+	}
+	else
+		rewind(file);
+	while(fread(rgb, 1, framesize, file) == framesize)
+	{
+		if((ret = emit_frame(compiler, rgb, duration_us)))
+			goto exit_rgb;
+		frames++;
+	}
+	if(frames == 0)
+	{
+		fprintf(stderr, "%s: no complete %dx%d frame\n", arg, compiler->topology.width, compiler->topology.height);
+		ret = -1;
+	}
+	goto exit_rgb;
+
+exit_format:
+	fprintf(stderr, "%s: invalid PPM header\n", arg);
+	ret = -1;
+exit_rgb:
+	free(rgb);
+exit_file:
+	fclose(file);
+	return ret;
+}
+
+static int write_header(struct compiler* compiler, int loop_mode)
+{
+	int i;
+	struct topology* topology = &compiler->topology;
+	struct adamtx_frames_header header = {
+		.magic = htole32(ADAMTX_FRAMES_MAGIC),
+		.version = htole32(ADAMTX_FRAMES_VERSION),
+		.header_size = htole32(sizeof(struct adamtx_frames_header)),
+		.rows = htole32(topology->scan.rows),
+		.columns = htole32(topology->scan.columns),
+		.addresses = htole32(topology->scan.addresses),
+		.shift_len = htole32(compiler->encoder.shift_len),
+		.address_mode = htole32(topology->scan.address_mode),
+		.pwm_bits = htole32(compiler->pwm_bits),
+		.dither_frames = htole32(compiler->dither_frames),
+		.loop_mode = htole32(loop_mode),
+		.num_frames = htole32(compiler->num_frames),
+		.frame_size = htole32(compiler->frame_len * sizeof(struct adamtx_panel_io))
+	};
+	for(i = 0; i < ADAMTX_NUM_PINS; i++)
+		header.pins[i] = htole32(topology->pins[i]);
+	rewind(compiler->out);
+	return fwrite(&header, sizeof(header), 1, compiler->out) == 1 ? 0 : -1;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s -t topology -o output [-d duration_us] [-l once|repeat|pingpong] frame[@duration_us]...\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt, err, ret = 1;
+	int loop_mode = 1;
+	unsigned int duration_us = 33333;
+	const char* topology_path = NULL;
+	const char* output_path = NULL;
+	struct compiler compiler;
+	struct adamtx_frames_header placeholder;
+
+	memset(&compiler, 0, sizeof(compiler));
+	while((opt = getopt(argc, argv, "t:o:d:l:")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				topology_path = optarg;
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			case 'd':
+				duration_us = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				if(!strcmp(optarg, "once"))
+					loop_mode = 0;
+				else if(!strcmp(optarg, "repeat"))
+					loop_mode = 1;
+				else if(!strcmp(optarg, "pingpong"))
+					loop_mode = 2;
+				else
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(topology_path == NULL || output_path == NULL || optind >= argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(parse_topology(&compiler.topology, topology_path))
+		return 1;
+	topology_gain_tables(&compiler.topology, compiler.gain_lut, NULL);
+	compiler.pwm_bits = PWM_BITS - compiler.topology.dither_bits;
+	compiler.dither_frames = 1 << compiler.topology.dither_bits;
+	if((err = adamtx_encoder_init(&compiler.encoder, compiler.topology.pins, compiler.pwm_bits, &compiler.topology.scan)))
+	{
+		fprintf(stderr, "Invalid pinout or scan configuration (%d)\n", err);
+		return 1;
+	}
+	compiler.frame_len = compiler.dither_frames * compiler.pwm_bits * compiler.topology.scan.rows / 2 * compiler.topology.scan.columns;
+	compiler.intermediate = malloc(compiler.topology.scan.rows * compiler.topology.scan.columns * sizeof(uint32_t));
+	compiler.paneldata = malloc(compiler.frame_len * sizeof(struct adamtx_panel_io));
+	if(compiler.intermediate == NULL || compiler.paneldata == NULL)
+		goto exit_encoder;
+
+	compiler.out = fopen(output_path, "wb");
+	if(compiler.out == NULL)
+	{
+		perror(output_path);
+		goto exit_encoder;
+	}
+	// Frame count is only known at the end
+	memset(&placeholder, 0, sizeof(placeholder));
+	if(fwrite(&placeholder, sizeof(placeholder), 1, compiler.out) != 1)
+		goto exit_out;
+	for(; optind < argc; optind++)
+	{
+		if(compile_file(&compiler, argv[optind], duration_us))
+			goto exit_out;
+	}
+	if(write_header(&compiler, loop_mode))
+		goto exit_out;
+	printf("%u frames of %zu bytes, %dx%d display, 1/%d scan\n", compiler.num_frames, compiler.frame_len * sizeof(struct adamtx_panel_io),
+		compiler.topology.width, compiler.topology.height, compiler.topology.scan.addresses);
+	ret = 0;
+
+exit_out:
+	if(fclose(compiler.out))
+		ret = 1;
+	if(ret)
+		unlink(output_path);
+exit_encoder:
+	free(compiler.paneldata);
+	free(compiler.intermediate);
+	adamtx_encoder_free(&compiler.encoder);
+	return ret;
+}
@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "io.h"
 
@@ -24,27 +25,164 @@ const uint32_t valid_gpio_bits = ((1 <<  0) | (1 <<  1) | // RPi 1 - Revision 1
    (1 <<  5) | (1 <<  6) | (1 << 12) | (1 << 13) | (1 << 16) |
    (1 << 19) | (1 << 20) | (1 << 21) | (1 << 26));
 
-int llgpio_init()
+struct llgpio_backend {
+	const char* name;
+	uint32_t* (*map)(const char* arg);
+	void (*unmap)(uint32_t* map);
+};
+
+static const struct llgpio_backend* llgpio_active = NULL;
+
+static uint32_t* llgpio_map_file(const char* path, off_t offset, int flags)
+{
+	uint32_t* map;
+	int fd = open(path, flags);
+	if(fd < 0)
+	{
+		perror(path);
+		return NULL;
+	}
+	map = mmap(NULL, REGISTER_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		perror(path);
+		return NULL;
+	}
+	return map;
+}
+
+static void llgpio_unmap_file(uint32_t* map)
+{
+	munmap(map, REGISTER_BLOCK_SIZE);
+}
+
+// Only the GPIO block is exposed, no root needed
+static uint32_t* llgpio_map_gpiomem(const char* arg)
+{
+	return llgpio_map_file(arg ? arg : "/dev/gpiomem", 0, O_RDWR | O_SYNC);
+}
+
+/*
+ * Peripheral base from the bus to CPU mapping of the soc node, the second
+ * cell of ranges or the third one where the CPU address takes two cells.
+ */
+static off_t llgpio_peripheral_base()
+{
+	unsigned char ranges[12];
+	uint32_t base;
+	size_t len;
+	FILE* file = fopen("/proc/device-tree/soc/ranges", "rb");
+	if(file == NULL)
+		return PERIPHERAL_BASE;
+	len = fread(ranges, 1, sizeof(ranges), file);
+	fclose(file);
+	if(len < 8)
+		return PERIPHERAL_BASE;
+	base = ranges[4] << 24 | ranges[5] << 16 | ranges[6] << 8 | ranges[7];
+	if(base == 0 && len >= 12)
+		base = ranges[8] << 24 | ranges[9] << 16 | ranges[10] << 8 | ranges[11];
+	return base ? base : PERIPHERAL_BASE;
+}
+
+static uint32_t* llgpio_map_mem(const char* arg)
+{
+	off_t base = arg ? strtoul(arg, NULL, 0) : llgpio_peripheral_base();
+	return llgpio_map_file("/dev/mem", base + GPIO_OFFSET, O_RDWR | O_SYNC);
+}
+
+/*
+ * Register block in memory, or in a file other processes can map to watch
+ * the writes. Registers keep the last value written, there is no pin state.
+ */
+static uint32_t* llgpio_map_sim(const char* arg)
 {
-	int mem = open("/dev/mem", O_RDWR | O_SYNC);
-	if(mem < 0)
+	int fd;
+	uint32_t* map;
+	if(arg == NULL)
 	{
-		perror("Failed to open /dev/mem");
-		return mem;
+		map = mmap(NULL, REGISTER_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return map == MAP_FAILED ? NULL : map;
 	}
-	uint32_t* map = (uint32_t*) mmap(NULL, REGISTER_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem, PERIPHERAL_BASE + GPIO_OFFSET);
-	close(mem);
-	if(mem == MAP_FAILED)
+	fd = open(arg, O_RDWR | O_CREAT, 0644);
+	if(fd < 0 || ftruncate(fd, REGISTER_BLOCK_SIZE))
 	{
-		perror("Failed to map gpio");
-		return -EFAULT;
+		perror(arg);
+		if(fd >= 0)
+			close(fd);
+		return NULL;
 	}
+	close(fd);
+	return llgpio_map_file(arg, 0, O_RDWR);
+}
+
+static const struct llgpio_backend llgpio_backends[LLGPIO_NUM_BACKENDS] = {
+	[LLGPIO_GPIOMEM] =	{ "gpiomem",	llgpio_map_gpiomem,	llgpio_unmap_file },
+	[LLGPIO_MEM] =		{ "mem",		llgpio_map_mem,		llgpio_unmap_file },
+	[LLGPIO_SIM] =		{ "sim",		llgpio_map_sim,		llgpio_unmap_file }
+};
+
+int llgpio_open(int backend, const char* arg)
+{
+	uint32_t* map;
+	if(backend == LLGPIO_AUTO)
+	{
+		if(llgpio_open(LLGPIO_GPIOMEM, NULL) == 0)
+			return 0;
+		return llgpio_open(LLGPIO_MEM, NULL);
+	}
+	if(backend < 0 || backend >= LLGPIO_NUM_BACKENDS || llgpio_backends[backend].name == NULL)
+		return -EINVAL;
+	llgpio_close();
+	map = llgpio_backends[backend].map(arg);
+	if(map == NULL)
+		return -EIO;
+	llgpio_active = &llgpio_backends[backend];
 	gpio_map = map;
 	gpio_set = map + GPIO_SET_OFFSET;
 	gpio_clr = map + GPIO_CLR_OFFSET;
 	return 0;
 }
 
+void llgpio_close()
+{
+	if(llgpio_active == NULL)
+		return;
+	llgpio_active->unmap(gpio_map);
+	llgpio_active = NULL;
+	gpio_map = gpio_set = gpio_clr = NULL;
+}
+
+const char* llgpio_backend_name()
+{
+	return llgpio_active ? llgpio_active->name : "none";
+}
+
+// ADAMTX_GPIO selects the backend as name[:argument], e.g. sim:/tmp/gpio or mem:0xFE000000
+int llgpio_init()
+{
+	int i;
+	size_t len;
+	const char* arg;
+	const char* env = getenv(LLGPIO_ENV);
+	if(env == NULL || *env == '\0')
+		return llgpio_open(LLGPIO_AUTO, NULL);
+	arg = strchr(env, ':');
+	len = arg ? (size_t)(arg - env) : strlen(env);
+	for(i = 0; i < LLGPIO_NUM_BACKENDS; i++)
+	{
+		if(llgpio_backends[i].name && strlen(llgpio_backends[i].name) == len && !strncmp(env, llgpio_backends[i].name, len))
+			return llgpio_open(i, arg ? arg + 1 : NULL);
+	}
+	fprintf(stderr, "%s: unknown gpio backend %s\n", LLGPIO_ENV, env);
+	return -EINVAL;
+}
+
+int llgpio_init_sim()
+{
+	return llgpio_open(LLGPIO_SIM, NULL);
+}
+
 void gpio_set_outputs(uint32_t outputs)
 {
 	outputs &= valid_gpio_bits;
@@ -9,13 +9,34 @@
 #define INP_GPIO(g) *(gpio_map+((g)/10)) &= ~(7<<(((g)%10)*3))
 #define OUT_GPIO(g) *(gpio_map+((g)/10)) |=  (1<<(((g)%10)*3))
 
-uint32_t* gpio_set;
-uint32_t* gpio_clr;
+extern uint32_t* gpio_set;
+extern uint32_t* gpio_clr;
 
-const uint32_t valid_gpio_bits;
+extern const uint32_t valid_gpio_bits;
 
+// Register block providers, all map the GPIO block of the BCM283x layout
+enum llgpio_backend_id {
+	LLGPIO_AUTO = -1,	// gpiomem, then mem
+	LLGPIO_GPIOMEM = 0,	// /dev/gpiomem or the given device
+	LLGPIO_MEM,			// /dev/mem at the peripheral base from the device tree or the given one
+	LLGPIO_SIM,			// Anonymous memory or the given file
+	LLGPIO_NUM_BACKENDS
+};
+
+#define LLGPIO_ENV	"ADAMTX_GPIO"
+
+int llgpio_open(int backend, const char* arg);
+
+void llgpio_close();
+
+const char* llgpio_backend_name();
+
+// Backend from the environment (see LLGPIO_ENV), automatic without
 int llgpio_init();
 
+// Headless operation, writes go to a register block in memory
+int llgpio_init_sim();
+
 void gpio_set_outputs(uint32_t outputs);
 
 void gpio_set_bits(uint32_t value);
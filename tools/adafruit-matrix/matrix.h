@@ -1,3 +1,6 @@
+#ifndef _MATRIX_H
+#define _MATRIX_H
+
 typedef struct matrix_ledpanel
 {
 	char* name;
@@ -9,6 +12,8 @@ typedef struct matrix_ledpanel
 	int	realy;
 	int	flip_x : 1;
 	int	flip_y : 1;
+	// Color gains, 255 keeps a channel as is
+	unsigned char gain[3];
 };
 
 typedef struct matrix_pos
@@ -29,3 +34,4 @@ void matrix_panel_get_local_position(struct matrix_pos* pos, struct matrix_ledpa
 
 void matrix_panel_get_position(struct matrix_pos* pos, struct matrix_ledpanel* panel, int x, int y);
 
+#endif
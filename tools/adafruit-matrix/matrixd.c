@@ -0,0 +1,533 @@
+/*
+ * Userspace display daemon, a fallback for kernels the adafruit-matrix-rpi
+ * module can't be loaded on. Frames come from a shared memory ring (see
+ * matrixd.h) or as raw RGB on stdin, are encoded on worker threads with the
+ * driver's encoder and refreshed with the driver's GPIO sequence from a
+ * SCHED_FIFO thread. All memory is locked.
+ *
+ * Build:
+ *   gcc -O2 -Wall -pthread -I../../modules/adafruit-matrix-rpi -o matrixd matrixd.c topology.c matrix.c io.c delay.c \
+ *       ../../modules/adafruit-matrix-rpi/encoder.c ../../modules/adafruit-matrix-rpi/refresh.c -lrt
+ *
+ * Usage:
+ *   matrixd -t topology [-i shm|pipe] [-n shm_name] [-j workers] [-p priority] [-c cpu] [-s] [-v]
+ *
+ * The topology file is the one of frame_compiler, panel color gains are
+ * applied while remapping as in the driver. Frames are display sized,
+ * width * height * 3 bytes. -s runs headless against GPIO registers in
+ * memory, e.g. to test producers, -v prints rates and BCM delay accuracy
+ * once per second. Without -s the register access comes from ADAMTX_GPIO
+ * (gpiomem, mem[:base] or sim[:file]), /dev/gpiomem then /dev/mem if unset.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "io.h"
+#include "matrix.h"
+#include "encoder.h"
+#include "refresh.h"
+#include "topology.h"
+#include "matrixd.h"
+#include "delay.h"
+
+#define PWM_BITS			8
+#define DEFAULT_WORKERS		2
+#define DEFAULT_PRIORITY	50
+#define MAX_WORKERS			16
+#define INPUT_POLL_US		500
+// Stacks are locked too, keep them small
+#define THREAD_STACK_SIZE	(256 * 1024)
+
+// Triple buffering, the ready slot carries a flag once it holds an unseen frame
+#define NUM_BUFFERS			3
+#define BUFFER_NEW			4
+
+enum input_mode {
+	INPUT_SHM = 0,
+	INPUT_PIPE
+};
+
+struct worker {
+	struct matrixd* matrixd;
+	pthread_t thread;
+	int first_address;
+	int last_address;
+	// Workers encode concurrently, each needs its own line scratch
+	uint32_t* lines;
+};
+
+struct matrixd {
+	struct topology topology;
+	struct adamtx_encoder encoder;
+	int pwm_bits;
+	int dither_frames;
+	size_t plane_len;
+	uint32_t* remap_table;
+	// NULL if no panel is calibrated
+	uint8_t* gain_lut;
+	uint16_t* gain_map;
+	uint32_t* intermediate;
+	struct adamtx_panel_io* buffers[NUM_BUFFERS];
+	int back;
+	int ready;
+	int num_workers;
+	struct worker workers[MAX_WORKERS];
+	pthread_barrier_t start;
+	pthread_barrier_t done;
+	// Only written by the main thread, run may change between the barrier and the check
+	int stop;
+	struct matrixd_ring* ring;
+	size_t ring_size;
+	unsigned long refreshes;
+	unsigned long frames;
+	unsigned long dropped;
+};
+
+static volatile sig_atomic_t run = 1;
+
+static void signalhandler(int sig)
+{
+	run = 0;
+}
+
+// refresh.c drives the panel through the driver's io interface, mapped onto io.c here
+
+void adamtx_gpio_set_bits(uint32_t value)
+{
+	gpio_set_bits(value);
+}
+
+void adamtx_gpio_clr_bits(uint32_t value)
+{
+	gpio_clr_bits(value);
+}
+
+void adamtx_gpio_write_masked_bits(uint32_t value, uint32_t mask)
+{
+	gpio_write_masked_bits(value, mask);
+}
+
+void ndelay(unsigned long ns)
+{
+	delay_ns(ns);
+}
+
+// Same split as process_frame() of the driver, every worker encodes whole addresses
+static void* encode_worker(void* arg)
+{
+	int i;
+	struct worker* worker = arg;
+	struct matrixd* matrixd = worker->matrixd;
+	struct topology* topology = &matrixd->topology;
+	int fold = matrixd->encoder.fold;
+	struct adamtx_frame part = {
+		.width = topology->scan.columns,
+		.height = topology->scan.rows,
+		.vertical_offset = worker->first_address * 2 * fold,
+		.rows = (worker->last_address - worker->first_address) * 2 * fold,
+		.pwm_bits = matrixd->pwm_bits,
+		.dither_bits = topology->dither_bits,
+		.encoder = &matrixd->encoder,
+		.frame = matrixd->intermediate,
+		.lines = worker->lines
+	};
+	while(1)
+	{
+		pthread_barrier_wait(&matrixd->start);
+		if(matrixd->stop)
+			break;
+		for(i = 0; i < matrixd->dither_frames; i++)
+		{
+			part.dither_frame = i;
+			part.paneldata = matrixd->buffers[matrixd->back] + i * matrixd->plane_len;
+			prerender_frame_part(&part);
+		}
+		pthread_barrier_wait(&matrixd->done);
+	}
+	return NULL;
+}
+
+static void process_frame(struct matrixd* matrixd, const uint8_t* rgb)
+{
+	int i;
+	uint32_t value;
+	const uint8_t* pixel;
+	struct topology* topology = &matrixd->topology;
+	for(i = 0; i < topology->width * topology->height; i++)
+	{
+		pixel = rgb + i * MATRIXD_PIX_LEN;
+		value = pixel[0] << 16 | pixel[1] << 8 | pixel[2];
+		if(matrixd->gain_map)
+			value = adamtx_gain_apply(matrixd->gain_lut + matrixd->gain_map[i] * ADAMTX_GAIN_LUT_LEN, value);
+		matrixd->intermediate[matrixd->remap_table[i]] = value;
+	}
+	pthread_barrier_wait(&matrixd->start);
+	pthread_barrier_wait(&matrixd->done);
+	matrixd->back = __atomic_exchange_n(&matrixd->ready, matrixd->back | BUFFER_NEW, __ATOMIC_ACQ_REL) & ~BUFFER_NEW;
+	__atomic_add_fetch(&matrixd->frames, 1, __ATOMIC_RELAXED);
+}
+
+static void* refresh_thread(void* arg)
+{
+	struct matrixd* matrixd = arg;
+	int front = 0, dither_frame = 0;
+	while(run)
+	{
+		if(__atomic_load_n(&matrixd->ready, __ATOMIC_ACQUIRE) & BUFFER_NEW)
+			front = __atomic_exchange_n(&matrixd->ready, front, __ATOMIC_ACQ_REL) & ~BUFFER_NEW;
+		show_frame(0, &matrixd->encoder, matrixd->buffers[front] + dither_frame * matrixd->plane_len, matrixd->pwm_bits, ADAMTX_POWER_SCALE_OFF);
+		dither_frame = (dither_frame + 1) % matrixd->dither_frames;
+		__atomic_add_fetch(&matrixd->refreshes, 1, __ATOMIC_RELAXED);
+	}
+	// Leave the panel dark
+	gpio_set_bits(matrixd->encoder.oe);
+	return NULL;
+}
+
+static void* stats_thread(void* arg)
+{
+	struct matrixd* matrixd = arg;
+	unsigned long refreshes, frames, dropped;
+	struct delay_stats delays;
+	while(run)
+	{
+		sleep(1);
+		refreshes = __atomic_exchange_n(&matrixd->refreshes, 0, __ATOMIC_RELAXED);
+		frames = __atomic_exchange_n(&matrixd->frames, 0, __ATOMIC_RELAXED);
+		dropped = __atomic_exchange_n(&matrixd->dropped, 0, __ATOMIC_RELAXED);
+		printf("%lu refreshes/s, %lu frames/s, %lu dropped\n", refreshes, frames, dropped);
+		delay_stats_take(&delays);
+		delay_stats_print(stdout, &delays);
+		fflush(stdout);
+	}
+	return NULL;
+}
+
+static int open_ring(struct matrixd* matrixd, const char* name)
+{
+	int fd;
+	struct topology* topology = &matrixd->topology;
+	matrixd->ring_size = MATRIXD_RING_SIZE(topology->width, topology->height);
+	fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+	if(fd < 0)
+	{
+		perror(name);
+		return -1;
+	}
+	if(ftruncate(fd, matrixd->ring_size))
+	{
+		perror(name);
+		close(fd);
+		return -1;
+	}
+	matrixd->ring = mmap(NULL, matrixd->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(matrixd->ring == MAP_FAILED)
+	{
+		perror(name);
+		matrixd->ring = NULL;
+		return -1;
+	}
+	matrixd->ring->width = topology->width;
+	matrixd->ring->height = topology->height;
+	matrixd->ring->slots = MATRIXD_RING_SLOTS;
+	matrixd->ring->frame_size = topology->width * topology->height * MATRIXD_PIX_LEN;
+	matrixd->ring->version = MATRIXD_RING_VERSION;
+	__atomic_store_n(&matrixd->ring->write_seq, 0, __ATOMIC_RELAXED);
+	// Producers check the magic last
+	__atomic_store_n(&matrixd->ring->magic, MATRIXD_RING_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void read_ring(struct matrixd* matrixd, uint8_t* rgb)
+{
+	uint64_t seq, last_seq = 0, now_seq;
+	struct matrixd_ring* ring = matrixd->ring;
+	// The header is writable by any producer, its geometry is never read back
+	size_t frame_size = matrixd->topology.width * matrixd->topology.height * MATRIXD_PIX_LEN;
+	while(run)
+	{
+		seq = __atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE);
+		if(seq == last_seq)
+		{
+			usleep(INPUT_POLL_US);
+			continue;
+		}
+		memcpy(rgb, ring->frames + (seq - 1) % MATRIXD_RING_SLOTS * frame_size, frame_size);
+		// The slot is rewritten once the producer is a whole ring ahead. An acquire load only orders
+		// later accesses, the fence keeps the copy's reads from moving past the re-read
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		now_seq = __atomic_load_n(&ring->write_seq, __ATOMIC_RELAXED);
+		if(now_seq - seq + 1 >= MATRIXD_RING_SLOTS)
+			continue;
+		if(last_seq && seq - last_seq > 1)
+			__atomic_add_fetch(&matrixd->dropped, seq - last_seq - 1, __ATOMIC_RELAXED);
+		last_seq = seq;
+		process_frame(matrixd, rgb);
+	}
+}
+
+static void read_pipe(struct matrixd* matrixd, uint8_t* rgb)
+{
+	size_t len, framesize = matrixd->topology.width * matrixd->topology.height * MATRIXD_PIX_LEN;
+	while(run)
+	{
+		len = fread(rgb, 1, framesize, stdin);
+		if(len == framesize)
+		{
+			process_frame(matrixd, rgb);
+			continue;
+		}
+		// Keep showing the last frame until stopped
+		if(feof(stdin))
+		{
+			while(run)
+				pause();
+		}
+		clearerr(stdin);
+	}
+}
+
+static int start_refresh_thread(pthread_t* thread, struct matrixd* matrixd, int priority, int cpu)
+{
+	int err;
+	pthread_attr_t attr;
+	struct sched_param param = { .sched_priority = priority };
+	cpu_set_t cpus;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+	if(cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	err = pthread_create(thread, &attr, refresh_thread, matrixd);
+	if(err == EPERM)
+	{
+		fprintf(stderr, "No permission for SCHED_FIFO, refreshing with normal priority\n");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		err = pthread_create(thread, &attr, refresh_thread, matrixd);
+	}
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s -t topology [-i shm|pipe] [-n shm_name] [-j workers] [-p priority] [-c cpu] [-s] [-v]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt, i, err, ret = 1;
+	int input = INPUT_SHM, priority = DEFAULT_PRIORITY, cpu = -1, sim = 0, verbose = 0;
+	const char* topology_path = NULL;
+	const char* shm_name = MATRIXD_SHM_NAME;
+	size_t buffer_len;
+	uint8_t* rgb = NULL;
+	pthread_t refresh, stats;
+	pthread_attr_t attr;
+	struct sigaction action;
+	struct matrixd* matrixd = calloc(1, sizeof(struct matrixd));
+	if(matrixd == NULL)
+		return 1;
+	matrixd->num_workers = DEFAULT_WORKERS;
+	while((opt = getopt(argc, argv, "t:i:n:j:p:c:sv")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				topology_path = optarg;
+				break;
+			case 'i':
+				if(!strcmp(optarg, "shm"))
+					input = INPUT_SHM;
+				else if(!strcmp(optarg, "pipe"))
+					input = INPUT_PIPE;
+				else
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'n':
+				shm_name = optarg;
+				break;
+			case 'j':
+				matrixd->num_workers = atoi(optarg);
+				break;
+			case 'p':
+				priority = atoi(optarg);
+				break;
+			case 'c':
+				cpu = atoi(optarg);
+				break;
+			case 's':
+				sim = 1;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(topology_path == NULL || matrixd->num_workers < 1 || matrixd->num_workers > MAX_WORKERS)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(parse_topology(&matrixd->topology, topology_path))
+		return 1;
+	matrixd->pwm_bits = PWM_BITS - matrixd->topology.dither_bits;
+	matrixd->dither_frames = 1 << matrixd->topology.dither_bits;
+	if((err = adamtx_encoder_init(&matrixd->encoder, matrixd->topology.pins, matrixd->pwm_bits, &matrixd->topology.scan)))
+	{
+		fprintf(stderr, "Invalid pinout or scan configuration (%d)\n", err);
+		return 1;
+	}
+	if(matrixd->num_workers > matrixd->topology.scan.addresses)
+		matrixd->num_workers = matrixd->topology.scan.addresses;
+
+	matrixd->plane_len = matrixd->pwm_bits * matrixd->topology.scan.rows / 2 * matrixd->topology.scan.columns;
+	buffer_len = matrixd->dither_frames * matrixd->plane_len;
+	matrixd->remap_table = malloc(matrixd->topology.width * matrixd->topology.height * sizeof(uint32_t));
+	matrixd->intermediate = calloc(matrixd->topology.scan.rows * matrixd->topology.scan.columns + 1, sizeof(uint32_t));
+	rgb = calloc(matrixd->topology.width * matrixd->topology.height, MATRIXD_PIX_LEN);
+	if(matrixd->remap_table == NULL || matrixd->intermediate == NULL || rgb == NULL)
+		goto exit_buffers;
+	for(i = 0; i < NUM_BUFFERS; i++)
+	{
+		matrixd->buffers[i] = calloc(buffer_len, sizeof(struct adamtx_panel_io));
+		if(matrixd->buffers[i] == NULL)
+			goto exit_buffers;
+	}
+	topology_remap_table(&matrixd->topology, matrixd->remap_table);
+	if(topology_calibrated(&matrixd->topology))
+	{
+		matrixd->gain_lut = malloc(matrixd->topology.num_panels * ADAMTX_GAIN_LUT_LEN);
+		matrixd->gain_map = malloc(matrixd->topology.width * matrixd->topology.height * sizeof(uint16_t));
+		if(matrixd->gain_lut == NULL || matrixd->gain_map == NULL)
+			goto exit_buffers;
+		topology_gain_tables(&matrixd->topology, matrixd->gain_lut, matrixd->gain_map);
+	}
+	// The refresh thread starts on buffer 0, all three must be distinct
+	matrixd->back = 1;
+	matrixd->ready = 2;
+
+	if(input == INPUT_SHM && open_ring(matrixd, shm_name))
+		goto exit_buffers;
+
+	if((sim ? llgpio_init_sim() : llgpio_init()) != 0)
+	{
+		fprintf(stderr, "Failed to access GPIOs\n");
+		goto exit_ring;
+	}
+	if(verbose)
+		fprintf(stderr, "gpio backend %s\n", llgpio_backend_name());
+	delay_init(-1);
+	gpio_set_outputs(matrixd->encoder.mask_all);
+	gpio_set_bits(matrixd->encoder.oe);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = signalhandler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	// Page faults in the refresh thread show up as flicker
+	if(mlockall(MCL_CURRENT | MCL_FUTURE))
+		perror("mlockall");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+	pthread_barrier_init(&matrixd->start, NULL, matrixd->num_workers + 1);
+	pthread_barrier_init(&matrixd->done, NULL, matrixd->num_workers + 1);
+	for(i = 0; i < matrixd->num_workers; i++)
+	{
+		struct worker* worker = &matrixd->workers[i];
+		worker->matrixd = matrixd;
+		worker->first_address = i * matrixd->topology.scan.addresses / matrixd->num_workers;
+		worker->last_address = (i + 1) * matrixd->topology.scan.addresses / matrixd->num_workers;
+		worker->lines = malloc(ADAMTX_LINES_LEN(&matrixd->encoder) * sizeof(uint32_t));
+		if(worker->lines == NULL)
+		{
+			fprintf(stderr, "Failed to allocate encoder scratch\n");
+			goto exit_gpio;
+		}
+		// Workers already started stay blocked on the barrier until exit
+		if(pthread_create(&worker->thread, &attr, encode_worker, worker))
+		{
+			fprintf(stderr, "Failed to start encoder threads\n");
+			goto exit_gpio;
+		}
+	}
+
+	// Black with valid row addresses until the first frame arrives
+	process_frame(matrixd, rgb);
+	if((err = start_refresh_thread(&refresh, matrixd, priority, cpu)))
+	{
+		fprintf(stderr, "Failed to start refresh thread (%d)\n", err);
+		pthread_attr_destroy(&attr);
+		run = 0;
+		goto exit_workers;
+	}
+	if(verbose && pthread_create(&stats, &attr, stats_thread, matrixd))
+		verbose = 0;
+	pthread_attr_destroy(&attr);
+
+	if(input == INPUT_SHM)
+		read_ring(matrixd, rgb);
+	else
+		read_pipe(matrixd, rgb);
+
+	run = 0;
+	pthread_join(refresh, NULL);
+	if(verbose)
+		pthread_join(stats, NULL);
+	ret = 0;
+exit_workers:
+	// Workers see stop once released from the start barrier
+	matrixd->stop = 1;
+	pthread_barrier_wait(&matrixd->start);
+	for(i = 0; i < matrixd->num_workers; i++)
+		pthread_join(matrixd->workers[i].thread, NULL);
+exit_gpio:
+	llgpio_close();
+exit_ring:
+	if(matrixd->ring)
+	{
+		munmap(matrixd->ring, matrixd->ring_size);
+		shm_unlink(shm_name);
+	}
+exit_buffers:
+	for(i = 0; i < NUM_BUFFERS; i++)
+		free(matrixd->buffers[i]);
+	for(i = 0; i < MAX_WORKERS; i++)
+		free(matrixd->workers[i].lines);
+	free(rgb);
+	free(matrixd->intermediate);
+	free(matrixd->gain_map);
+	free(matrixd->gain_lut);
+	free(matrixd->remap_table);
+	adamtx_encoder_free(&matrixd->encoder);
+	free(matrixd);
+	return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef _MATRIXD_H
+#define _MATRIXD_H
+
+#include <stdint.h>
+
+/*
+ * Frame input of matrixd through POSIX shared memory, created by the daemon.
+ * A producer writes a display sized RGB frame into slot write_seq % slots,
+ * then increments write_seq with release semantics. The daemon only shows
+ * the newest complete frame and drops frames the producer overtook while
+ * they were copied. The header besides write_seq is written once by the
+ * daemon for producers to read, the daemon never trusts it.
+ */
+#define MATRIXD_SHM_NAME		"/matrixd"
+#define MATRIXD_RING_MAGIC		0x444D5841	// "AXMD"
+#define MATRIXD_RING_VERSION	1
+#define MATRIXD_RING_SLOTS		4
+#define MATRIXD_PIX_LEN			3
+
+struct matrixd_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t slots;
+	uint32_t frame_size;
+	uint64_t write_seq;
+	// Followed by slots * frame_size bytes of RGB frames
+	uint8_t frames[];
+};
+
+#define MATRIXD_RING_SIZE(width, height) (sizeof(struct matrixd_ring) + MATRIXD_RING_SLOTS * (width) * (height) * MATRIXD_PIX_LEN)
+
+#endif
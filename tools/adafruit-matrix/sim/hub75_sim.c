@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "encoder.h"
+#include "io.h"
+#include "hub75_sim.h"
+
+// Same GPIOs as the driver accepts in io.c, writes to others are dropped like there
+const uint32_t adamtx_valid_gpio_bits = ((1 <<  0) | (1 <<  1) |
+   (1 <<  2) | (1 <<  3) |
+   (1 <<  4) | (1 <<  7) | (1 << 8) | (1 <<  9) |
+   (1 << 10) | (1 << 11) | (1 << 14) | (1 << 15)| (1 <<17) | (1 << 18) |
+   (1 << 22) | (1 << 23) | (1 << 24) | (1 << 25)| (1 << 27) |
+   (1 <<  5) | (1 <<  6) | (1 << 12) | (1 << 13) | (1 << 16) |
+   (1 << 19) | (1 << 20) | (1 << 21) | (1 << 26));
+
+// The io.h interface has no handle, writes go to the last initialized simulation
+static struct hub75_sim* hub75_sim_active = NULL;
+
+static int hub75_sim_address(struct hub75_sim* sim)
+{
+	int i, address = 0;
+	struct adamtx_encoder* encoder = sim->encoder;
+	if(encoder->scan.address_mode == ADAMTX_ADDRESS_SHIFT)
+	{
+		// Row driver outputs are active low
+		for(i = 0; i < encoder->scan.addresses; i++)
+		{
+			if(!sim->row_latched[i])
+				return i;
+		}
+		return -1;
+	}
+	for(i = 0; i < ADAMTX_NUM_ADDRESS_PINS; i++)
+	{
+		if(sim->gpios & (1U << encoder->pins[ADAMTX_PIN_A + i]))
+			address |= 1 << i;
+	}
+	return address < encoder->scan.addresses ? address : -1;
+}
+
+// Integrates emission since the last change of OE, latch or row selection
+static void hub75_sim_flush(struct hub75_sim* sim)
+{
+	int k, c, address, upper, lower;
+	uint8_t bits;
+	uint64_t dt = sim->now - sim->segment_start;
+	struct adamtx_encoder* encoder = sim->encoder;
+	sim->segment_start = sim->now;
+	if(!dt || (sim->gpios & encoder->oe))
+		return;
+	address = hub75_sim_address(sim);
+	if(address < 0)
+		return;
+	sim->enabled_time += dt;
+	sim->address_time[address] += dt;
+	if(sim->latches)
+		sim->plane_time[(sim->latches - 1) % encoder->pwm_bits] += dt;
+	upper = address * sim->columns;
+	lower = (sim->rows / 2 + address) * sim->columns;
+	for(k = 0; k < encoder->shift_len; k++)
+	{
+		bits = sim->latched[k];
+		if(!bits)
+			continue;
+		for(c = 0; c < 3; c++)
+		{
+			if(bits & (1 << c))
+				sim->on_time[(upper + sim->pixel_offset[k]) * 3 + c] += dt;
+			if(bits & (8 << c))
+				sim->on_time[(lower + sim->pixel_offset[k]) * 3 + c] += dt;
+		}
+	}
+}
+
+static void hub75_sim_write(struct hub75_sim* sim, uint32_t gpios)
+{
+	int k;
+	uint8_t bits;
+	struct adamtx_encoder* encoder = sim->encoder;
+	int shift_len = encoder->shift_len;
+	uint32_t changed = (sim->gpios ^ gpios) & adamtx_valid_gpio_bits;
+	uint32_t rising = changed & gpios;
+	uint32_t row_clk = 1U << encoder->pins[ADAMTX_PIN_A];
+	uint32_t row_data = 1U << encoder->pins[ADAMTX_PIN_B];
+	gpios = (sim->gpios & ~changed) | (gpios & changed);
+	if(changed & (encoder->oe | encoder->str | encoder->mask_address))
+		hub75_sim_flush(sim);
+	if(rising & encoder->clk)
+	{
+		bits = 0;
+		for(k = 0; k < HUB75_SIM_CHANNELS; k++)
+		{
+			if(gpios & (1U << encoder->pins[ADAMTX_PIN_R1 + k]))
+				bits |= 1 << k;
+		}
+		sim->head = (sim->head + shift_len - 1) % shift_len;
+		sim->shift[sim->head] = bits;
+		sim->clocks++;
+	}
+	if(rising & encoder->str)
+	{
+		for(k = 0; k < shift_len; k++)
+			sim->latched[k] = sim->shift[(sim->head + k) % shift_len];
+		sim->latches++;
+	}
+	// Output stage takes the register contents from before the edge
+	if(encoder->scan.address_mode == ADAMTX_ADDRESS_SHIFT && (rising & row_clk))
+	{
+		memcpy(sim->row_latched, sim->row_shift, encoder->scan.addresses);
+		memmove(sim->row_shift + 1, sim->row_shift, encoder->scan.addresses - 1);
+		sim->row_shift[0] = !!(gpios & row_data);
+	}
+	sim->gpios = gpios;
+	sim->now += sim->write_ns;
+	sim->writes++;
+}
+
+int hub75_sim_init(struct hub75_sim* sim, struct adamtx_encoder* encoder, unsigned long write_ns)
+{
+	int k;
+	int shift_len = encoder->shift_len;
+	int addresses = encoder->scan.addresses;
+	if(encoder->pwm_bits > HUB75_SIM_MAX_PLANES)
+		return -EINVAL;
+	memset(sim, 0, sizeof(struct hub75_sim));
+	sim->encoder = encoder;
+	sim->rows = encoder->scan.rows;
+	sim->columns = encoder->scan.columns;
+	sim->write_ns = write_ns;
+	// OE is active low, the panel starts dark
+	sim->gpios = encoder->oe;
+	sim->shift = calloc(shift_len, 1);
+	sim->latched = calloc(shift_len, 1);
+	sim->row_shift = malloc(addresses);
+	sim->row_latched = malloc(addresses);
+	sim->pixel_offset = malloc(shift_len * sizeof(int));
+	sim->on_time = calloc(sim->rows * sim->columns * 3, sizeof(uint64_t));
+	sim->address_time = calloc(addresses, sizeof(uint64_t));
+	if(!sim->shift || !sim->latched || !sim->row_shift || !sim->row_latched || !sim->pixel_offset || !sim->on_time || !sim->address_time)
+	{
+		hub75_sim_free(sim);
+		return -ENOMEM;
+	}
+	memset(sim->row_shift, 1, addresses);
+	memset(sim->row_latched, 1, addresses);
+	for(k = 0; k < shift_len; k++)
+		sim->pixel_offset[k] = encoder->scan_map ? encoder->scan_map[k] : k;
+	hub75_sim_active = sim;
+	return 0;
+}
+
+void hub75_sim_free(struct hub75_sim* sim)
+{
+	free(sim->shift);
+	free(sim->latched);
+	free(sim->row_shift);
+	free(sim->row_latched);
+	free(sim->pixel_offset);
+	free(sim->on_time);
+	free(sim->address_time);
+	memset(sim, 0, sizeof(struct hub75_sim));
+	if(hub75_sim_active == sim)
+		hub75_sim_active = NULL;
+}
+
+void hub75_sim_image(struct hub75_sim* sim, uint32_t* image)
+{
+	int i, c;
+	uint64_t value, full;
+	hub75_sim_flush(sim);
+	// A fully lit LED emits whenever its address is selected
+	full = sim->enabled_time / sim->encoder->scan.addresses;
+	for(i = 0; i < sim->rows * sim->columns; i++)
+	{
+		image[i] = 0;
+		for(c = 0; c < 3; c++)
+		{
+			value = full ? (sim->on_time[i * 3 + c] * 255 + full / 2) / full : 0;
+			image[i] |= (value > 255 ? 255 : value) << (16 - 8 * c);
+		}
+	}
+}
+
+// io.h backend
+
+int adamtx_gpio_alloc(void)
+{
+	return hub75_sim_active ? 0 : -ENODEV;
+}
+
+void adamtx_gpio_free(void)
+{
+}
+
+void adamtx_gpio_set_outputs(uint32_t outputs)
+{
+}
+
+void adamtx_gpio_set_bits(uint32_t value)
+{
+	hub75_sim_write(hub75_sim_active, hub75_sim_active->gpios | value);
+}
+
+void adamtx_gpio_clr_bits(uint32_t value)
+{
+	hub75_sim_write(hub75_sim_active, hub75_sim_active->gpios & ~value);
+}
+
+void adamtx_gpio_write_bits(uint32_t value)
+{
+	adamtx_gpio_clr_bits(~value);
+	adamtx_gpio_set_bits(value);
+}
+
+void adamtx_gpio_write_masked_bits(uint32_t value, uint32_t mask)
+{
+	adamtx_gpio_clr_bits(~value & mask);
+	adamtx_gpio_set_bits(value & mask);
+}
+
+void ndelay(unsigned long ns)
+{
+	hub75_sim_active->now += ns;
+}
@@ -0,0 +1,51 @@
+#ifndef _HUB75_SIM_H
+#define _HUB75_SIM_H
+
+#include <stdint.h>
+
+#include "encoder.h"
+
+#define HUB75_SIM_CHANNELS	6
+#define HUB75_SIM_MAX_PLANES	8
+
+/*
+ * Model of a HUB75 chain driven through the io.h functions. Every GPIO write
+ * costs write_ns of simulated time, ndelay() advances it as requested. LEDs
+ * of the selected row emit while OE is low, with the bits latched by the last
+ * STR edge. Emission time is integrated per LED and channel.
+ */
+typedef struct hub75_sim {
+	struct adamtx_encoder*	encoder;
+	int			rows;
+	int			columns;
+	unsigned long	write_ns;
+	uint32_t	gpios;
+	uint64_t	now;
+	uint64_t	segment_start;
+	// Color shift register as a ring, position k is at (head + k) % shift_len
+	uint8_t*	shift;
+	int			head;
+	uint8_t*	latched;
+	// Row select register of shift addressing and its output stage
+	uint8_t*	row_shift;
+	uint8_t*	row_latched;
+	// Pixel of position k relative to the first pixel driven by an address
+	int*		pixel_offset;
+	// Emitting time per LED channel, R G B of each chain pixel
+	uint64_t*	on_time;
+	uint64_t*	address_time;
+	uint64_t	enabled_time;
+	uint64_t	plane_time[HUB75_SIM_MAX_PLANES];
+	unsigned long	latches;
+	unsigned long	clocks;
+	unsigned long	writes;
+} hub75_sim;
+
+int hub75_sim_init(struct hub75_sim* sim, struct adamtx_encoder* encoder, unsigned long write_ns);
+
+void hub75_sim_free(struct hub75_sim* sim);
+
+// Perceived chain image, each channel scaled to the emission of a fully lit LED
+void hub75_sim_image(struct hub75_sim* sim, uint32_t* image);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * Runs the refresh loop of the adafruit-matrix-rpi driver (refresh.c) against
+ * a simulated HUB75 chain and reports what the panel would show. No hardware
+ * or root needed, so refresh changes can be checked in CI.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I../../../modules/adafruit-matrix-rpi -o refresh_sim refresh_sim.c hub75_sim.c \
+ *       ../../../modules/adafruit-matrix-rpi/refresh.c ../../../modules/adafruit-matrix-rpi/encoder.c
+ *
+ * Usage:
+ *   refresh_sim [-W columns] [-H rows] [-s scan] [-a direct|shift] [-z zigzag] [-Z] [-d dither_bits]
+ *               [-r refreshes] [-w write_ns] [-p black|gradient|lines|noise | -i chain.ppm] [-o perceived.ppm]
+ *               [-e max_error] [-g max_ghost] [-l power_scale]
+ *
+ * The frame is encoded like the driver does and shown for the given number of
+ * refreshes, twice: once with free GPIO writes, giving the image the bitplanes
+ * describe, and once with every write taking write_ns, which adds the shifting
+ * overhead a real refresh has. Reported are refresh rate, OE duty cycle,
+ * effective bitplane weights, the error of the timed image against the ideal
+ * one and ghosting, light on pixels that are black in the input. With -e or -g
+ * the exit status is 1 if the timed image exceeds the given error or ghosting.
+ * -l shows the frame with the on-time scale of the power limiter, 0 to 256.
+ * Without it OE stays low during clock out, as on displays without a limit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "encoder.h"
+#include "refresh.h"
+#include "hub75_sim.h"
+
+#define PWM_BITS			8
+#define DEFAULT_COLUMNS		128
+#define DEFAULT_ROWS		32
+#define DEFAULT_WRITE_NS	20
+#define DEFAULT_REFRESHES	8
+
+// Default pinout of the driver
+static const uint32_t pins[ADAMTX_NUM_PINS] = {11, 27, 7, 8, 9, 10, 22, 23, 24, 25, 15, 18, 4, 17};
+
+struct result {
+	uint64_t time;
+	uint64_t enabled_time;
+	uint64_t plane_time[HUB75_SIM_MAX_PLANES];
+	unsigned long writes;
+	uint32_t* image;
+};
+
+static int read_ppm(const char* path, uint32_t* frame, int columns, int rows)
+{
+	FILE* file;
+	int width, height, maxval, i, ret = -1;
+	uint8_t rgb[3];
+	if((file = fopen(path, "rb")) == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	if(fscanf(file, "P6 %d %d %d", &width, &height, &maxval) != 3 || fgetc(file) == EOF || maxval != 255)
+	{
+		fprintf(stderr, "%s: not a binary 8 bit PPM\n", path);
+		goto exit_close;
+	}
+	if(width != columns || height != rows)
+	{
+		fprintf(stderr, "%s: %dx%d, chain is %dx%d\n", path, width, height, columns, rows);
+		goto exit_close;
+	}
+	for(i = 0; i < columns * rows; i++)
+	{
+		if(fread(rgb, 3, 1, file) != 1)
+		{
+			fprintf(stderr, "%s: short read\n", path);
+			goto exit_close;
+		}
+		frame[i] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+	}
+	ret = 0;
+exit_close:
+	fclose(file);
+	return ret;
+}
+
+static int write_ppm(const char* path, const uint32_t* frame, int columns, int rows)
+{
+	FILE* file;
+	int i;
+	uint8_t rgb[3];
+	if((file = fopen(path, "wb")) == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", columns, rows);
+	for(i = 0; i < columns * rows; i++)
+	{
+		rgb[0] = frame[i] >> 16;
+		rgb[1] = frame[i] >> 8;
+		rgb[2] = frame[i];
+		fwrite(rgb, 3, 1, file);
+	}
+	return fclose(file);
+}
+
+static int fill_pattern(uint32_t* frame, const char* pattern, int columns, int rows)
+{
+	int x, y;
+	uint32_t seed = 0x2545F491;
+	for(y = 0; y < rows; y++)
+	{
+		for(x = 0; x < columns; x++)
+		{
+			if(!strcmp(pattern, "black"))
+				frame[y * columns + x] = 0;
+			else if(!strcmp(pattern, "gradient"))
+				frame[y * columns + x] = (x * 255 / (columns - 1)) << 16 | (y * 255 / (rows - 1)) << 8 | ((x + y) & 0xFF);
+			// Single lit rows between dark ones show ghosting on their neighbours
+			else if(!strcmp(pattern, "lines"))
+				frame[y * columns + x] = y % 4 ? 0 : 0xFFFFFF;
+			else if(!strcmp(pattern, "noise"))
+			{
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				frame[y * columns + x] = seed & 0x00FFFFFF;
+			}
+			else
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int simulate(struct adamtx_encoder* encoder, struct adamtx_panel_io* paneldata, int dither_frames, int refreshes, unsigned long write_ns, unsigned int scale, struct result* result)
+{
+	int i, err;
+	struct hub75_sim sim;
+	int paneldata_len = encoder->pwm_bits * encoder->scan.addresses * encoder->shift_len;
+	if((err = hub75_sim_init(&sim, encoder, write_ns)))
+		return err;
+	for(i = 0; i < refreshes; i++)
+		show_frame(0, encoder, paneldata + (i % dither_frames) * paneldata_len, encoder->pwm_bits, scale);
+	hub75_sim_image(&sim, result->image);
+	result->time = sim.now;
+	result->enabled_time = sim.enabled_time;
+	result->writes = sim.writes;
+	memcpy(result->plane_time, sim.plane_time, sizeof(result->plane_time));
+	hub75_sim_free(&sim);
+	return 0;
+}
+
+static int channel_diff(uint32_t a, uint32_t b, int shift)
+{
+	return abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF));
+}
+
+static void compare(const char* name, const uint32_t* image, const uint32_t* reference, int pixels, int* max_error)
+{
+	int i, shift, diff;
+	uint64_t sum = 0;
+	*max_error = 0;
+	for(i = 0; i < pixels; i++)
+	{
+		for(shift = 0; shift < 24; shift += 8)
+		{
+			diff = channel_diff(image[i], reference[i], shift);
+			sum += diff;
+			if(diff > *max_error)
+				*max_error = diff;
+		}
+	}
+	printf("%-12s mean %.2f max %d (of 255)\n", name, (double)sum / (pixels * 3), *max_error);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-W columns] [-H rows] [-s scan] [-a direct|shift] [-z zigzag] [-Z] [-d dither_bits] [-r refreshes] [-w write_ns]\n"
+		"       [-p black|gradient|lines|noise | -i chain.ppm] [-o perceived.ppm] [-e max_error] [-g max_ghost] [-l power_scale]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt, i, shift, value, err, ret = 1;
+	int dither_frames, max_error, ghost_max = 0, ghost_pixels = 0;
+	int dither_bits = 0, refreshes = DEFAULT_REFRESHES, error_limit = -1, ghost_limit = -1;
+	unsigned long write_ns = DEFAULT_WRITE_NS;
+	unsigned int scale = ADAMTX_POWER_SCALE_OFF;
+	const char* pattern = "gradient";
+	const char* input = NULL;
+	const char* output = NULL;
+	double period;
+	uint32_t* frame = NULL;
+	struct adamtx_panel_io* paneldata = NULL;
+	struct adamtx_encoder encoder;
+	struct result ideal = { 0 }, timed = { 0 };
+	struct adamtx_scan scan = {
+		.rows = DEFAULT_ROWS,
+		.columns = DEFAULT_COLUMNS,
+		.addresses = 0,
+		.address_mode = ADAMTX_ADDRESS_DIRECT
+	};
+	struct adamtx_frame part = { 0 };
+	while((opt = getopt(argc, argv, "W:H:s:a:z:Zd:r:w:p:i:o:e:g:l:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'W':
+				scan.columns = atoi(optarg);
+				break;
+			case 'H':
+				scan.rows = atoi(optarg);
+				break;
+			case 's':
+				scan.addresses = atoi(optarg);
+				break;
+			case 'a':
+				scan.address_mode = strcmp(optarg, "shift") ? ADAMTX_ADDRESS_DIRECT : ADAMTX_ADDRESS_SHIFT;
+				break;
+			case 'z':
+				scan.zigzag = atoi(optarg);
+				break;
+			case 'Z':
+				scan.zigzag_invert = 1;
+				break;
+			case 'd':
+				dither_bits = atoi(optarg);
+				break;
+			case 'r':
+				refreshes = atoi(optarg);
+				break;
+			case 'w':
+				write_ns = strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				pattern = optarg;
+				break;
+			case 'i':
+				input = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'e':
+				error_limit = atoi(optarg);
+				break;
+			case 'g':
+				ghost_limit = atoi(optarg);
+				break;
+			case 'l':
+				scale = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(!scan.addresses)
+		scan.addresses = scan.rows / 2;
+	if(dither_bits < 0 || dither_bits > ADAMTX_DITHER_MAX_BITS || refreshes <= 0 || (scale > ADAMTX_POWER_SCALE_ONE && scale != ADAMTX_POWER_SCALE_OFF))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if((err = adamtx_encoder_init(&encoder, pins, PWM_BITS - dither_bits, &scan)))
+	{
+		fprintf(stderr, "Invalid chain geometry\n");
+		return 1;
+	}
+	// Whole dither cycles only, a partial cycle is not the intended average
+	dither_frames = 1 << dither_bits;
+	refreshes = (refreshes + dither_frames - 1) / dither_frames * dither_frames;
+
+	frame = malloc(scan.rows * scan.columns * sizeof(uint32_t));
+	paneldata = calloc(dither_frames * encoder.pwm_bits * scan.addresses * encoder.shift_len, sizeof(struct adamtx_panel_io));
+	ideal.image = malloc(scan.rows * scan.columns * sizeof(uint32_t));
+	timed.image = malloc(scan.rows * scan.columns * sizeof(uint32_t));
+	if(!frame || !paneldata || !ideal.image || !timed.image)
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto exit_free;
+	}
+	if(input ? read_ppm(input, frame, scan.columns, scan.rows) : fill_pattern(frame, pattern, scan.columns, scan.rows))
+	{
+		if(!input)
+			usage(argv[0]);
+		goto exit_free;
+	}
+
+	// Same as process_frame() of the driver for the whole chain
+	part.width = scan.columns;
+	part.height = scan.rows;
+	part.rows = scan.rows;
+	part.frame = frame;
+	part.pwm_bits = encoder.pwm_bits;
+	part.dither_bits = dither_bits;
+	part.encoder = &encoder;
+	for(i = 0; i < dither_frames; i++)
+	{
+		part.dither_frame = i;
+		part.paneldata = paneldata + i * encoder.pwm_bits * scan.addresses * encoder.shift_len;
+		prerender_frame_part(&part);
+	}
+
+	if(simulate(&encoder, paneldata, dither_frames, refreshes, 0, scale, &ideal) ||
+		simulate(&encoder, paneldata, dither_frames, refreshes, write_ns, scale, &timed))
+	{
+		fprintf(stderr, "Simulation failed\n");
+		goto exit_free;
+	}
+
+	period = (double)timed.time / refreshes;
+	printf("%dx%d chain, 1/%d scan, %d bits + %d dither, %d refreshes, %lu ns per GPIO write\n",
+		scan.columns, scan.rows, scan.addresses, encoder.pwm_bits, dither_bits, refreshes, write_ns);
+	printf("refresh      %.1f us, %.1f Hz, %.1f Hz per dither cycle, %lu writes\n",
+		period / 1000, 1e9 / period, 1e9 / period / dither_frames, timed.writes / refreshes);
+	printf("duty cycle   %.1f %% (ideal timing %.1f %%)\n",
+		100.0 * timed.enabled_time / timed.time, ideal.time ? 100.0 * ideal.enabled_time / ideal.time : 100.0);
+	// Shifting the next plane happens while the current one is shown and stretches it
+	printf("planes      ");
+	for(i = 0; i < encoder.pwm_bits; i++)
+		printf(" %.2f", (double)timed.plane_time[i] / ((double)refreshes * scan.addresses * (1 << i) * ADAMTX_BCD_TIME_NS));
+	printf(" x ideal on-time\n");
+
+	compare("quantization", ideal.image, frame, scan.rows * scan.columns, &max_error);
+	compare("timing", timed.image, ideal.image, scan.rows * scan.columns, &max_error);
+	for(i = 0; i < scan.rows * scan.columns; i++)
+	{
+		for(shift = 0; shift < 24; shift += 8)
+		{
+			if((frame[i] >> shift) & 0xFF)
+				continue;
+			value = (timed.image[i] >> shift) & 0xFF;
+			if(value > ghost_max)
+				ghost_max = value;
+			if(value)
+				ghost_pixels++;
+		}
+	}
+	printf("ghosting     max %d (of 255) on %d dark channels\n", ghost_max, ghost_pixels);
+
+	if(output && write_ppm(output, timed.image, scan.columns, scan.rows))
+		goto exit_free;
+	ret = 0;
+	if(error_limit >= 0 && max_error > error_limit)
+		ret = 1;
+	if(ghost_limit >= 0 && ghost_max > ghost_limit)
+		ret = 1;
+exit_free:
+	free(timed.image);
+	free(ideal.image);
+	free(paneldata);
+	free(frame);
+	adamtx_encoder_free(&encoder);
+	return ret;
+}
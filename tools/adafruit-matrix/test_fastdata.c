@@ -12,6 +12,7 @@
 
 #include "io.h"
 #include "matrix.h"
+#include "delay.h"
 
 #define GPIO_R1		11
 #define GPIO_R2		8
@@ -135,20 +136,6 @@ void llgpio_setup()
 #define GPIO_LO(gpio) gpio_clr_bits((1 << gpio))
 #define GPIO_SET(gpio, state) (state ? GPIO_HI(gpio) : GPIO_LO(gpio))
 
-inline void nanosleep_real(long nanos)
-{
-//	printf("sleeping for %ld\n", nanos);
-	struct timespec spec = {0, nanos};
-	struct timespec remain = {0, 0};
-	do
-	{
-		nanosleep(&spec, &remain);
-//		printf("Continuing sleep for %ld\n", (&remain)->tv_nsec);
-//		assert(0);
-	}
-	while(((&remain)->tv_nsec + (&remain)->tv_sec * 1000000000UL) > 0 && 0);
-}
-
 void display_row(struct panel_io* data, int length)
 {
 	while(--length >= 0)
@@ -187,6 +174,7 @@ int fork_child()
 
 void signalhandler(int sig)
 {
+	struct delay_stats delays;
 	printf("Signal: %d\n", sig);
 	if(sig == SIGINT)
 		run = 0;
@@ -194,6 +182,8 @@ void signalhandler(int sig)
 	{
 		numchld--;
 		printf("%ld updates per second\n", updates);
+		delay_stats_take(&delays);
+		delay_stats_print(stdout, &delays);
 		updates = 0;
 		if(run)
 		{
@@ -320,7 +310,7 @@ void show_frame(struct panel_io* frame, int bits, int rows, int columns)
 			//gpio_clr_bits(GPIO_CLOCK_MASK | GPIO_DATA_MASK);
 			GPIO_HI(GPIO_STR);
 			GPIO_LO(GPIO_STR);
-			nanosleep_real(( 1 << j) * BASE_TIME);
+			delay_ns((1 << j) * BASE_TIME);
 		}
 	}
 }
@@ -388,6 +378,7 @@ int main(int argc, char** argv)
 	if(llgpio_init() != 0)
 		return -EPERM;
 	llgpio_setup();
+	delay_init(-1);
 
 	struct matrix_ledpanel* ledpanels[NUM_PANELS] = {
 		&matrix_low,
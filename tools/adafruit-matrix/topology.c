@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topology.h"
+
+static int max(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+static int parse_panel(struct topology* topology, char* args)
+{
+	char name[64], flags[3][32] = {"", "", ""};
+	struct matrix_ledpanel* panel;
+	int i, fields;
+	unsigned int gain[3];
+	char end;
+	if(topology->num_panels >= MAX_PANELS)
+		return -1;
+	panel = &topology->panel_store[topology->num_panels];
+	fields = sscanf(args, "%63s %d %d %d %d %d %d %31s %31s %31s", name, &panel->xres, &panel->yres,
+		&panel->virtual_x, &panel->virtual_y, &panel->realx, &panel->realy, flags[0], flags[1], flags[2]);
+	if(fields < 7)
+		return -1;
+	memset(panel->gain, ADAMTX_GAIN_UNITY, sizeof(panel->gain));
+	for(i = 0; i < 3; i++)
+	{
+		if(!strncmp(flags[i], "gain=", 5))
+		{
+			// Same as adafruit,color-gain, one value per channel
+			if(sscanf(flags[i] + 5, "%u,%u,%u%c", &gain[0], &gain[1], &gain[2], &end) != 3 ||
+				gain[0] > ADAMTX_GAIN_UNITY || gain[1] > ADAMTX_GAIN_UNITY || gain[2] > ADAMTX_GAIN_UNITY)
+				return -1;
+			panel->gain[0] = gain[0];
+			panel->gain[1] = gain[1];
+			panel->gain[2] = gain[2];
+		}
+	}
+	panel->name = strdup(name);
+	panel->flip_x = !strcmp(flags[0], "flip-x") || !strcmp(flags[1], "flip-x") || !strcmp(flags[2], "flip-x");
+	panel->flip_y = !strcmp(flags[0], "flip-y") || !strcmp(flags[1], "flip-y") || !strcmp(flags[2], "flip-y");
+	topology->panels[topology->num_panels] = panel;
+	topology->num_panels++;
+	return 0;
+}
+
+int parse_topology(struct topology* topology, const char* path)
+{
+	int i, line = 0;
+	char buffer[256], key[32], mode[32];
+	char* args;
+	FILE* file = fopen(path, "r");
+	if(file == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	memset(topology, 0, sizeof(struct topology));
+	while(fgets(buffer, sizeof(buffer), file))
+	{
+		line++;
+		if(sscanf(buffer, "%31s", key) != 1 || key[0] == '#')
+			continue;
+		args = buffer + strspn(buffer, " \t") + strlen(key);
+		if(!strcmp(key, "pinout"))
+		{
+			for(i = 0; i < ADAMTX_NUM_PINS; i++)
+			{
+				if(sscanf(args, "%u", &topology->pins[i]) != 1)
+					goto exit_err;
+				args += strspn(args, " \t");
+				args += strspn(args, "0123456789");
+			}
+		}
+		else if(!strcmp(key, "scan"))
+		{
+			if(sscanf(args, "%d", &topology->scan.addresses) != 1)
+				goto exit_err;
+		}
+		else if(!strcmp(key, "address-mode"))
+		{
+			if(sscanf(args, "%31s", mode) != 1)
+				goto exit_err;
+			if(!strcmp(mode, "direct"))
+				topology->scan.address_mode = ADAMTX_ADDRESS_DIRECT;
+			else if(!strcmp(mode, "shift-register"))
+				topology->scan.address_mode = ADAMTX_ADDRESS_SHIFT;
+			else
+				goto exit_err;
+		}
+		else if(!strcmp(key, "zigzag"))
+		{
+			if(sscanf(args, "%d %d", &topology->scan.zigzag, &topology->scan.zigzag_invert) < 1)
+				goto exit_err;
+		}
+		else if(!strcmp(key, "dither-bits"))
+		{
+			if(sscanf(args, "%d", &topology->dither_bits) != 1 || topology->dither_bits < 0 || topology->dither_bits > ADAMTX_DITHER_MAX_BITS)
+				goto exit_err;
+		}
+		else if(!strcmp(key, "panel"))
+		{
+			if(parse_panel(topology, args))
+				goto exit_err;
+		}
+		else
+			goto exit_err;
+	}
+	fclose(file);
+
+	if(topology->num_panels == 0)
+	{
+		fprintf(stderr, "%s: no panels\n", path);
+		return -1;
+	}
+	// Same derivation as the driver
+	for(i = 0; i < topology->num_panels; i++)
+	{
+		struct matrix_ledpanel* panel = topology->panels[i];
+		topology->scan.columns = max(topology->scan.columns, panel->virtual_x + panel->xres);
+		topology->scan.rows = max(topology->scan.rows, panel->virtual_y + panel->yres);
+		topology->width = max(topology->width, panel->realx + panel->xres);
+		topology->height = max(topology->height, panel->realy + panel->yres);
+	}
+	if(topology->scan.addresses == 0)
+		topology->scan.addresses = topology->scan.rows / 2;
+	return 0;
+
+exit_err:
+	fprintf(stderr, "%s:%d: invalid line\n", path, line);
+	fclose(file);
+	return -1;
+}
+
+void topology_remap_table(const struct topology* topology, uint32_t* table)
+{
+	int x, y;
+	struct matrix_ledpanel* panel;
+	struct matrix_pos pos;
+	for(y = 0; y < topology->height; y++)
+	{
+		for(x = 0; x < topology->width; x++)
+		{
+			panel = matrix_get_panel_at_real((struct matrix_ledpanel**)topology->panels, topology->num_panels, x, y);
+			if(panel == NULL)
+			{
+				table[y * topology->width + x] = topology->scan.rows * topology->scan.columns;
+				continue;
+			}
+			matrix_panel_get_position(&pos, panel, x, y);
+			table[y * topology->width + x] = pos.y * topology->scan.columns + pos.x;
+		}
+	}
+}
+
+int topology_calibrated(const struct topology* topology)
+{
+	int i, j;
+	for(i = 0; i < topology->num_panels; i++)
+	{
+		for(j = 0; j < 3; j++)
+		{
+			if(topology->panel_store[i].gain[j] != ADAMTX_GAIN_UNITY)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+void topology_gain_tables(const struct topology* topology, uint8_t* lut, uint16_t* map)
+{
+	int i;
+	struct matrix_ledpanel* panel;
+	for(i = 0; i < topology->num_panels; i++)
+		adamtx_gain_fill_lut(lut + i * ADAMTX_GAIN_LUT_LEN, topology->panel_store[i].gain);
+	if(map == NULL)
+		return;
+	for(i = 0; i < topology->width * topology->height; i++)
+	{
+		panel = matrix_get_panel_at_real((struct matrix_ledpanel**)topology->panels, topology->num_panels, i % topology->width, i / topology->width);
+		map[i] = panel ? panel - topology->panel_store : 0;
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <stdint.h>
+
+#include "matrix.h"
+#include "encoder.h"
+#include "remap.h"
+
+#define MAX_PANELS	32
+
+/*
+ * Display description shared by the tools, same keys as the device tree node
+ * of the driver. See frame_compiler.c for the file format.
+ */
+struct topology {
+	uint32_t pins[ADAMTX_NUM_PINS];
+	struct adamtx_scan scan;
+	int dither_bits;
+	int width;
+	int height;
+	int num_panels;
+	struct matrix_ledpanel panel_store[MAX_PANELS];
+	struct matrix_ledpanel* panels[MAX_PANELS];
+};
+
+int parse_topology(struct topology* topology, const char* path);
+
+// Chain position of every display pixel, pixels no panel covers map to the spare slot rows * columns
+void topology_remap_table(const struct topology* topology, uint32_t* table);
+
+// Whether any panel has a color gain other than 255
+int topology_calibrated(const struct topology* topology);
+
+/*
+ * Gain tables of all panels, num_panels * ADAMTX_GAIN_LUT_LEN bytes, and if
+ * map isn't NULL the panel index of every display pixel, same layout as in
+ * the driver. Pixels no panel covers use the first table.
+ */
+void topology_gain_tables(const struct topology* topology, uint8_t* lut, uint16_t* map);
+
+#endif